@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  ISO 7816-4 command chaining and response chaining (61xx/6Cxx).
+ */
+
+#include "ApduChain.h"
+
+#include <algorithm>
+
+namespace {
+const size_t kHeaderLen = 4;        // CLA INS P1 P2
+const size_t kMaxShortData = 255;   // largest Lc of a short APDU
+const uint8_t kClaChaining = 0x10;  // command is not the last of a chain
+const uint8_t kInsGetResponse = 0xC0;
+}  // namespace
+
+/*******************************************************************************
+**
+** Function:        splitCommand
+**
+** Description:     Split an extended-length command APDU into a chain of
+**                  short APDUs.
+**                  apdu: command APDU.
+**                  apduLen: length of the command APDU.
+**                  maxLen: longest APDU the controller can send.
+**                  chain: receives the short APDUs.
+**
+** Returns:         True if split.
+**
+*******************************************************************************/
+bool ApduChain::splitCommand(const uint8_t* apdu, size_t apduLen,
+                             size_t maxLen, std::vector<Apdu>* chain) {
+  // extended Lc is 00 followed by two length bytes
+  if ((apduLen <= maxLen) || (apduLen < kHeaderLen + 3) ||
+      (apdu[kHeaderLen] != 0) || (maxLen <= kHeaderLen + 2))
+    return false;
+  size_t const lc = (apdu[kHeaderLen + 1] << 8) | apdu[kHeaderLen + 2];
+  size_t const dataOffset = kHeaderLen + 3;
+  if ((lc == 0) || (dataOffset + lc > apduLen)) return false;
+
+  // an extended Le is two bytes; 0000 asks for as much as possible
+  size_t const leLen = apduLen - dataOffset - lc;
+  if ((leLen != 0) && (leLen != 2)) return false;
+  bool const hasLe = (leLen == 2);
+  size_t const le =
+      hasLe ? ((apdu[apduLen - 2] << 8) | apdu[apduLen - 1]) : 0;
+
+  // header, Lc and Le around each piece of data
+  size_t const chunkMax = std::min(kMaxShortData, maxLen - kHeaderLen - 2);
+  chain->clear();
+  for (size_t offset = 0; offset < lc; offset += chunkMax) {
+    size_t const chunk = std::min(chunkMax, lc - offset);
+    bool const last = (offset + chunk == lc);
+    Apdu piece(apdu, apdu + kHeaderLen);
+    if (!last) piece[0] |= kClaChaining;
+    piece.push_back((uint8_t)chunk);
+    piece.insert(piece.end(), apdu + dataOffset + offset,
+                 apdu + dataOffset + offset + chunk);
+    // a short Le of 00 asks for up to 256 bytes
+    if (last && hasLe) piece.push_back((le > 0 && le < 256) ? le : 0);
+    chain->push_back(piece);
+  }
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        getResponse
+**
+** Description:     Build the GET RESPONSE that fetches the rest of a
+**                  response after 61xx.
+**                  cla: CLA of the command that was answered.
+**                  le: SW2 of the 61xx status word.
+**
+** Returns:         GET RESPONSE APDU.
+**
+*******************************************************************************/
+ApduChain::Apdu ApduChain::getResponse(uint8_t cla, uint8_t le) {
+  // keep the logical channel of an interindustry class
+  uint8_t const channel = (cla & 0x80) ? 0 : (cla & 0x03);
+  return Apdu{channel, kInsGetResponse, 0x00, 0x00, le};
+}
+
+/*******************************************************************************
+**
+** Function:        setLe
+**
+** Description:     Replace or add the Le of a short APDU.
+**                  apdu: short command APDU, modified in place.
+**                  le: SW2 of the 6Cxx status word.
+**
+** Returns:         False if the APDU is not a well-formed short APDU.
+**
+*******************************************************************************/
+bool ApduChain::setLe(Apdu* apdu, uint8_t le) {
+  size_t const len = apdu->size();
+  if (len < kHeaderLen) return false;
+  if (len == kHeaderLen) {  // case 1: no body
+    apdu->push_back(le);
+    return true;
+  }
+  if (len == kHeaderLen + 1) {  // case 2: Le only
+    (*apdu)[kHeaderLen] = le;
+    return true;
+  }
+  size_t const lc = (*apdu)[kHeaderLen];
+  if (lc == 0) return false;         // extended length
+  if (len == kHeaderLen + 1 + lc) {  // case 3: Lc and data
+    apdu->push_back(le);
+    return true;
+  }
+  if (len == kHeaderLen + 2 + lc) {  // case 4: Lc, data and Le
+    apdu->back() = le;
+    return true;
+  }
+  return false;
+}
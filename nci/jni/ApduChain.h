@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  ISO 7816-4 command chaining and response chaining (61xx/6Cxx).
+ */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+class ApduChain {
+ public:
+  typedef std::vector<uint8_t> Apdu;
+
+  /*******************************************************************************
+  **
+  ** Function:        splitCommand
+  **
+  ** Description:     Split an extended-length command APDU that is longer
+  **                  than the frame limit into a chain of short APDUs, with
+  **                  the chaining bit set in the CLA of all but the last.
+  **                  apdu: command APDU.
+  **                  apduLen: length of the command APDU.
+  **                  maxLen: longest APDU the controller can send.
+  **                  chain: receives the short APDUs.
+  **
+  ** Returns:         True if split; false if the APDU fits or is not an
+  **                  extended-length command APDU with data.
+  **
+  *******************************************************************************/
+  static bool splitCommand(const uint8_t* apdu, size_t apduLen, size_t maxLen,
+                           std::vector<Apdu>* chain);
+
+  /*******************************************************************************
+  **
+  ** Function:        getResponse
+  **
+  ** Description:     Build the GET RESPONSE that fetches the rest of a
+  **                  response after 61xx.
+  **                  cla: CLA of the command that was answered.
+  **                  le: SW2 of the 61xx status word.
+  **
+  ** Returns:         GET RESPONSE APDU.
+  **
+  *******************************************************************************/
+  static Apdu getResponse(uint8_t cla, uint8_t le);
+
+  /*******************************************************************************
+  **
+  ** Function:        setLe
+  **
+  ** Description:     Replace or add the Le of a short APDU, to repeat it after
+  **                  6Cxx with the exact length.
+  **                  apdu: short command APDU, modified in place.
+  **                  le: SW2 of the 6Cxx status word.
+  **
+  ** Returns:         False if the APDU is not a well-formed short APDU.
+  **
+  *******************************************************************************/
+  static bool setLe(Apdu* apdu, uint8_t le);
+};
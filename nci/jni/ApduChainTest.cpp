@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include "ApduChain.h"
+
+// Test an extended APDU is split into short APDUs carrying all its data
+TEST(ApduChainTest, SplitCommand) {
+  ApduChain::Apdu apdu = {0x00, 0xDA, 0x01, 0x02, 0x00, 0x01, 0x2C};
+  for (int i = 0; i < 300; i++) apdu.push_back((uint8_t)i);
+  apdu.push_back(0x00);  // Le 0000
+  apdu.push_back(0x00);
+
+  std::vector<ApduChain::Apdu> chain;
+  ASSERT_TRUE(ApduChain::splitCommand(apdu.data(), apdu.size(), 261, &chain));
+  ASSERT_EQ(chain.size(), 2u);
+  ASSERT_EQ(chain[0][0], 0x10);  // chaining bit
+  ASSERT_EQ(chain[0][4], 255);
+  ASSERT_EQ(chain[0].size(), 4u + 1 + 255);
+  ASSERT_EQ(chain[1][0], 0x00);
+  ASSERT_EQ(chain[1][4], 45);
+  ASSERT_EQ(chain[1].size(), 4u + 1 + 45 + 1);  // keeps Le
+  ASSERT_EQ(chain[1][5], 255);
+  ASSERT_EQ(chain[1].back(), 0x00);
+}
+
+// Test APDUs that fit, or are not extended, are left alone
+TEST(ApduChainTest, NoSplit) {
+  std::vector<ApduChain::Apdu> chain;
+  ApduChain::Apdu select = {0x00, 0xA4, 0x04, 0x00, 0x02, 0x3F, 0x00, 0x00};
+  ASSERT_FALSE(
+      ApduChain::splitCommand(select.data(), select.size(), 261, &chain));
+  ASSERT_FALSE(ApduChain::splitCommand(select.data(), select.size(), 4, &chain));
+}
+
+// Test GET RESPONSE and the Le of a repeated command
+TEST(ApduChainTest, ResponseChaining) {
+  ASSERT_EQ(ApduChain::getResponse(0x01, 0x20),
+            (ApduChain::Apdu{0x01, 0xC0, 0x00, 0x00, 0x20}));
+  ASSERT_EQ(ApduChain::getResponse(0x84, 0x00),
+            (ApduChain::Apdu{0x00, 0xC0, 0x00, 0x00, 0x00}));
+
+  ApduChain::Apdu readBinary = {0x00, 0xB0, 0x00, 0x00, 0x00};
+  ASSERT_TRUE(ApduChain::setLe(&readBinary, 0x12));
+  ASSERT_EQ(readBinary.back(), 0x12);
+  ApduChain::Apdu update = {0x00, 0xD6, 0x00, 0x00, 0x01, 0xAA};
+  ASSERT_TRUE(ApduChain::setLe(&update, 0x04));
+  ASSERT_EQ(update.size(), 7u);
+  ApduChain::Apdu truncated = {0x00, 0xD6, 0x00, 0x00, 0x05, 0xAA};
+  ASSERT_FALSE(ApduChain::setLe(&truncated, 0x04));
+}
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Size-classed pool of data buffers shared by the JNI layer.
+ */
+
+#include "BufferPool.h"
+
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using android::base::StringPrintf;
+
+namespace {
+// short APDU, 253/255/261-octet frame, and two steps of extended length;
+// anything larger comes straight from the heap
+const uint32_t kDefaultClassSizes[] = {64, 288, 1024, 4096};
+const uint32_t kDefaultMaxFreePerClass = 16;
+}  // namespace
+
+/*******************************************************************************
+**
+** Function:        BufferPool
+**
+** Description:     Initialize member variables.
+**                  classSizes: usable size of each class, ascending.
+**                  numClasses: number of classes; at most kMaxClasses.
+**                  maxFreePerClass: free blocks kept per class.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+BufferPool::BufferPool(const uint32_t* classSizes, size_t numClasses,
+                       uint32_t maxFreePerClass)
+    : mNumClasses(0),
+      mMaxFreePerClass(maxFreePerClass),
+      mPoolHits(0),
+      mPoolMisses(0),
+      mOversized(0),
+      mReleases(0),
+      mOutstanding(0) {
+  if (numClasses > kMaxClasses) {
+    LOG(ERROR) << StringPrintf("%s: too many classes %zu", __func__,
+                               numClasses);
+    numClasses = kMaxClasses;
+  }
+  for (size_t i = 0; i < numClasses; i++) {
+    if ((i > 0) && (classSizes[i] <= classSizes[i - 1])) {
+      LOG(ERROR) << StringPrintf("%s: class sizes not ascending", __func__);
+      break;
+    }
+    mClasses[i].size = classSizes[i];
+    mClasses[i].freeCount = 0;
+    mClasses[i].freeList = NULL;
+    mNumClasses++;
+  }
+}
+
+/*******************************************************************************
+**
+** Function:        ~BufferPool
+**
+** Description:     Release all cached blocks.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+BufferPool::~BufferPool() {
+  for (size_t i = 0; i < mNumClasses; i++) {
+    Block* block = mClasses[i].freeList;
+    while (block) {
+      Block* next = block->next;
+      free(block);
+      block = next;
+    }
+  }
+}
+
+/*******************************************************************************
+**
+** Function:        getInstance
+**
+** Description:     Get the pool shared by the JNI layer.
+**
+** Returns:         Reference to BufferPool object.
+**
+*******************************************************************************/
+BufferPool& BufferPool::getInstance() {
+  // never destroyed, so static objects may release buffers at exit
+  static BufferPool* pool = new BufferPool(
+      kDefaultClassSizes,
+      sizeof(kDefaultClassSizes) / sizeof(kDefaultClassSizes[0]),
+      kDefaultMaxFreePerClass);
+  return *pool;
+}
+
+/*******************************************************************************
+**
+** Function:        allocate
+**
+** Description:     Get a buffer of at least the given size.
+**                  size: number of octets needed.
+**
+** Returns:         Buffer; NULL if out of memory.
+**
+*******************************************************************************/
+void* BufferPool::allocate(size_t size) {
+  size_t index = 0;
+  while ((index < mNumClasses) && (size > mClasses[index].size)) index++;
+
+  Block* block = NULL;
+  if (index == mNumClasses) {
+    block = (Block*)malloc(sizeof(Block) + size);
+    if (block == NULL) return NULL;
+    block->classIndex = kHeapClass;
+    mOversized++;
+  } else {
+    SizeClass& sizeClass = mClasses[index];
+    sizeClass.mutex.lock();
+    block = sizeClass.freeList;
+    if (block) {
+      sizeClass.freeList = block->next;
+      sizeClass.freeCount--;
+    }
+    sizeClass.mutex.unlock();
+
+    if (block) {
+      mPoolHits++;
+    } else {
+      block = (Block*)malloc(sizeof(Block) + sizeClass.size);
+      if (block == NULL) return NULL;
+      mPoolMisses++;
+    }
+    block->classIndex = index;
+  }
+  mOutstanding++;
+  return block + 1;
+}
+
+/*******************************************************************************
+**
+** Function:        release
+**
+** Description:     Return a buffer obtained from allocate().
+**                  buffer: buffer to return; NULL is ignored.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void BufferPool::release(void* buffer) {
+  if (buffer == NULL) return;
+
+  Block* block = (Block*)buffer - 1;
+  uint32_t index = block->classIndex;
+  mReleases++;
+  mOutstanding--;
+  if (index == kHeapClass) {
+    free(block);
+    return;
+  }
+  if (index >= mNumClasses) {
+    LOG(ERROR) << StringPrintf("%s: corrupt block %p", __func__, buffer);
+    return;
+  }
+
+  SizeClass& sizeClass = mClasses[index];
+  sizeClass.mutex.lock();
+  if (sizeClass.freeCount < mMaxFreePerClass) {
+    block->next = sizeClass.freeList;
+    sizeClass.freeList = block;
+    sizeClass.freeCount++;
+    block = NULL;
+  }
+  sizeClass.mutex.unlock();
+  if (block) free(block);
+}
+
+/*******************************************************************************
+**
+** Function:        getStats
+**
+** Description:     Get a snapshot of the allocation counters.
+**
+** Returns:         Counters.
+**
+*******************************************************************************/
+BufferPool::Stats BufferPool::getStats() const {
+  Stats stats;
+  stats.poolHits = mPoolHits.load(std::memory_order_relaxed);
+  stats.poolMisses = mPoolMisses.load(std::memory_order_relaxed);
+  stats.oversized = mOversized.load(std::memory_order_relaxed);
+  stats.releases = mReleases.load(std::memory_order_relaxed);
+  stats.outstanding = mOutstanding.load(std::memory_order_relaxed);
+  return stats;
+}
+
+/*******************************************************************************
+**
+** Function:        dump
+**
+** Description:     Write the allocation counters to a file descriptor.
+**                  fd: file descriptor.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void BufferPool::dump(int fd) const {
+  Stats stats = getStats();
+  dprintf(fd, "BufferPool: hits=%llu misses=%llu oversized=%llu "
+              "releases=%llu outstanding=%llu\n",
+          (unsigned long long)stats.poolHits,
+          (unsigned long long)stats.poolMisses,
+          (unsigned long long)stats.oversized,
+          (unsigned long long)stats.releases,
+          (unsigned long long)stats.outstanding);
+}
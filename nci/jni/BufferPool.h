@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Size-classed pool of data buffers shared by the JNI layer.
+ */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "Mutex.h"
+
+class BufferPool {
+ public:
+  struct Stats {
+    uint64_t poolHits;      // served from a free list
+    uint64_t poolMisses;    // free list empty; new block from the heap
+    uint64_t oversized;     // larger than every class; plain heap buffer
+    uint64_t releases;      // buffers returned with release()
+    uint64_t outstanding;   // buffers allocated and not yet released
+  };
+
+  /*******************************************************************************
+  **
+  ** Function:        BufferPool
+  **
+  ** Description:     Initialize member variables.
+  **                  classSizes: usable size of each class, ascending.
+  **                  numClasses: number of classes; at most kMaxClasses.
+  **                  maxFreePerClass: free blocks kept per class; extra
+  **                  blocks go back to the heap.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  BufferPool(const uint32_t* classSizes, size_t numClasses,
+             uint32_t maxFreePerClass);
+
+  /*******************************************************************************
+  **
+  ** Function:        ~BufferPool
+  **
+  ** Description:     Release all cached blocks.  Buffers still outstanding
+  **                  must not be released afterwards.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  ~BufferPool();
+
+  /*******************************************************************************
+  **
+  ** Function:        getInstance
+  **
+  ** Description:     Get the pool shared by the JNI layer.  Its classes fit
+  **                  short APDUs, 255-octet frames and the extended ISO-DEP
+  **                  transceive length.
+  **
+  ** Returns:         Reference to BufferPool object.
+  **
+  *******************************************************************************/
+  static BufferPool& getInstance();
+
+  /*******************************************************************************
+  **
+  ** Function:        allocate
+  **
+  ** Description:     Get a buffer of at least the given size.
+  **                  size: number of octets needed.
+  **
+  ** Returns:         Buffer; NULL if out of memory.
+  **
+  *******************************************************************************/
+  void* allocate(size_t size);
+
+  /*******************************************************************************
+  **
+  ** Function:        release
+  **
+  ** Description:     Return a buffer obtained from allocate().
+  **                  buffer: buffer to return; NULL is ignored.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void release(void* buffer);
+
+  /*******************************************************************************
+  **
+  ** Function:        getStats
+  **
+  ** Description:     Get a snapshot of the allocation counters.
+  **
+  ** Returns:         Counters.
+  **
+  *******************************************************************************/
+  Stats getStats() const;
+
+  /*******************************************************************************
+  **
+  ** Function:        dump
+  **
+  ** Description:     Write the allocation counters to a file descriptor.
+  **                  fd: file descriptor.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void dump(int fd) const;
+
+  static const size_t kMaxClasses = 8;
+
+ private:
+  union Block {
+    Block* next;             // while on a free list
+    uint32_t classIndex;     // while handed out
+    max_align_t alignment;
+  };
+
+  struct SizeClass {
+    uint32_t size;
+    uint32_t freeCount;
+    Block* freeList;
+    Mutex mutex;
+  };
+
+  SizeClass mClasses[kMaxClasses];
+  size_t mNumClasses;
+  uint32_t mMaxFreePerClass;
+  std::atomic<uint64_t> mPoolHits;
+  std::atomic<uint64_t> mPoolMisses;
+  std::atomic<uint64_t> mOversized;
+  std::atomic<uint64_t> mReleases;
+  std::atomic<uint64_t> mOutstanding;
+
+  static const uint32_t kHeapClass = 0xFFFFFFFF;
+};
+
+/*
+ *  STL allocator drawing nodes from the shared BufferPool.
+ */
+template <typename T>
+struct BufferPoolAllocator {
+  typedef T value_type;
+
+  BufferPoolAllocator() = default;
+  template <typename U>
+  BufferPoolAllocator(const BufferPoolAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    return (T*)BufferPool::getInstance().allocate(n * sizeof(T));
+  }
+  void deallocate(T* p, size_t) { BufferPool::getInstance().release(p); }
+
+  template <typename U>
+  bool operator==(const BufferPoolAllocator<U>&) const {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const BufferPoolAllocator<U>&) const {
+    return false;
+  }
+};
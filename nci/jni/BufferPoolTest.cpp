@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <string.h>
+
+#include <thread>
+#include <vector>
+
+#include "BufferPool.h"
+#include "DataQueue.h"
+
+class BufferPoolTest : public ::testing::Test {
+ protected:
+  static constexpr uint32_t kSizes[] = {64, 256};
+  BufferPoolTest() : pool(kSizes, 2, 2) {}
+  BufferPool pool;
+};
+
+// Test a released buffer is handed out again without a heap allocation
+TEST_F(BufferPoolTest, ReusesReleasedBuffer) {
+  void* first = pool.allocate(10);
+  ASSERT_NE(first, nullptr);
+  memset(first, 0xAA, 64);
+  pool.release(first);
+  void* second = pool.allocate(64);
+  ASSERT_EQ(second, first);
+  pool.release(second);
+
+  BufferPool::Stats stats = pool.getStats();
+  ASSERT_EQ(stats.poolMisses, 1u);
+  ASSERT_EQ(stats.poolHits, 1u);
+  ASSERT_EQ(stats.outstanding, 0u);
+}
+
+// Test each size is served by the smallest class that fits
+TEST_F(BufferPoolTest, SizeClasses) {
+  void* small = pool.allocate(64);
+  void* large = pool.allocate(65);
+  pool.release(small);
+  // a free 64-octet block cannot serve a 65-octet request
+  void* other = pool.allocate(65);
+  ASSERT_NE(other, small);
+  pool.release(large);
+  pool.release(other);
+  ASSERT_EQ(pool.getStats().poolMisses, 3u);
+}
+
+// Test requests larger than every class fall back to the heap
+TEST_F(BufferPoolTest, Oversized) {
+  void* buffer = pool.allocate(1000);
+  ASSERT_NE(buffer, nullptr);
+  memset(buffer, 0, 1000);
+  pool.release(buffer);
+  BufferPool::Stats stats = pool.getStats();
+  ASSERT_EQ(stats.oversized, 1u);
+  ASSERT_EQ(stats.releases, 1u);
+  ASSERT_EQ(stats.outstanding, 0u);
+}
+
+// Test free lists are bounded
+TEST_F(BufferPoolTest, FreeListBounded) {
+  void* buffers[4];
+  for (int i = 0; i < 4; i++) buffers[i] = pool.allocate(32);
+  for (int i = 0; i < 4; i++) pool.release(buffers[i]);
+  for (int i = 0; i < 4; i++) buffers[i] = pool.allocate(32);
+  for (int i = 0; i < 4; i++) pool.release(buffers[i]);
+  BufferPool::Stats stats = pool.getStats();
+  ASSERT_EQ(stats.poolHits, 2u);
+  ASSERT_EQ(stats.poolMisses, 6u);
+}
+
+// Test several threads sharing the pool
+TEST_F(BufferPoolTest, Concurrent) {
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([this, t]() {
+      for (int i = 0; i < 10000; i++) {
+        uint8_t* buffer = (uint8_t*)pool.allocate(1 + (i % 200));
+        buffer[0] = (uint8_t)t;
+        pool.release(buffer);
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  ASSERT_EQ(pool.getStats().outstanding, 0u);
+  ASSERT_EQ(pool.getStats().releases, 40000u);
+}
+
+// Test a list-mode DataQueue stops hitting the heap once warmed up
+TEST(BufferPoolDataQueueTest, SteadyStateUsesPool) {
+  DataQueue queue;
+  uint8_t data[255] = {0};
+  uint8_t buffer[255];
+  uint16_t actualLen;
+  for (int i = 0; i < 4; i++) ASSERT_TRUE(queue.enqueue(data, sizeof(data)));
+  for (int i = 0; i < 4; i++)
+    ASSERT_TRUE(queue.dequeue(buffer, sizeof(buffer), actualLen));
+
+  BufferPool::Stats before = BufferPool::getInstance().getStats();
+  for (int i = 0; i < 100; i++) {
+    ASSERT_TRUE(queue.enqueue(data, sizeof(data)));
+    ASSERT_TRUE(queue.dequeue(buffer, sizeof(buffer), actualLen));
+  }
+  BufferPool::Stats after = BufferPool::getInstance().getStats();
+  ASSERT_EQ(after.poolMisses, before.poolMisses);
+  ASSERT_EQ(after.oversized, before.oversized);
+  ASSERT_GT(after.poolHits, before.poolHits);
+}
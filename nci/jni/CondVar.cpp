@@ -25,6 +25,7 @@
 #include <errno.h>
 #include <string.h>
 
+#include "Futex.h"
 #include "NfcJniUtil.h"
 
 using android::base::StringPrintf;
@@ -38,7 +39,7 @@ using android::base::StringPrintf;
 ** Returns:         None.
 **
 *******************************************************************************/
-CondVar::CondVar() {
+CondVar::CondVar() : mSequence(0), mFutexWaiters(0) {
   pthread_condattr_t attr;
   pthread_condattr_init(&attr);
   pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
@@ -76,7 +77,14 @@ CondVar::~CondVar() {
 **
 *******************************************************************************/
 void CondVar::wait(Mutex& mutex) {
+  if (mutex.kind() == Mutex::kAdaptive) {
+    futexWaitFor(mutex, NULL);
+    return;
+  }
+  // time spent waiting does not count as holding the mutex
+  const char* holder = mutex.holdEnd();
   int const res = pthread_cond_wait(&mCondition, mutex.nativeHandle());
+  mutex.holdBegin(holder);
   if (res) {
     LOG(ERROR) << StringPrintf("CondVar::wait: fail wait; error=0x%X", res);
   }
@@ -93,6 +101,13 @@ void CondVar::wait(Mutex& mutex) {
 **
 *******************************************************************************/
 bool CondVar::wait(Mutex& mutex, long millisec) {
+  if (mutex.kind() == Mutex::kAdaptive) {
+    struct timespec timeout;
+    timeout.tv_sec = millisec / 1000;
+    timeout.tv_nsec = (millisec % 1000) * 1000000;
+    return futexWaitFor(mutex, &timeout);
+  }
+
   bool retVal = false;
   struct timespec absoluteTime;
 
@@ -109,8 +124,10 @@ bool CondVar::wait(Mutex& mutex, long millisec) {
       absoluteTime.tv_nsec = ns;
   }
 
+  const char* holder = mutex.holdEnd();
   int waitResult =
       pthread_cond_timedwait(&mCondition, mutex.nativeHandle(), &absoluteTime);
+  mutex.holdBegin(holder);
   if ((waitResult != 0) && (waitResult != ETIMEDOUT))
     LOG(ERROR) << StringPrintf("CondVar::wait: fail timed wait; error=0x%X",
                                waitResult);
@@ -118,6 +135,42 @@ bool CondVar::wait(Mutex& mutex, long millisec) {
   return retVal;
 }
 
+/*******************************************************************************
+**
+** Function:        wait
+**
+** Description:     Block the caller and wait for a condition.
+**                  deadline: Time by which to give up.
+**
+** Returns:         True if wait is successful; false if timeout occurs.
+**
+*******************************************************************************/
+bool CondVar::wait(Mutex& mutex, const Deadline& deadline) {
+  if (deadline.isNever()) {
+    wait(mutex);
+    return true;
+  }
+  if (deadline.expired()) return false;
+
+  if (mutex.kind() == Mutex::kAdaptive) {
+    long const millisec = deadline.remainingMs();
+    struct timespec timeout;
+    timeout.tv_sec = millisec / 1000;
+    timeout.tv_nsec = (millisec % 1000) * 1000000;
+    return futexWaitFor(mutex, &timeout);
+  }
+
+  struct timespec const absoluteTime = deadline.toTimespec();
+  const char* holder = mutex.holdEnd();
+  int waitResult =
+      pthread_cond_timedwait(&mCondition, mutex.nativeHandle(), &absoluteTime);
+  mutex.holdBegin(holder);
+  if ((waitResult != 0) && (waitResult != ETIMEDOUT))
+    LOG(ERROR) << StringPrintf("CondVar::wait: fail timed wait; error=0x%X",
+                               waitResult);
+  return waitResult == 0;
+}
+
 /*******************************************************************************
 **
 ** Function:        notifyOne
@@ -128,9 +181,72 @@ bool CondVar::wait(Mutex& mutex, long millisec) {
 **
 *******************************************************************************/
 void CondVar::notifyOne() {
+  futexNotify(1);
   int const res = pthread_cond_signal(&mCondition);
   if (res) {
     LOG(ERROR) << StringPrintf("CondVar::notifyOne: fail signal; error=0x%X",
                                res);
   }
 }
+
+/*******************************************************************************
+**
+** Function:        notifyAll
+**
+** Description:     Unblock all waiting threads.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void CondVar::notifyAll() {
+  futexNotify(INT32_MAX);
+  int const res = pthread_cond_broadcast(&mCondition);
+  if (res) {
+    LOG(ERROR) << StringPrintf("CondVar::notifyAll: fail broadcast; error=0x%X",
+                               res);
+  }
+}
+
+/*******************************************************************************
+**
+** Function:        futexWaitFor
+**
+** Description:     Wait on behalf of an adaptive mutex: release the mutex,
+**                  sleep until the sequence moves on, then lock it again.
+**                  mutex: adaptive mutex held by the caller.
+**                  timeout: relative timeout; NULL to wait without timeout.
+**
+** Returns:         True if woken; false if timeout occurs.
+**
+*******************************************************************************/
+bool CondVar::futexWaitFor(Mutex& mutex, const struct timespec* timeout) {
+  mFutexWaiters.fetch_add(1);
+  uint32_t const sequence = mSequence.load();
+  const char* holder = mutex.holdEnd();
+  mutex.unlock();
+  int const res = futexWait(&mSequence, sequence, timeout);
+  if ((res != 0) && (res != EAGAIN) && (res != EINTR) && (res != ETIMEDOUT)) {
+    LOG(ERROR) << StringPrintf("CondVar::wait: fail futex wait; error=0x%X",
+                               res);
+  }
+  // other waiters may still be asleep on the mutex
+  mutex.lockContended();
+  mutex.holdBegin(holder);
+  mFutexWaiters.fetch_sub(1);
+  return res != ETIMEDOUT;
+}
+
+/*******************************************************************************
+**
+** Function:        futexNotify
+**
+** Description:     Wake threads waiting with an adaptive mutex.
+**                  count: maximum number of threads to wake.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void CondVar::futexNotify(int count) {
+  mSequence.fetch_add(1);
+  if (mFutexWaiters.load() > 0) futexWake(&mSequence, count);
+}
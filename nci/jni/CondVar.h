@@ -20,6 +20,11 @@
 
 #pragma once
 #include <pthread.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "Deadline.h"
 #include "Mutex.h"
 
 class CondVar {
@@ -69,6 +74,18 @@ class CondVar {
   *******************************************************************************/
   bool wait(Mutex& mutex, long millisec);
 
+  /*******************************************************************************
+  **
+  ** Function:        wait
+  **
+  ** Description:     Block the caller and wait for a condition.
+  **                  deadline: Time by which to give up.
+  **
+  ** Returns:         True if wait is successful; false if timeout occurs.
+  **
+  *******************************************************************************/
+  bool wait(Mutex& mutex, const Deadline& deadline);
+
   /*******************************************************************************
   **
   ** Function:        notifyOne
@@ -80,6 +97,23 @@ class CondVar {
   *******************************************************************************/
   void notifyOne();
 
+  /*******************************************************************************
+  **
+  ** Function:        notifyAll
+  **
+  ** Description:     Unblock all waiting threads.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void notifyAll();
+
  private:
+  bool futexWaitFor(Mutex& mutex, const struct timespec* timeout);
+  void futexNotify(int count);
+
   pthread_cond_t mCondition;
+  // used with adaptive mutexes: waiters sleep until the sequence changes
+  std::atomic<uint32_t> mSequence;
+  std::atomic<uint32_t> mFutexWaiters;
 };
@@ -24,8 +24,20 @@
 #include <android-base/stringprintf.h>
 #include <malloc.h>
 #include <string.h>
+#include <time.h>
 
 using android::base::StringPrintf;
+
+namespace {
+// every record in the ring starts on a 4-octet boundary
+const uint32_t kRingAlign = 4;
+const uint32_t kRingMinCapacity = 64;
+
+uint32_t ringRecordLen(uint32_t dataLen, uint32_t headerLen) {
+  return (headerLen + dataLen + kRingAlign - 1) & ~(kRingAlign - 1);
+}
+}  // namespace
+
 /*******************************************************************************
 **
 ** Function:        DataQueue
@@ -35,7 +47,42 @@ using android::base::StringPrintf;
 ** Returns:         None.
 **
 *******************************************************************************/
-DataQueue::DataQueue() {}
+DataQueue::DataQueue()
+    : mWaiters(0),
+      mAbortGen(0),
+      mRing(NULL),
+      mRingMask(0),
+      mRingWrite(0),
+      mRingRead(0) {}
+
+/*******************************************************************************
+**
+** Function:        DataQueue
+**
+** Description:     Initialize a lock-free ring-buffer queue.
+**                  ringCapacity: size of the arena in octets; rounded up
+**                  to a power of two.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+DataQueue::DataQueue(uint32_t ringCapacity)
+    : mWaiters(0),
+      mAbortGen(0),
+      mRing(NULL),
+      mRingMask(0),
+      mRingWrite(0),
+      mRingRead(0) {
+  uint32_t capacity = kRingMinCapacity;
+  while (capacity < ringCapacity && capacity < 0x80000000) capacity <<= 1;
+
+  mRing = (uint8_t*)malloc(capacity);
+  if (mRing) {
+    mRingMask = capacity - 1;
+  } else {
+    LOG(ERROR) << StringPrintf("DataQueue::DataQueue: out of memory ?????");
+  }
+}
 
 /*******************************************************************************
 **
@@ -47,16 +94,23 @@ DataQueue::DataQueue() {}
 **
 *******************************************************************************/
 DataQueue::~DataQueue() {
+  if (mRing) free(mRing);
+
   mMutex.lock();
   while (mQueue.empty() == false) {
     tHeader* header = mQueue.front();
     mQueue.pop_front();
-    free(header);
+    BufferPool::getInstance().release(header);
   }
   mMutex.unlock();
 }
 
 bool DataQueue::isEmpty() {
+  if (mRing) {
+    return mRingRead.load(std::memory_order_acquire) ==
+           mRingWrite.load(std::memory_order_acquire);
+  }
+
   mMutex.lock();
   bool retval = mQueue.empty();
   mMutex.unlock();
@@ -77,10 +131,17 @@ bool DataQueue::isEmpty() {
 bool DataQueue::enqueue(uint8_t* data, uint16_t dataLen) {
   if ((data == NULL) || (dataLen == 0)) return false;
 
+  if (mRing) {
+    if (!ringEnqueue(data, dataLen)) return false;
+    notifyWaiters();
+    return true;
+  }
+
   mMutex.lock();
 
   bool retval = false;
-  tHeader* header = (tHeader*)malloc(sizeof(tHeader) + dataLen);
+  tHeader* header =
+      (tHeader*)BufferPool::getInstance().allocate(sizeof(tHeader) + dataLen);
 
   if (header) {
     memset(header, 0, sizeof(tHeader));
@@ -90,6 +151,9 @@ bool DataQueue::enqueue(uint8_t* data, uint16_t dataLen) {
     mQueue.push_back(header);
 
     retval = true;
+    if (mWaiters.load(std::memory_order_relaxed) > 0) {
+      mDataCondVar.notifyAll();
+    }
   } else {
     LOG(ERROR) << StringPrintf("DataQueue::enqueue: out of memory ?????");
   }
@@ -111,6 +175,26 @@ bool DataQueue::enqueue(uint8_t* data, uint16_t dataLen) {
 *******************************************************************************/
 bool DataQueue::dequeue(uint8_t* buffer, uint16_t bufferMaxLen,
                         uint16_t& actualLen) {
+  if (mRing) {
+    tHeader* header = ringFront();
+    if (!header || !buffer || (bufferMaxLen == 0)) return false;
+
+    char* src = (char*)(header) + sizeof(tHeader) + header->mOffset;
+    if (header->mDataLen <= bufferMaxLen) {
+      actualLen = header->mDataLen;
+      memcpy(buffer, src, actualLen);
+      ringPopFront(header);
+    } else {
+      // the record stays at the head of the ring; the next dequeue()
+      // resumes from the adjusted offset
+      actualLen = bufferMaxLen;
+      memcpy(buffer, src, actualLen);
+      header->mDataLen -= actualLen;
+      header->mOffset += actualLen;
+    }
+    return true;
+  }
+
   mMutex.lock();
 
   tHeader* header = mQueue.front();
@@ -124,7 +208,7 @@ bool DataQueue::dequeue(uint8_t* buffer, uint16_t bufferMaxLen,
       memcpy(buffer, src, actualLen);
 
       mQueue.pop_front();
-      free(header);
+      BufferPool::getInstance().release(header);
     } else {
       // caller's buffer is too small
       actualLen = bufferMaxLen;
@@ -139,3 +223,323 @@ bool DataQueue::dequeue(uint8_t* buffer, uint16_t bufferMaxLen,
   mMutex.unlock();
   return retval;
 }
+
+/*******************************************************************************
+**
+** Function:        waitDequeue
+**
+** Description:     Block until data is available, then retrieve and remove
+**                  data from the front of the queue.
+**                  buffer: array to store the data.
+**                  bufferMaxLen: maximum size of the buffer.
+**                  actualLen: actual length of the data.
+**                  timeoutMs: maximum time to wait in milliseconds;
+**                  negative to wait until data arrives or abortWaits().
+**
+** Returns:         True if ok; false on timeout or abort.
+**
+*******************************************************************************/
+bool DataQueue::waitDequeue(uint8_t* buffer, uint16_t bufferMaxLen,
+                            uint16_t& actualLen, long timeoutMs) {
+  if (!waitForData(timeoutMs)) return false;
+  return dequeue(buffer, bufferMaxLen, actualLen);
+}
+
+/*******************************************************************************
+**
+** Function:        dequeueMany
+**
+** Description:     Retrieve and remove as many whole elements as fit into
+**                  the buffer, packed back to back.
+**                  buffer: array to store the data.
+**                  bufferMaxLen: maximum size of the buffer.
+**                  lengths: receives the length of each element retrieved.
+**                  maxCount: maximum number of elements to retrieve.
+**                  timeoutMs: maximum time to wait for the first element.
+**
+** Returns:         Number of elements retrieved; 0 on timeout or abort.
+**
+*******************************************************************************/
+int DataQueue::dequeueMany(uint8_t* buffer, uint16_t bufferMaxLen,
+                           uint16_t* lengths, int maxCount, long timeoutMs) {
+  if (!buffer || !lengths || (bufferMaxLen == 0) || (maxCount <= 0)) return 0;
+  if ((timeoutMs != 0) && !waitForData(timeoutMs)) return 0;
+
+  int count = 0;
+  uint16_t used = 0;
+  const uint8_t* data = NULL;
+  uint16_t dataLen = 0;
+  while ((count < maxCount) && peek(data, dataLen)) {
+    if (dataLen > bufferMaxLen - used) {
+      if (count > 0) break;
+      // first element is larger than the whole buffer
+      dataLen = bufferMaxLen;
+    }
+    memcpy(buffer + used, data, dataLen);
+    consume(dataLen);
+    lengths[count++] = dataLen;
+    used += dataLen;
+  }
+  return count;
+}
+
+/*******************************************************************************
+**
+** Function:        abortWaits
+**
+** Description:     Unblock all threads waiting in waitDequeue() or
+**                  dequeueMany().
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void DataQueue::abortWaits() {
+  mMutex.lock();
+  mAbortGen.fetch_add(1);
+  mDataCondVar.notifyAll();
+  mMutex.unlock();
+}
+
+/*******************************************************************************
+**
+** Function:        peek
+**
+** Description:     Get the data at the front of the queue without copying
+**                  or removing it.
+**                  data: receives the address of the remaining data.
+**                  dataLen: receives the length of the remaining data.
+**
+** Returns:         True if ok; false if the queue is empty.
+**
+*******************************************************************************/
+bool DataQueue::peek(const uint8_t*& data, uint16_t& dataLen) {
+  tHeader* header = NULL;
+
+  if (mRing) {
+    header = ringFront();
+  } else {
+    mMutex.lock();
+    if (!mQueue.empty()) header = mQueue.front();
+    mMutex.unlock();
+  }
+
+  if (!header) return false;
+  // only the consumer removes elements, so the header outlives the lock
+  data = (const uint8_t*)(header + 1) + header->mOffset;
+  dataLen = header->mDataLen;
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        consume
+**
+** Description:     Discard data from the front of the queue after peek().
+**                  len: number of octets to discard.
+**
+** Returns:         True if ok; false if the queue is empty.
+**
+*******************************************************************************/
+bool DataQueue::consume(uint16_t len) {
+  if (mRing) {
+    tHeader* header = ringFront();
+    if (!header) return false;
+    if (len >= header->mDataLen) {
+      ringPopFront(header);
+    } else {
+      header->mDataLen -= len;
+      header->mOffset += len;
+    }
+    return true;
+  }
+
+  mMutex.lock();
+  bool retval = false;
+  if (!mQueue.empty()) {
+    tHeader* header = mQueue.front();
+    if (len >= header->mDataLen) {
+      mQueue.pop_front();
+      BufferPool::getInstance().release(header);
+    } else {
+      header->mDataLen -= len;
+      header->mOffset += len;
+    }
+    retval = true;
+  }
+  mMutex.unlock();
+  return retval;
+}
+
+/*******************************************************************************
+**
+** Function:        hasDataLocked
+**
+** Description:     Whether the queue holds data.  In list mode the caller
+**                  must hold mMutex.
+**
+** Returns:         True if not empty.
+**
+*******************************************************************************/
+bool DataQueue::hasDataLocked() {
+  if (mRing) {
+    return mRingRead.load(std::memory_order_acquire) !=
+           mRingWrite.load(std::memory_order_acquire);
+  }
+  return !mQueue.empty();
+}
+
+/*******************************************************************************
+**
+** Function:        waitForData
+**
+** Description:     Block until the queue holds data.
+**                  timeoutMs: maximum time to wait in milliseconds;
+**                  negative to wait until data arrives or abortWaits().
+**
+** Returns:         True if data is available; false on timeout or abort.
+**
+*******************************************************************************/
+bool DataQueue::waitForData(long timeoutMs) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += timeoutMs / 1000;
+  deadline.tv_nsec += (timeoutMs % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  mMutex.lock();
+  uint32_t const abortGen = mAbortGen.load();
+  // pairs with the fence in notifyWaiters(): either the producer sees this
+  // waiter, or this waiter sees the producer's data
+  mWaiters.fetch_add(1);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  while (!hasDataLocked() && (abortGen == mAbortGen.load())) {
+    if (timeoutMs < 0) {
+      mDataCondVar.wait(mMutex);
+      continue;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t remainingNs =
+        (int64_t)(deadline.tv_sec - now.tv_sec) * 1000000000 +
+        (deadline.tv_nsec - now.tv_nsec);
+    if (remainingNs <= 0) break;
+    long remainingMs = (long)((remainingNs + 999999) / 1000000);
+    mDataCondVar.wait(mMutex, remainingMs);
+  }
+  mWaiters.fetch_sub(1);
+  bool const ready = hasDataLocked() && (abortGen == mAbortGen.load());
+  mMutex.unlock();
+  return ready;
+}
+
+/*******************************************************************************
+**
+** Function:        notifyWaiters
+**
+** Description:     Wake consumers blocked in waitForData() after the
+**                  producer published a record to the ring.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void DataQueue::notifyWaiters() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (mWaiters.load(std::memory_order_relaxed) == 0) return;
+  mMutex.lock();
+  mDataCondVar.notifyAll();
+  mMutex.unlock();
+}
+
+/*******************************************************************************
+**
+** Function:        ringEnqueue
+**
+** Description:     Append a record to the ring buffer.  Called by the
+**                  producer thread only.
+**                  data: array of bytes
+**                  dataLen: length of the data.
+**
+** Returns:         True if ok; false if the ring is full.
+**
+*******************************************************************************/
+bool DataQueue::ringEnqueue(const uint8_t* data, uint16_t dataLen) {
+  uint32_t const capacity = mRingMask + 1;
+  uint32_t const recordLen = ringRecordLen(dataLen, sizeof(tHeader));
+  uint32_t write = mRingWrite.load(std::memory_order_relaxed);
+  uint32_t const read = mRingRead.load(std::memory_order_acquire);
+  uint32_t const index = write & mRingMask;
+  uint32_t const tailRoom = capacity - index;
+
+  // a record never straddles the end of the ring; when it does not fit in
+  // the tail, the tail is marked as padding and the record starts at 0
+  uint32_t needed = recordLen;
+  if (recordLen > tailRoom) needed += tailRoom;
+  if ((recordLen > capacity) || (needed > capacity - (write - read))) {
+    LOG(ERROR) << StringPrintf("DataQueue::enqueue: ring full; len=%u",
+                               dataLen);
+    return false;
+  }
+
+  if (recordLen > tailRoom) {
+    tHeader* padding = (tHeader*)(mRing + index);
+    padding->mDataLen = 0;  // zero-length record marks the wrap point
+    padding->mOffset = 0;
+    write += tailRoom;
+  }
+
+  tHeader* header = (tHeader*)(mRing + (write & mRingMask));
+  header->mDataLen = dataLen;
+  header->mOffset = 0;
+  memcpy(header + 1, data, dataLen);
+
+  // publish the record to the consumer
+  mRingWrite.store(write + recordLen, std::memory_order_release);
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        ringFront
+**
+** Description:     Get the record at the head of the ring buffer, skipping
+**                  the padding at the wrap point.  Called by the consumer
+**                  thread only.
+**
+** Returns:         Head record, or NULL if the ring is empty.
+**
+*******************************************************************************/
+DataQueue::tHeader* DataQueue::ringFront() {
+  uint32_t read = mRingRead.load(std::memory_order_relaxed);
+  uint32_t const write = mRingWrite.load(std::memory_order_acquire);
+  if (read == write) return NULL;
+
+  tHeader* header = (tHeader*)(mRing + (read & mRingMask));
+  if (header->mDataLen == 0) {
+    read += (mRingMask + 1) - (read & mRingMask);
+    mRingRead.store(read, std::memory_order_release);
+    if (read == write) return NULL;
+    header = (tHeader*)(mRing + (read & mRingMask));
+  }
+  return header;
+}
+
+/*******************************************************************************
+**
+** Function:        ringPopFront
+**
+** Description:     Release the head record of the ring buffer back to the
+**                  producer.  Called by the consumer thread only.
+**                  header: record returned by ringFront().
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void DataQueue::ringPopFront(tHeader* header) {
+  uint32_t const recordLen =
+      ringRecordLen(header->mOffset + header->mDataLen, sizeof(tHeader));
+  uint32_t const read = mRingRead.load(std::memory_order_relaxed);
+  mRingRead.store(read + recordLen, std::memory_order_release);
+}
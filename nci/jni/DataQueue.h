@@ -19,7 +19,10 @@
  */
 
 #pragma once
+#include <atomic>
 #include <list>
+#include "BufferPool.h"
+#include "CondVar.h"
 #include "Mutex.h"
 #include "NfcJniUtil.h"
 #include "gki.h"
@@ -37,6 +40,22 @@ class DataQueue {
   *******************************************************************************/
   DataQueue();
 
+  /*******************************************************************************
+  **
+  ** Function:        DataQueue
+  **
+  ** Description:     Initialize a lock-free ring-buffer queue.  Records are
+  **                  stored inline in one byte arena that is allocated here,
+  **                  so enqueue() and dequeue() never touch the heap.  Only
+  **                  one thread may enqueue and only one thread may dequeue.
+  **                  ringCapacity: size of the arena in octets; rounded up
+  **                  to a power of two.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  explicit DataQueue(uint32_t ringCapacity);
+
   /*******************************************************************************
   **
   ** Function:        ~DataQueue
@@ -75,6 +94,88 @@ class DataQueue {
   *******************************************************************************/
   bool dequeue(uint8_t* buffer, uint16_t bufferMaxLen, uint16_t& actualLen);
 
+  /*******************************************************************************
+  **
+  ** Function:        waitDequeue
+  **
+  ** Description:     Block until data is available, then retrieve and remove
+  **                  data from the front of the queue.
+  **                  buffer: array to store the data.
+  **                  bufferMaxLen: maximum size of the buffer.
+  **                  actualLen: actual length of the data.
+  **                  timeoutMs: maximum time to wait in milliseconds;
+  **                  negative to wait until data arrives or abortWaits().
+  **
+  ** Returns:         True if ok; false on timeout or abort.
+  **
+  *******************************************************************************/
+  bool waitDequeue(uint8_t* buffer, uint16_t bufferMaxLen, uint16_t& actualLen,
+                   long timeoutMs);
+
+  /*******************************************************************************
+  **
+  ** Function:        dequeueMany
+  **
+  ** Description:     Retrieve and remove as many whole elements as fit into
+  **                  the buffer, packed back to back.  If the first element
+  **                  does not fit, only part of it is retrieved, as with
+  **                  dequeue().
+  **                  buffer: array to store the data.
+  **                  bufferMaxLen: maximum size of the buffer.
+  **                  lengths: receives the length of each element retrieved.
+  **                  maxCount: maximum number of elements to retrieve.
+  **                  timeoutMs: maximum time to wait for the first element;
+  **                  0 to not wait, negative to wait until data arrives or
+  **                  abortWaits().
+  **
+  ** Returns:         Number of elements retrieved; 0 on timeout or abort.
+  **
+  *******************************************************************************/
+  int dequeueMany(uint8_t* buffer, uint16_t bufferMaxLen, uint16_t* lengths,
+                  int maxCount, long timeoutMs);
+
+  /*******************************************************************************
+  **
+  ** Function:        abortWaits
+  **
+  ** Description:     Unblock all threads waiting in waitDequeue() or
+  **                  dequeueMany(); they return without data.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void abortWaits();
+
+  /*******************************************************************************
+  **
+  ** Function:        peek
+  **
+  ** Description:     Get the data at the front of the queue without copying
+  **                  or removing it.  The data stays valid until consume()
+  **                  or dequeue() is called by the consumer.
+  **                  data: receives the address of the remaining data.
+  **                  dataLen: receives the length of the remaining data.
+  **
+  ** Returns:         True if ok; false if the queue is empty.
+  **
+  *******************************************************************************/
+  bool peek(const uint8_t*& data, uint16_t& dataLen);
+
+  /*******************************************************************************
+  **
+  ** Function:        consume
+  **
+  ** Description:     Discard data from the front of the queue after peek().
+  **                  The front element is removed once all of its data is
+  **                  consumed; otherwise the next peek() or dequeue() resumes
+  **                  after the consumed data.
+  **                  len: number of octets to discard.
+  **
+  ** Returns:         True if ok; false if the queue is empty.
+  **
+  *******************************************************************************/
+  bool consume(uint16_t len);
+
   /*******************************************************************************
   **
   ** Function:        isEmpty
@@ -91,8 +192,24 @@ class DataQueue {
     uint16_t mDataLen;  // number of octets of data
     uint16_t mOffset;   // offset of the first octet of data
   };
-  typedef std::list<tHeader*> Queue;
+  typedef std::list<tHeader*, BufferPoolAllocator<tHeader*>> Queue;
 
   Queue mQueue;
-  Mutex mMutex;
+  Mutex mMutex{"DataQueue::mMutex"};
+  CondVar mDataCondVar;              // signalled on enqueue and abortWaits()
+  std::atomic<uint32_t> mWaiters;    // threads blocked on mDataCondVar
+  std::atomic<uint32_t> mAbortGen;   // incremented by abortWaits()
+
+  // ring-buffer mode; mRing is NULL when the queue is list based
+  uint8_t* mRing;
+  uint32_t mRingMask;
+  std::atomic<uint32_t> mRingWrite;  // advanced by the producer only
+  std::atomic<uint32_t> mRingRead;   // advanced by the consumer only
+
+  bool hasDataLocked();
+  bool waitForData(long timeoutMs);
+  void notifyWaiters();
+  bool ringEnqueue(const uint8_t* data, uint16_t dataLen);
+  tHeader* ringFront();
+  void ringPopFront(tHeader* header);
 };
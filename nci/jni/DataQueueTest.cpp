@@ -15,6 +15,10 @@
  */
 
 #include <gtest/gtest.h>
+#include <malloc.h>
+
+#include <chrono>
+#include <thread>
 
 #include "DataQueue.h"
 
@@ -88,4 +92,266 @@ TEST_F(DataQueueTest, DequeueEmpty) {
 TEST_F(DataQueueTest, EnqueueInvalidInput) {
   ASSERT_FALSE(queue.enqueue(nullptr, 10));
   ASSERT_FALSE(queue.enqueue(reinterpret_cast<uint8_t*>(0x1234), 0));
-}
\ No newline at end of file
+}
+
+// Test peek() returns the front element without removing it
+TEST_F(DataQueueTest, PeekConsume) {
+  uint8_t data1[] = {1, 2, 3, 4, 5};
+  uint8_t data2[] = {6, 7};
+  const uint8_t* peeked = nullptr;
+  uint16_t peekedLen = 0;
+  ASSERT_FALSE(queue.peek(peeked, peekedLen));
+  ASSERT_FALSE(queue.consume(1));
+
+  ASSERT_TRUE(queue.enqueue(data1, sizeof(data1)));
+  ASSERT_TRUE(queue.enqueue(data2, sizeof(data2)));
+  ASSERT_TRUE(queue.peek(peeked, peekedLen));
+  ASSERT_EQ(peekedLen, sizeof(data1));
+  ASSERT_EQ(memcmp(peeked, data1, sizeof(data1)), 0);
+
+  // consuming part of the element leaves the remainder at the front
+  ASSERT_TRUE(queue.consume(2));
+  ASSERT_TRUE(queue.peek(peeked, peekedLen));
+  ASSERT_EQ(peekedLen, 3);
+  ASSERT_EQ(memcmp(peeked, data1 + 2, 3), 0);
+
+  uint8_t buffer[10];
+  uint16_t actualLen;
+  ASSERT_TRUE(queue.dequeue(buffer, sizeof(buffer), actualLen));
+  ASSERT_EQ(actualLen, 3);
+  ASSERT_EQ(memcmp(buffer, data1 + 2, 3), 0);
+
+  ASSERT_TRUE(queue.peek(peeked, peekedLen));
+  ASSERT_EQ(peekedLen, sizeof(data2));
+  ASSERT_TRUE(queue.consume(peekedLen));
+  ASSERT_TRUE(queue.isEmpty());
+}
+
+// Test waitDequeue() gives up after the timeout when no data arrives
+TEST_F(DataQueueTest, WaitDequeueTimeout) {
+  uint8_t buffer[10];
+  uint16_t actualLen;
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_FALSE(queue.waitDequeue(buffer, sizeof(buffer), actualLen, 50));
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  ASSERT_GE(elapsed, std::chrono::milliseconds(50));
+}
+
+// Test waitDequeue() returns as soon as another thread enqueues
+TEST_F(DataQueueTest, WaitDequeueWakesOnEnqueue) {
+  uint8_t data[] = {1, 2, 3};
+  std::thread producer([this, &data]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    queue.enqueue(data, sizeof(data));
+  });
+  uint8_t buffer[10];
+  uint16_t actualLen;
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_TRUE(queue.waitDequeue(buffer, sizeof(buffer), actualLen, 5000));
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  producer.join();
+  ASSERT_EQ(actualLen, sizeof(data));
+  ASSERT_LT(elapsed, std::chrono::milliseconds(1000));
+}
+
+// Test abortWaits() unblocks a thread waiting without a timeout
+TEST_F(DataQueueTest, AbortWaits) {
+  std::thread consumer([this]() {
+    uint8_t buffer[10];
+    uint16_t actualLen;
+    EXPECT_FALSE(queue.waitDequeue(buffer, sizeof(buffer), actualLen, -1));
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  queue.abortWaits();
+  consumer.join();
+
+  // a later wait is not affected by the earlier abort
+  uint8_t data[] = {1};
+  ASSERT_TRUE(queue.enqueue(data, sizeof(data)));
+  uint8_t buffer[10];
+  uint16_t actualLen;
+  ASSERT_TRUE(queue.waitDequeue(buffer, sizeof(buffer), actualLen, -1));
+}
+
+// Test dequeueMany() drains whole elements that fit into the buffer
+TEST_F(DataQueueTest, DequeueMany) {
+  uint8_t data1[] = {1, 2, 3};
+  uint8_t data2[] = {4, 5};
+  uint8_t data3[] = {6, 7, 8, 9};
+  ASSERT_TRUE(queue.enqueue(data1, sizeof(data1)));
+  ASSERT_TRUE(queue.enqueue(data2, sizeof(data2)));
+  ASSERT_TRUE(queue.enqueue(data3, sizeof(data3)));
+
+  uint8_t buffer[8];
+  uint16_t lengths[4];
+  ASSERT_EQ(queue.dequeueMany(buffer, sizeof(buffer), lengths, 4, 0), 2);
+  ASSERT_EQ(lengths[0], sizeof(data1));
+  ASSERT_EQ(lengths[1], sizeof(data2));
+  uint8_t expected[] = {1, 2, 3, 4, 5};
+  ASSERT_EQ(memcmp(buffer, expected, sizeof(expected)), 0);
+
+  // an element larger than the buffer is retrieved partially
+  ASSERT_EQ(queue.dequeueMany(buffer, 3, lengths, 4, 0), 1);
+  ASSERT_EQ(lengths[0], 3);
+  ASSERT_EQ(queue.dequeueMany(buffer, sizeof(buffer), lengths, 4, 0), 1);
+  ASSERT_EQ(lengths[0], 1);
+  ASSERT_EQ(buffer[0], 9);
+  ASSERT_EQ(queue.dequeueMany(buffer, sizeof(buffer), lengths, 4, 10), 0);
+}
+
+class DataQueueRingTest : public ::testing::Test {
+ protected:
+  DataQueueRingTest() : queue(256) {}
+  DataQueue queue;
+};
+
+// Test enqueue() and dequeue() in ring-buffer mode
+TEST_F(DataQueueRingTest, EnqueueDequeueMultipleElements) {
+  uint8_t data1[] = {1, 2, 3};
+  uint8_t data2[] = {4, 5, 6, 7};
+  ASSERT_TRUE(queue.isEmpty());
+  ASSERT_TRUE(queue.enqueue(data1, sizeof(data1)));
+  ASSERT_TRUE(queue.enqueue(data2, sizeof(data2)));
+  ASSERT_FALSE(queue.isEmpty());
+
+  uint8_t buffer[10];
+  uint16_t actualLen;
+  ASSERT_TRUE(queue.dequeue(buffer, sizeof(buffer), actualLen));
+  ASSERT_EQ(actualLen, sizeof(data1));
+  ASSERT_EQ(memcmp(buffer, data1, sizeof(data1)), 0);
+
+  ASSERT_TRUE(queue.dequeue(buffer, sizeof(buffer), actualLen));
+  ASSERT_EQ(actualLen, sizeof(data2));
+  ASSERT_EQ(memcmp(buffer, data2, sizeof(data2)), 0);
+  ASSERT_TRUE(queue.isEmpty());
+  ASSERT_FALSE(queue.dequeue(buffer, sizeof(buffer), actualLen));
+}
+
+// Test dequeue() with a small buffer resumes from the offset in ring mode
+TEST_F(DataQueueRingTest, DequeuePartial) {
+  uint8_t data[] = {1, 2, 3, 4, 5};
+  ASSERT_TRUE(queue.enqueue(data, sizeof(data)));
+
+  uint8_t buffer[3];
+  uint16_t actualLen;
+  ASSERT_TRUE(queue.dequeue(buffer, sizeof(buffer), actualLen));
+  ASSERT_EQ(actualLen, sizeof(buffer));
+  ASSERT_EQ(memcmp(buffer, data, sizeof(buffer)), 0);
+  ASSERT_FALSE(queue.isEmpty());
+
+  ASSERT_TRUE(queue.dequeue(buffer, sizeof(buffer), actualLen));
+  ASSERT_EQ(actualLen, 2);
+  ASSERT_EQ(memcmp(buffer, data + 3, 2), 0);
+  ASSERT_TRUE(queue.isEmpty());
+}
+
+// Test peek() and consume() in ring-buffer mode
+TEST_F(DataQueueRingTest, PeekConsume) {
+  uint8_t data[] = {1, 2, 3, 4, 5};
+  ASSERT_TRUE(queue.enqueue(data, sizeof(data)));
+
+  const uint8_t* peeked = nullptr;
+  uint16_t peekedLen = 0;
+  ASSERT_TRUE(queue.peek(peeked, peekedLen));
+  ASSERT_EQ(peekedLen, sizeof(data));
+  ASSERT_EQ(memcmp(peeked, data, sizeof(data)), 0);
+
+  ASSERT_TRUE(queue.consume(4));
+  ASSERT_TRUE(queue.peek(peeked, peekedLen));
+  ASSERT_EQ(peekedLen, 1);
+  ASSERT_EQ(peeked[0], 5);
+  ASSERT_TRUE(queue.consume(1));
+  ASSERT_TRUE(queue.isEmpty());
+  ASSERT_FALSE(queue.peek(peeked, peekedLen));
+}
+
+// Test records that do not fit in the tail of the ring wrap to the start
+TEST_F(DataQueueRingTest, WrapAround) {
+  uint8_t data[100];
+  uint8_t buffer[sizeof(data)];
+  uint16_t actualLen;
+  for (int i = 0; i < 20; i++) {
+    memset(data, i, sizeof(data));
+    ASSERT_TRUE(queue.enqueue(data, sizeof(data)));
+    ASSERT_TRUE(queue.dequeue(buffer, sizeof(buffer), actualLen));
+    ASSERT_EQ(actualLen, sizeof(data));
+    ASSERT_EQ(memcmp(buffer, data, sizeof(data)), 0);
+  }
+  ASSERT_TRUE(queue.isEmpty());
+}
+
+// Test enqueue() fails instead of overwriting when the ring is full
+TEST_F(DataQueueRingTest, EnqueueFull) {
+  uint8_t data[60] = {0};
+  int count = 0;
+  while (queue.enqueue(data, sizeof(data))) count++;
+  ASSERT_EQ(count, 4);
+
+  uint8_t buffer[sizeof(data)];
+  uint16_t actualLen;
+  ASSERT_TRUE(queue.dequeue(buffer, sizeof(buffer), actualLen));
+  ASSERT_TRUE(queue.enqueue(data, sizeof(data)));
+}
+
+// Test records held in the ring do not use the heap
+TEST_F(DataQueueRingTest, SteadyStateDoesNotAllocate) {
+  uint8_t data[32] = {0};
+  uint8_t buffer[sizeof(data)];
+  uint16_t actualLen;
+
+  size_t before = mallinfo().uordblks;
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_TRUE(queue.enqueue(data, sizeof(data)));
+    ASSERT_TRUE(queue.enqueue(data, sizeof(data)));
+    ASSERT_EQ(mallinfo().uordblks, before);
+    ASSERT_TRUE(queue.dequeue(buffer, sizeof(buffer), actualLen));
+    ASSERT_TRUE(queue.dequeue(buffer, sizeof(buffer), actualLen));
+  }
+  ASSERT_EQ(mallinfo().uordblks, before);
+}
+
+// Test one producer thread and one consumer thread keep records in order
+TEST_F(DataQueueRingTest, SingleProducerSingleConsumer) {
+  const uint32_t kCount = 100000;
+  std::thread producer([this, kCount]() {
+    for (uint32_t i = 0; i < kCount; i++) {
+      uint8_t data[40] = {0};
+      uint16_t dataLen = 1 + (i % sizeof(data));
+      memcpy(data, &i, std::min(sizeof(i), (size_t)dataLen));
+      while (!queue.enqueue(data, dataLen)) std::this_thread::yield();
+    }
+  });
+
+  uint8_t buffer[64];
+  uint16_t actualLen;
+  for (uint32_t i = 0; i < kCount; i++) {
+    while (!queue.dequeue(buffer, sizeof(buffer), actualLen))
+      std::this_thread::yield();
+    ASSERT_EQ(actualLen, 1 + (i % 40));
+    uint32_t value = 0;
+    memcpy(&value, buffer, std::min(sizeof(value), (size_t)actualLen));
+    uint32_t expected = 0;
+    memcpy(&expected, &i, std::min(sizeof(i), (size_t)actualLen));
+    ASSERT_EQ(value, expected);
+  }
+  producer.join();
+  ASSERT_TRUE(queue.isEmpty());
+}
+
+// Test waitDequeue() in ring-buffer mode wakes on enqueue
+TEST_F(DataQueueRingTest, WaitDequeueWakesOnEnqueue) {
+  const uint32_t kCount = 1000;
+  std::thread producer([this, kCount]() {
+    for (uint32_t i = 0; i < kCount; i++) {
+      uint8_t data = (uint8_t)i;
+      while (!queue.enqueue(&data, 1)) std::this_thread::yield();
+    }
+  });
+  uint8_t buffer[4];
+  uint16_t actualLen;
+  for (uint32_t i = 0; i < kCount; i++) {
+    ASSERT_TRUE(queue.waitDequeue(buffer, sizeof(buffer), actualLen, 5000));
+    ASSERT_EQ(buffer[0], (uint8_t)i);
+  }
+  producer.join();
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Point in time on CLOCK_MONOTONIC by which a multi-step operation must
+ *  finish, so that its waits share one budget.
+ */
+
+#pragma once
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+
+class Deadline {
+ public:
+  /*******************************************************************************
+  **
+  ** Function:        fromNow
+  **
+  ** Description:     Create a deadline some time from now.
+  **                  millisec: budget in milliseconds; negative means none.
+  **
+  ** Returns:         Deadline.
+  **
+  *******************************************************************************/
+  static Deadline fromNow(long millisec) {
+    if (millisec < 0) return never();
+    return Deadline(nowNs() + (uint64_t)millisec * 1000000);
+  }
+
+  /*******************************************************************************
+  **
+  ** Function:        never
+  **
+  ** Description:     Create a deadline that never expires.
+  **
+  ** Returns:         Deadline.
+  **
+  *******************************************************************************/
+  static Deadline never() { return Deadline(kNever); }
+
+  /*******************************************************************************
+  **
+  ** Function:        isNever
+  **
+  ** Description:     Whether the deadline never expires.
+  **
+  ** Returns:         True if there is no time limit.
+  **
+  *******************************************************************************/
+  bool isNever() const { return mNs == kNever; }
+
+  /*******************************************************************************
+  **
+  ** Function:        expired
+  **
+  ** Description:     Whether the budget is used up.
+  **
+  ** Returns:         True if the deadline has passed.
+  **
+  *******************************************************************************/
+  bool expired() const { return !isNever() && (nowNs() >= mNs); }
+
+  /*******************************************************************************
+  **
+  ** Function:        remainingMs
+  **
+  ** Description:     Time left, rounded up to whole milliseconds.
+  **
+  ** Returns:         Milliseconds left; 0 if expired; LONG_MAX if never.
+  **
+  *******************************************************************************/
+  long remainingMs() const {
+    if (isNever()) return LONG_MAX;
+    uint64_t now = nowNs();
+    if (now >= mNs) return 0;
+    return (long)((mNs - now + 999999) / 1000000);
+  }
+
+  /*******************************************************************************
+  **
+  ** Function:        clampMs
+  **
+  ** Description:     Limit a step's own timeout to the time left.
+  **                  millisec: timeout of the step in milliseconds.
+  **
+  ** Returns:         The smaller of millisec and the time left.
+  **
+  *******************************************************************************/
+  long clampMs(long millisec) const {
+    long remaining = remainingMs();
+    return (millisec < remaining) ? millisec : remaining;
+  }
+
+  /*******************************************************************************
+  **
+  ** Function:        toTimespec
+  **
+  ** Description:     Absolute CLOCK_MONOTONIC time of the deadline, as taken
+  **                  by pthread_cond_timedwait().  Not meaningful if never.
+  **
+  ** Returns:         Absolute time.
+  **
+  *******************************************************************************/
+  struct timespec toTimespec() const {
+    struct timespec ts;
+    ts.tv_sec = (time_t)(mNs / 1000000000);
+    ts.tv_nsec = (long)(mNs % 1000000000);
+    return ts;
+  }
+
+ private:
+  static const uint64_t kNever = UINT64_MAX;
+
+  explicit Deadline(uint64_t ns) : mNs(ns) {}
+
+  static uint64_t nowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+  }
+
+  uint64_t mNs;
+};
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Thin wrappers around the process-private futex system call, used by the
+ *  adaptive Mutex and CondVar.
+ */
+
+#pragma once
+#include <errno.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+              "futex word must be 32 bits");
+
+/*******************************************************************************
+**
+** Function:        futexWait
+**
+** Description:     Sleep while the word still holds the expected value.
+**                  word: futex word.
+**                  expected: value the caller last observed.
+**                  timeout: relative timeout on CLOCK_MONOTONIC; NULL to
+**                  wait without a timeout.
+**
+** Returns:         0 when woken; ETIMEDOUT, EAGAIN (value changed) or EINTR.
+**
+*******************************************************************************/
+inline int futexWait(std::atomic<uint32_t>* word, uint32_t expected,
+                     const struct timespec* timeout) {
+  if (syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT_PRIVATE,
+              expected, timeout, NULL, 0) == 0) {
+    return 0;
+  }
+  return errno;
+}
+
+/*******************************************************************************
+**
+** Function:        futexWake
+**
+** Description:     Wake threads sleeping on the word.
+**                  word: futex word.
+**                  count: maximum number of threads to wake.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+inline void futexWake(std::atomic<uint32_t>* word, int count) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE_PRIVATE,
+          count, NULL, NULL, 0);
+}
+
+/*******************************************************************************
+**
+** Function:        cpuRelax
+**
+** Description:     Hint to the CPU that the caller is spinning.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+inline void cpuRelax() {
+#if defined(__aarch64__) || defined(__arm__)
+  __asm__ __volatile__("yield" ::: "memory");
+#elif defined(__x86_64__) || defined(__i386__)
+  __asm__ __volatile__("pause" ::: "memory");
+#endif
+}
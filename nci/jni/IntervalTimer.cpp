@@ -30,55 +30,57 @@ IntervalTimer::IntervalTimer() {
   mCb = NULL;
 }
 
-bool IntervalTimer::set(int ms, TIMER_FUNC cb) {
+bool IntervalTimer::set(int ms, TIMER_FUNC cb) { return arm(ms, 0, cb); }
+
+bool IntervalTimer::setPeriodic(int ms, TIMER_FUNC cb) {
+  return arm(ms, ms, cb);
+}
+
+bool IntervalTimer::arm(int ms, int periodMs, TIMER_FUNC cb) {
   if (mTimerId == 0) {
     if (cb == NULL) return false;
 
     if (!create(cb)) return false;
   }
-  if (cb != mCb) {
-    kill();
-    if (!create(cb)) return false;
+  if ((cb != NULL) && (cb != mCb)) {
+    // re-arming with a new callback keeps the registered timer
+    if (!TimerService::getInstance().setCallback(mTimerId, cb)) return false;
+    mCb = cb;
   }
 
-  int stat = 0;
-  struct itimerspec ts;
-  ts.it_value.tv_sec = ms / 1000;
-  ts.it_value.tv_nsec = (ms % 1000) * 1000000;
-
-  ts.it_interval.tv_sec = 0;
-  ts.it_interval.tv_nsec = 0;
-
-  stat = timer_settime(mTimerId, 0, &ts, 0);
-  if (stat == -1) LOG(ERROR) << StringPrintf("fail set timer");
-  return stat == 0;
+  bool stat = TimerService::getInstance().arm(mTimerId, ms, periodMs);
+  if (!stat) LOG(ERROR) << StringPrintf("fail set timer");
+  return stat;
 }
 
 IntervalTimer::~IntervalTimer() { kill(); }
 
+// Cancels a pending expiry but keeps the timer registered, so the next set()
+// only re-arms it; kill() also unregisters it.
+void IntervalTimer::disarm() {
+  if (mTimerId == 0) return;
+
+  TimerService::getInstance().disarm(mTimerId);
+}
+
 void IntervalTimer::kill() {
   if (mTimerId == 0) return;
 
-  timer_delete(mTimerId);
+  TimerService::getInstance().destroy(mTimerId);
   mTimerId = 0;
   mCb = NULL;
 }
 
 bool IntervalTimer::create(TIMER_FUNC cb) {
-  struct sigevent se;
-  int stat = 0;
+  union sigval value;
 
   /*
-   * Set the sigevent structure to cause the signal to be
-   * delivered by creating a new thread.
+   * Callbacks run on the shared timer service thread rather than on a
+   * new thread per expiry.
    */
-  se.sigev_notify = SIGEV_THREAD;
-  se.sigev_value.sival_ptr = &mTimerId;
-  se.sigev_notify_function = cb;
-  se.sigev_notify_attributes = NULL;
-  se.sigev_signo = 0;
+  value.sival_ptr = &mTimerId;
   mCb = cb;
-  stat = timer_create(CLOCK_MONOTONIC, &se, &mTimerId);
-  if (stat == -1) LOG(ERROR) << StringPrintf("fail create timer");
-  return stat == 0;
+  mTimerId = TimerService::getInstance().create(cb, value);
+  if (mTimerId == 0) LOG(ERROR) << StringPrintf("fail create timer");
+  return mTimerId != 0;
 }
@@ -18,7 +18,9 @@
  *  Asynchronous interval timer.
  */
 
-#include <time.h>
+#include <signal.h>
+
+#include "TimerService.h"
 
 class IntervalTimer {
  public:
@@ -27,10 +29,14 @@ class IntervalTimer {
   IntervalTimer();
   ~IntervalTimer();
   bool set(int ms, TIMER_FUNC cb);
+  bool setPeriodic(int ms, TIMER_FUNC cb);
+  void disarm();
   void kill();
   bool create(TIMER_FUNC);
 
  private:
-  timer_t mTimerId;
+  bool arm(int ms, int periodMs, TIMER_FUNC cb);
+
+  TimerService::TimerId mTimerId;
   TIMER_FUNC mCb;
 };
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Estimate a response timeout from observed response latencies.
+ */
+
+#include "LatencyEstimator.h"
+
+namespace {
+// slack added to the estimate for scheduling delays in the stack
+const int64_t kMarginUs = 10000;
+}  // namespace
+
+/*******************************************************************************
+**
+** Function:        LatencyEstimator
+**
+** Description:     Initialize member variables.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+LatencyEstimator::LatencyEstimator()
+    : mSamples(0), mBackedOff(false), mAverageUs(0), mDeviationUs(0) {}
+
+/*******************************************************************************
+**
+** Function:        addSample
+**
+** Description:     Fold a response latency into the moving average and
+**                  mean deviation, as TCP does for its retransmit timer.
+**                  latencyUs: time from sending a command to its response.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void LatencyEstimator::addSample(uint32_t latencyUs) {
+  int64_t const sample = latencyUs;
+  if (mSamples == 0) {
+    mAverageUs = sample;
+    mDeviationUs = sample / 2;
+  } else {
+    int64_t const error = sample - mAverageUs;
+    mDeviationUs += ((error < 0 ? -error : error) - mDeviationUs) / 4;
+    mAverageUs += error / 8;
+  }
+  if (mSamples < kMinSamples) mSamples++;
+}
+
+/*******************************************************************************
+**
+** Function:        addTimeout
+**
+** Description:     Record that a command timed out while waiting for the
+**                  estimated timeout.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void LatencyEstimator::addTimeout() { mBackedOff = true; }
+
+/*******************************************************************************
+**
+** Function:        timeoutMs
+**
+** Description:     Timeout derived from the observed latencies.
+**                  maxMs: configured timeout, which bounds the result.
+**
+** Returns:         Timeout in milliseconds.
+**
+*******************************************************************************/
+int LatencyEstimator::timeoutMs(int maxMs) const {
+  if (mBackedOff || (mSamples < kMinSamples)) return maxMs;
+
+  int64_t const estimateUs = mAverageUs + 4 * mDeviationUs + kMarginUs;
+  int64_t timeout = (estimateUs + 999) / 1000;
+  if (timeout < kMinTimeoutMs) timeout = kMinTimeoutMs;
+  return (timeout < maxMs) ? (int)timeout : maxMs;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Estimate a response timeout from observed response latencies.
+ */
+
+#pragma once
+#include <stdint.h>
+
+class LatencyEstimator {
+ public:
+  // samples needed before the estimate is trusted
+  static constexpr int kMinSamples = 4;
+  // lower bound of an estimated timeout
+  static constexpr int kMinTimeoutMs = 20;
+
+  /*******************************************************************************
+  **
+  ** Function:        LatencyEstimator
+  **
+  ** Description:     Initialize member variables.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  LatencyEstimator();
+
+  /*******************************************************************************
+  **
+  ** Function:        addSample
+  **
+  ** Description:     Fold a response latency into the moving average and
+  **                  mean deviation.
+  **                  latencyUs: time from sending a command to its response.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void addSample(uint32_t latencyUs);
+
+  /*******************************************************************************
+  **
+  ** Function:        addTimeout
+  **
+  ** Description:     Record that a command timed out while waiting for the
+  **                  estimated timeout.  The estimate is no longer used, so
+  **                  a slow but live tag only fails once.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void addTimeout();
+
+  /*******************************************************************************
+  **
+  ** Function:        timeoutMs
+  **
+  ** Description:     Timeout derived from the observed latencies: average
+  **                  plus four mean deviations, plus margin.
+  **                  maxMs: configured timeout, which bounds the result.
+  **
+  ** Returns:         Timeout in milliseconds; maxMs if there are too few
+  **                  samples or a command timed out.
+  **
+  *******************************************************************************/
+  int timeoutMs(int maxMs) const;
+
+ private:
+  int mSamples;
+  bool mBackedOff;       // an estimated timeout expired
+  int64_t mAverageUs;    // exponentially weighted, gain 1/8
+  int64_t mDeviationUs;  // mean deviation, gain 1/4
+};
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include "LatencyEstimator.h"
+
+// Test the configured timeout is used until there are enough samples
+TEST(LatencyEstimatorTest, NeedsSamples) {
+  LatencyEstimator latency;
+  for (int i = 0; i < LatencyEstimator::kMinSamples - 1; i++) {
+    latency.addSample(5000);
+    ASSERT_EQ(latency.timeoutMs(618), 618);
+  }
+  latency.addSample(5000);
+  ASSERT_LT(latency.timeoutMs(618), 100);
+}
+
+// Test steady latencies give a tight timeout, bounded on both sides
+TEST(LatencyEstimatorTest, Bounds) {
+  LatencyEstimator fast;
+  for (int i = 0; i < 50; i++) fast.addSample(1000);
+  ASSERT_EQ(fast.timeoutMs(618), LatencyEstimator::kMinTimeoutMs);
+
+  LatencyEstimator slow;
+  for (int i = 0; i < 50; i++) slow.addSample(400000);
+  ASSERT_EQ(slow.timeoutMs(255), 255);
+}
+
+// Test jitter widens the timeout
+TEST(LatencyEstimatorTest, Jitter) {
+  LatencyEstimator steady, jittery;
+  for (int i = 0; i < 50; i++) {
+    steady.addSample(20000);
+    jittery.addSample((i % 2) ? 5000 : 35000);
+  }
+  ASSERT_GT(jittery.timeoutMs(1000), steady.timeoutMs(1000));
+}
+
+// Test a timeout falls back to the configured value
+TEST(LatencyEstimatorTest, BackOff) {
+  LatencyEstimator latency;
+  for (int i = 0; i < 10; i++) latency.addSample(5000);
+  latency.addTimeout();
+  ASSERT_EQ(latency.timeoutMs(618), 618);
+}
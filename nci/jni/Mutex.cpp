@@ -23,23 +23,164 @@
 #include <android-base/logging.h>
 #include <android-base/stringprintf.h>
 #include <errno.h>
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
 
+#include <algorithm>
+
+#include "Futex.h"
 #include "NfcJniUtil.h"
 
 using android::base::StringPrintf;
 
+namespace {
+// bounds of the number of spins before an adaptive lock goes to sleep
+const uint32_t kMinSpins = 16;
+const uint32_t kMaxSpins = 1000;
+const uint32_t kInitialSpins = 100;
+
+std::atomic<bool> sProfilingEnabled(false);
+
+uint64_t nowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void updateMax(std::atomic<uint64_t>& max, uint64_t value) {
+  uint64_t current = max.load(std::memory_order_relaxed);
+  while ((value > current) &&
+         !max.compare_exchange_weak(current, value,
+                                    std::memory_order_relaxed)) {
+  }
+}
+}  // namespace
+
+/*****************************************************************************
+**
+**  Name:           Mutex::Profile
+**
+**  Description:    Wait and hold times of a named mutex, broken down by the
+**                  call site that locked it.  Counters are updated without
+**                  locks so that profiling does not add contention.
+**
+*****************************************************************************/
+struct Mutex::Profile {
+  struct Site {
+    std::atomic<const char*> caller;
+    std::atomic<uint64_t> acquisitions;
+    std::atomic<uint64_t> contended;
+    std::atomic<uint64_t> waitNs;
+    std::atomic<uint64_t> maxWaitNs;
+    std::atomic<uint64_t> holdNs;
+    std::atomic<uint64_t> maxHoldNs;
+  };
+  // the last site collects the callers that do not fit
+  static const int kMaxSites = 8;
+
+  Site* site(const char* caller);
+
+  const char* name;
+  std::atomic<const char*> owner;  // call site holding the mutex
+  uint64_t lockedAtNs;  // 0 unless timing a hold; used by the owner only
+  Site sites[kMaxSites];
+  Profile* prev;  // neighbours in sProfiles
+  Profile* next;
+
+  static pthread_mutex_t sProfilesLock;
+  static Profile* sProfiles;
+};
+
+pthread_mutex_t Mutex::Profile::sProfilesLock = PTHREAD_MUTEX_INITIALIZER;
+Mutex::Profile* Mutex::Profile::sProfiles = NULL;
+
+/*******************************************************************************
+**
+** Function:        site
+**
+** Description:     Find or claim the counters of a call site.
+**                  caller: name of the calling function.
+**
+** Returns:         Counters of the call site.
+**
+*******************************************************************************/
+Mutex::Profile::Site* Mutex::Profile::site(const char* caller) {
+  for (int i = 0; i < kMaxSites - 1; i++) {
+    const char* current = sites[i].caller.load(std::memory_order_acquire);
+    if ((current == NULL) &&
+        sites[i].caller.compare_exchange_strong(current, caller,
+                                                std::memory_order_acq_rel)) {
+      return &sites[i];
+    }
+    // equal names from different translation units may not share a pointer
+    if ((current == caller) || (strcmp(current, caller) == 0)) {
+      return &sites[i];
+    }
+  }
+  return &sites[kMaxSites - 1];
+}
+
 /*******************************************************************************
 **
 ** Function:        Mutex
 **
 ** Description:     Initialize member variables.
+**                  kind: implementation of the mutex.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+Mutex::Mutex(Kind kind)
+    : mKind(kind),
+      mProfile(NULL),
+      mFutex(kUnlocked),
+      mSpinLimit(kInitialSpins) {
+  init();
+}
+
+/*******************************************************************************
+**
+** Function:        Mutex
+**
+** Description:     Initialize member variables; add the mutex to the list
+**                  reported by dumpProfiles().
+**                  name: name of the mutex.
+**                  kind: implementation of the mutex.
 **
 ** Returns:         None.
 **
 *******************************************************************************/
-Mutex::Mutex() {
+Mutex::Mutex(const char* name, Kind kind)
+    : mKind(kind),
+      mProfile(NULL),
+      mFutex(kUnlocked),
+      mSpinLimit(kInitialSpins) {
+  init();
+  if (name == NULL) return;
+
+  mProfile = new Profile();
+  mProfile->name = name;
+  mProfile->sites[Profile::kMaxSites - 1].caller = "(other)";
+  pthread_mutex_lock(&Profile::sProfilesLock);
+  mProfile->next = Profile::sProfiles;
+  if (Profile::sProfiles) Profile::sProfiles->prev = mProfile;
+  Profile::sProfiles = mProfile;
+  pthread_mutex_unlock(&Profile::sProfilesLock);
+}
+
+/*******************************************************************************
+**
+** Function:        init
+**
+** Description:     Initialize the pthread mutex, unless adaptive.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void Mutex::init() {
   memset(&mMutex, 0, sizeof(mMutex));
+  if (mKind == kAdaptive) return;
   int res = pthread_mutex_init(&mMutex, NULL);
   if (res != 0) {
     LOG(ERROR) << StringPrintf("Mutex::Mutex: fail init; error=0x%X", res);
@@ -56,6 +197,15 @@ Mutex::Mutex() {
 **
 *******************************************************************************/
 Mutex::~Mutex() {
+  if (mProfile) {
+    pthread_mutex_lock(&Profile::sProfilesLock);
+    if (mProfile->prev) mProfile->prev->next = mProfile->next;
+    if (mProfile->next) mProfile->next->prev = mProfile->prev;
+    if (Profile::sProfiles == mProfile) Profile::sProfiles = mProfile->next;
+    pthread_mutex_unlock(&Profile::sProfilesLock);
+    delete mProfile;
+  }
+  if (mKind == kAdaptive) return;
   int res = pthread_mutex_destroy(&mMutex);
   if (res != 0) {
     LOG(ERROR) << StringPrintf("Mutex::~Mutex: fail destroy; error=0x%X", res);
@@ -67,14 +217,30 @@ Mutex::~Mutex() {
 ** Function:        lock
 **
 ** Description:     Block the thread and try lock the mutex.
+**                  caller: call site recorded when profiling.
 **
 ** Returns:         None.
 **
 *******************************************************************************/
-void Mutex::lock() {
-  int res = pthread_mutex_lock(&mMutex);
-  if (res != 0) {
-    LOG(ERROR) << StringPrintf("Mutex::lock: fail lock; error=0x%X", res);
+void Mutex::lock(const char* caller) {
+  if (!profiling()) {
+    rawLock();
+    return;
+  }
+
+  if (caller == NULL) caller = "(unknown)";
+  uint64_t const startNs = nowNs();
+  bool const contended = !rawTryLock();
+  if (contended) rawLock();
+  holdBegin(caller);
+
+  Profile::Site* site = mProfile->site(caller);
+  site->acquisitions.fetch_add(1, std::memory_order_relaxed);
+  if (contended) {
+    uint64_t const waitNs = mProfile->lockedAtNs - startNs;
+    site->contended.fetch_add(1, std::memory_order_relaxed);
+    site->waitNs.fetch_add(waitNs, std::memory_order_relaxed);
+    updateMax(site->maxWaitNs, waitNs);
   }
 }
 
@@ -88,10 +254,8 @@ void Mutex::lock() {
 **
 *******************************************************************************/
 void Mutex::unlock() {
-  int res = pthread_mutex_unlock(&mMutex);
-  if (res != 0) {
-    LOG(ERROR) << StringPrintf("Mutex::unlock: fail unlock; error=0x%X", res);
-  }
+  if (mProfile) holdEnd();
+  rawUnlock();
 }
 
 /*******************************************************************************
@@ -99,11 +263,49 @@ void Mutex::unlock() {
 ** Function:        tryLock
 **
 ** Description:     Try to lock the mutex.
+**                  caller: call site recorded when profiling.
 **
 ** Returns:         True if the mutex is locked.
 **
 *******************************************************************************/
-bool Mutex::tryLock() {
+bool Mutex::tryLock(const char* caller) {
+  if (!rawTryLock()) return false;
+  if (profiling()) {
+    if (caller == NULL) caller = "(unknown)";
+    holdBegin(caller);
+    mProfile->site(caller)->acquisitions.fetch_add(1,
+                                                   std::memory_order_relaxed);
+  }
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        rawLock / rawTryLock / rawUnlock
+**
+** Description:     Lock, try to lock or unlock without profiling.
+**
+** Returns:         rawTryLock returns true if the mutex is locked.
+**
+*******************************************************************************/
+void Mutex::rawLock() {
+  if (mKind == kAdaptive) {
+    adaptiveLock();
+    return;
+  }
+  int res = pthread_mutex_lock(&mMutex);
+  if (res != 0) {
+    LOG(ERROR) << StringPrintf("Mutex::lock: fail lock; error=0x%X", res);
+  }
+}
+
+bool Mutex::rawTryLock() {
+  if (mKind == kAdaptive) {
+    uint32_t state = kUnlocked;
+    return mFutex.compare_exchange_strong(state, kLocked,
+                                          std::memory_order_acquire,
+                                          std::memory_order_relaxed);
+  }
   int res = pthread_mutex_trylock(&mMutex);
   if ((res != 0) && (res != EBUSY)) {
     LOG(ERROR) << StringPrintf("Mutex::tryLock: error=0x%X", res);
@@ -111,13 +313,223 @@ bool Mutex::tryLock() {
   return res == 0;
 }
 
+void Mutex::rawUnlock() {
+  if (mKind == kAdaptive) {
+    adaptiveUnlock();
+    return;
+  }
+  int res = pthread_mutex_unlock(&mMutex);
+  if (res != 0) {
+    LOG(ERROR) << StringPrintf("Mutex::unlock: fail unlock; error=0x%X", res);
+  }
+}
+
+/*******************************************************************************
+**
+** Function:        profiling
+**
+** Description:     Whether this mutex records its use.
+**
+** Returns:         True if named and profiling is enabled.
+**
+*******************************************************************************/
+bool Mutex::profiling() const {
+  return mProfile && sProfilingEnabled.load(std::memory_order_relaxed);
+}
+
+/*******************************************************************************
+**
+** Function:        holdBegin
+**
+** Description:     Start timing a hold of the mutex.  The caller must hold
+**                  the mutex.
+**                  caller: call site holding the mutex; NULL to do nothing.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void Mutex::holdBegin(const char* caller) {
+  if ((mProfile == NULL) || (caller == NULL)) return;
+  mProfile->owner.store(caller, std::memory_order_relaxed);
+  mProfile->lockedAtNs = nowNs();
+}
+
+/*******************************************************************************
+**
+** Function:        holdEnd
+**
+** Description:     Stop timing a hold of the mutex, e.g. before unlocking it
+**                  or while a CondVar waits on it.  Holds that began before
+**                  profiling was enabled are not counted.  The caller must
+**                  hold the mutex.
+**
+** Returns:         Call site that held the mutex; NULL if not timed.
+**
+*******************************************************************************/
+const char* Mutex::holdEnd() {
+  if ((mProfile == NULL) || (mProfile->lockedAtNs == 0)) return NULL;
+
+  uint64_t const holdNs = nowNs() - mProfile->lockedAtNs;
+  const char* caller = mProfile->owner.load(std::memory_order_relaxed);
+  mProfile->lockedAtNs = 0;
+  mProfile->owner.store(NULL, std::memory_order_relaxed);
+
+  Profile::Site* site = mProfile->site(caller);
+  site->holdNs.fetch_add(holdNs, std::memory_order_relaxed);
+  updateMax(site->maxHoldNs, holdNs);
+  return caller;
+}
+
+/*******************************************************************************
+**
+** Function:        setProfilingEnabled
+**
+** Description:     Start or stop recording wait time, hold time and call
+**                  sites of named mutexes.
+**                  enabled: whether to profile.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void Mutex::setProfilingEnabled(bool enabled) {
+  sProfilingEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+/*******************************************************************************
+**
+** Function:        dumpProfiles
+**
+** Description:     Write the wait and hold times of every named mutex that
+**                  has been locked while profiling, per call site.
+**                  fd: file descriptor.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void Mutex::dumpProfiles(int fd) {
+  dprintf(fd, "Mutex profiles (%s; times in us):\n",
+          sProfilingEnabled.load(std::memory_order_relaxed) ? "enabled"
+                                                            : "disabled");
+  pthread_mutex_lock(&Profile::sProfilesLock);
+  for (Profile* profile = Profile::sProfiles; profile;
+       profile = profile->next) {
+    bool header = false;
+    for (int i = 0; i < Profile::kMaxSites; i++) {
+      Profile::Site& site = profile->sites[i];
+      uint64_t const acquisitions =
+          site.acquisitions.load(std::memory_order_relaxed);
+      if (acquisitions == 0) continue;
+      if (!header) {
+        const char* owner = profile->owner.load(std::memory_order_relaxed);
+        dprintf(fd, "  %s: owner=%s\n", profile->name, owner ? owner : "-");
+        header = true;
+      }
+      dprintf(fd,
+              "    %s: locks=%llu contended=%llu wait=%llu/max %llu "
+              "hold=%llu/max %llu\n",
+              site.caller.load(std::memory_order_relaxed),
+              (unsigned long long)acquisitions,
+              (unsigned long long)site.contended.load(std::memory_order_relaxed),
+              (unsigned long long)(site.waitNs.load(std::memory_order_relaxed) /
+                                   1000),
+              (unsigned long long)(site.maxWaitNs.load(
+                                       std::memory_order_relaxed) /
+                                   1000),
+              (unsigned long long)(site.holdNs.load(std::memory_order_relaxed) /
+                                   1000),
+              (unsigned long long)(site.maxHoldNs.load(
+                                       std::memory_order_relaxed) /
+                                   1000));
+    }
+  }
+  pthread_mutex_unlock(&Profile::sProfilesLock);
+}
+
 /*******************************************************************************
 **
 ** Function:        nativeHandle
 **
 ** Description:     Get the handle of the mutex.
 **
-** Returns:         Handle of the mutex.
+** Returns:         Handle of the mutex; NULL for an adaptive mutex.
+**
+*******************************************************************************/
+pthread_mutex_t* Mutex::nativeHandle() {
+  return (mKind == kAdaptive) ? NULL : &mMutex;
+}
+
+/*******************************************************************************
+**
+** Function:        lockContended
+**
+** Description:     Lock an adaptive mutex, marking it as having sleepers.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void Mutex::lockContended() {
+  if (mKind != kAdaptive) {
+    rawLock();
+    return;
+  }
+  while (mFutex.exchange(kLockedWithWaiters, std::memory_order_acquire) !=
+         kUnlocked) {
+    futexWait(&mFutex, kLockedWithWaiters, NULL);
+  }
+}
+
+/*******************************************************************************
+**
+** Function:        adaptiveLock
+**
+** Description:     Lock the futex word.  If it is held, spin for a while in
+**                  case the owner is about to release it, then sleep.  The
+**                  spin limit grows when spinning pays off and shrinks when
+**                  it does not.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void Mutex::adaptiveLock() {
+  uint32_t state = kUnlocked;
+  if (mFutex.compare_exchange_strong(state, kLocked, std::memory_order_acquire,
+                                     std::memory_order_relaxed)) {
+    return;
+  }
+
+  uint32_t const limit = mSpinLimit.load(std::memory_order_relaxed);
+  for (uint32_t i = 0; i < limit; i++) {
+    cpuRelax();
+    state = mFutex.load(std::memory_order_relaxed);
+    if (state == kLockedWithWaiters) break;  // others are already asleep
+    if ((state == kUnlocked) &&
+        mFutex.compare_exchange_weak(state, kLocked, std::memory_order_acquire,
+                                     std::memory_order_relaxed)) {
+      if (limit < kMaxSpins) {
+        mSpinLimit.store(std::min(kMaxSpins, limit + kMinSpins),
+                         std::memory_order_relaxed);
+      }
+      return;
+    }
+  }
+  if (limit > kMinSpins) {
+    mSpinLimit.store(std::max(kMinSpins, limit / 2), std::memory_order_relaxed);
+  }
+  lockContended();
+}
+
+/*******************************************************************************
+**
+** Function:        adaptiveUnlock
+**
+** Description:     Unlock the futex word and wake one sleeper, if any.
+**
+** Returns:         None.
 **
 *******************************************************************************/
-pthread_mutex_t* Mutex::nativeHandle() { return &mMutex; }
+void Mutex::adaptiveUnlock() {
+  if (mFutex.exchange(kUnlocked, std::memory_order_release) ==
+      kLockedWithWaiters) {
+    futexWake(&mFutex, 1);
+  }
+}
@@ -20,19 +20,48 @@
 
 #pragma once
 #include <pthread.h>
+#include <stdint.h>
+
+#include <atomic>
 
 class Mutex {
  public:
+  enum Kind {
+    kPthread,   // pthread_mutex_t
+    kAdaptive,  // futex word; spins briefly before sleeping
+  };
+
+#ifdef NFC_JNI_ADAPTIVE_MUTEX
+  static const Kind kDefaultKind = kAdaptive;
+#else
+  static const Kind kDefaultKind = kPthread;
+#endif
+
   /*******************************************************************************
   **
   ** Function:        Mutex
   **
   ** Description:     Initialize member variables.
+  **                  kind: implementation; the default is chosen at build
+  **                  time with NFC_JNI_ADAPTIVE_MUTEX.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  explicit Mutex(Kind kind = kDefaultKind);
+
+  /*******************************************************************************
+  **
+  ** Function:        Mutex
+  **
+  ** Description:     Initialize a named mutex, which can be profiled.
+  **                  name: name shown by dumpProfiles().
+  **                  kind: implementation.
   **
   ** Returns:         None.
   **
   *******************************************************************************/
-  Mutex();
+  explicit Mutex(const char* name, Kind kind = kDefaultKind);
 
   /*******************************************************************************
   **
@@ -50,11 +79,12 @@ class Mutex {
   ** Function:        lock
   **
   ** Description:     Block the thread and try lock the mutex.
+  **                  caller: call site recorded when profiling.
   **
   ** Returns:         None.
   **
   *******************************************************************************/
-  void lock();
+  void lock(const char* caller = __builtin_FUNCTION());
 
   /*******************************************************************************
   **
@@ -72,11 +102,23 @@ class Mutex {
   ** Function:        tryLock
   **
   ** Description:     Try to lock the mutex.
+  **                  caller: call site recorded when profiling.
   **
   ** Returns:         True if the mutex is locked.
   **
   *******************************************************************************/
-  bool tryLock();
+  bool tryLock(const char* caller = __builtin_FUNCTION());
+
+  /*******************************************************************************
+  **
+  ** Function:        kind
+  **
+  ** Description:     Get the implementation of the mutex.
+  **
+  ** Returns:         kPthread or kAdaptive.
+  **
+  *******************************************************************************/
+  Kind kind() const { return mKind; }
 
   /*******************************************************************************
   **
@@ -84,15 +126,59 @@ class Mutex {
   **
   ** Description:     Get the handle of the mutex.
   **
-  ** Returns:         Handle of the mutex.
+  ** Returns:         Handle of the mutex; NULL for an adaptive mutex.
   **
   *******************************************************************************/
   pthread_mutex_t* nativeHandle();
 
+  /*******************************************************************************
+  **
+  ** Function:        lockContended
+  **
+  ** Description:     Lock an adaptive mutex, marking it as having sleepers.
+  **                  Used by CondVar when a waiter reacquires the mutex,
+  **                  since other waiters may still be asleep on it.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void lockContended();
+
+  /*******************************************************************************
+  **
+  ** Function:        setProfilingEnabled
+  **
+  ** Description:     Start or stop recording wait time, hold time and call
+  **                  sites of named mutexes.
+  **                  enabled: whether to profile.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  static void setProfilingEnabled(bool enabled);
+
+  /*******************************************************************************
+  **
+  ** Function:        dumpProfiles
+  **
+  ** Description:     Write the profile of every named mutex.
+  **                  fd: file descriptor.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  static void dumpProfiles(int fd);
+
   class Autolock {
    public:
-    inline Autolock(Mutex& mutex) : mLock(mutex) { mLock.lock(); }
-    inline Autolock(Mutex* mutex) : mLock(*mutex) { mLock.lock(); }
+    inline Autolock(Mutex& mutex, const char* caller = __builtin_FUNCTION())
+        : mLock(mutex) {
+      mLock.lock(caller);
+    }
+    inline Autolock(Mutex* mutex, const char* caller = __builtin_FUNCTION())
+        : mLock(*mutex) {
+      mLock.lock(caller);
+    }
     inline ~Autolock() { mLock.unlock(); }
 
    private:
@@ -100,7 +186,29 @@ class Mutex {
   };
 
  private:
+  friend class CondVar;
+  struct Profile;
+
+  // states of mFutex
+  static const uint32_t kUnlocked = 0;
+  static const uint32_t kLocked = 1;
+  static const uint32_t kLockedWithWaiters = 2;
+
+  void init();
+  void rawLock();
+  bool rawTryLock();
+  void rawUnlock();
+  void adaptiveLock();
+  void adaptiveUnlock();
+  bool profiling() const;
+  void holdBegin(const char* caller);
+  const char* holdEnd();
+
+  const Kind mKind;
+  Profile* mProfile;  // NULL unless named
   pthread_mutex_t mMutex;
+  std::atomic<uint32_t> mFutex;
+  std::atomic<uint32_t> mSpinLimit;  // adapted to recent lock hold times
 };
 
 typedef Mutex::Autolock AutoMutex;
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Contention microbenchmarks for the pthread and adaptive Mutex kinds.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include "CondVar.h"
+#include "Mutex.h"
+
+namespace {
+Mutex sPthreadMutex(Mutex::kPthread);
+Mutex sAdaptiveMutex(Mutex::kAdaptive);
+volatile uint32_t sCounter = 0;
+
+// a critical section of a few instructions, like most users in the JNI layer
+void criticalSection(benchmark::State& state, Mutex& mutex) {
+  for (auto _ : state) {
+    mutex.lock();
+    sCounter = sCounter + 1;
+    mutex.unlock();
+  }
+}
+
+void BM_PthreadMutex(benchmark::State& state) {
+  criticalSection(state, sPthreadMutex);
+}
+
+void BM_AdaptiveMutex(benchmark::State& state) {
+  criticalSection(state, sAdaptiveMutex);
+}
+
+// signal a condition variable nobody waits on, as event callbacks often do
+void notifyUnderLock(benchmark::State& state, Mutex::Kind kind) {
+  Mutex mutex(kind);
+  CondVar condVar;
+  for (auto _ : state) {
+    mutex.lock();
+    condVar.notifyOne();
+    mutex.unlock();
+  }
+}
+
+void BM_PthreadNotify(benchmark::State& state) {
+  notifyUnderLock(state, Mutex::kPthread);
+}
+
+void BM_AdaptiveNotify(benchmark::State& state) {
+  notifyUnderLock(state, Mutex::kAdaptive);
+}
+}  // namespace
+
+BENCHMARK(BM_PthreadMutex)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_AdaptiveMutex)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_PthreadNotify);
+BENCHMARK(BM_AdaptiveNotify);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CondVar.h"
+#include "Mutex.h"
+
+class MutexTest : public ::testing::TestWithParam<Mutex::Kind> {};
+
+static void lockAndWait(Mutex& mutex, CondVar& condVar) {
+  Mutex::Autolock lock(mutex);
+  condVar.wait(mutex, 30);
+}
+
+static std::string dumpProfiles() {
+  FILE* file = tmpfile();
+  if (file == nullptr) return "";
+  Mutex::dumpProfiles(fileno(file));
+  rewind(file);
+  char line[256];
+  std::string dump;
+  while (fgets(line, sizeof(line), file)) dump += line;
+  fclose(file);
+  return dump;
+}
+
+// Test the mutex serializes increments from several threads
+TEST_P(MutexTest, MutualExclusion) {
+  Mutex mutex(GetParam());
+  int counter = 0;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; t++) {
+    threads.emplace_back([&mutex, &counter]() {
+      for (int i = 0; i < 20000; i++) {
+        Mutex::Autolock lock(mutex);
+        counter++;
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  ASSERT_EQ(counter, 8 * 20000);
+}
+
+// Test tryLock() fails while another holder has the mutex
+TEST_P(MutexTest, TryLock) {
+  Mutex mutex(GetParam());
+  ASSERT_TRUE(mutex.tryLock());
+  std::thread other([&mutex]() { EXPECT_FALSE(mutex.tryLock()); });
+  other.join();
+  mutex.unlock();
+  ASSERT_TRUE(mutex.tryLock());
+  mutex.unlock();
+}
+
+// Test a timed condition wait times out, and a notification wakes it
+TEST_P(MutexTest, CondVarWait) {
+  Mutex mutex(GetParam());
+  CondVar condVar;
+  bool ready = false;
+
+  mutex.lock();
+  ASSERT_FALSE(condVar.wait(mutex, 20));
+
+  std::thread notifier([&]() {
+    Mutex::Autolock lock(mutex);
+    ready = true;
+    condVar.notifyOne();
+  });
+  while (!ready) ASSERT_TRUE(condVar.wait(mutex, 5000));
+  mutex.unlock();
+  notifier.join();
+}
+
+// Test a profiled mutex reports its call site, and a condition wait does not
+// count as holding it
+TEST_P(MutexTest, Profile) {
+  Mutex mutex("MutexTest.mutex", GetParam());
+  CondVar condVar;
+  Mutex::setProfilingEnabled(true);
+  lockAndWait(mutex, condVar);
+  lockAndWait(mutex, condVar);
+  Mutex::setProfilingEnabled(false);
+  mutex.lock();  // not counted
+  mutex.unlock();
+
+  std::string dump = dumpProfiles();
+  ASSERT_NE(dump.find("MutexTest.mutex: owner=-\n"), std::string::npos)
+      << dump;
+  size_t site = dump.find("    lockAndWait: locks=2 contended=0");
+  ASSERT_NE(site, std::string::npos) << dump;
+  unsigned long long holdUs = 0, maxHoldUs = 0;
+  ASSERT_EQ(sscanf(dump.c_str() + dump.find("hold=", site), "hold=%llu/max %llu",
+                   &holdUs, &maxHoldUs),
+            2);
+  ASSERT_LT(maxHoldUs, 30000u);
+}
+
+INSTANTIATE_TEST_SUITE_P(Kinds, MutexTest,
+                         ::testing::Values(Mutex::kPthread, Mutex::kAdaptive));
@@ -24,6 +24,7 @@
 #include <nativehelper/ScopedUtfChars.h>
 #include <semaphore.h>
 
+#include "BufferPool.h"
 #include "HciEventManager.h"
 #include "JavaClassConstants.h"
 #include "NativeWlcManager.h"
@@ -35,9 +36,11 @@
 #include "NfcJniUtil.h"
 #include "NfcTag.h"
 #include "NfceeManager.h"
+#include "PhaseStats.h"
 #include "PowerSwitch.h"
 #include "RoutingManager.h"
 #include "SyncEvent.h"
+#include "TransceiveTrace.h"
 #include "android_nfc.h"
 #include "ce_api.h"
 #include "debug_lmrt.h"
@@ -75,6 +78,13 @@ extern void nativeNfcTag_setRfInterface(tNFA_INTF_TYPE rfInterface);
 extern void nativeNfcTag_setActivatedRfProtocol(tNFA_INTF_TYPE rfProtocol);
 extern void nativeNfcTag_setActivatedRfMode(uint8_t rfMode);
 extern void nativeNfcTag_abortWaits();
+extern void nativeNfcTag_setNdefPrefetch(bool enabled);
+extern void nativeNfcTag_startNdefPrefetch(uint8_t protocol);
+extern void nativeNfcTag_setNdefCache(bool enabled);
+extern void nativeNfcTag_dumpNdefCache(int fd);
+extern void nativeNfcTag_setAdaptivePresenceCheck(bool enabled);
+extern void nativeNfcTag_setFastReselect(bool enabled);
+extern void nativeNfcTag_notifyTagLost();
 extern void nativeNfcTag_registerNdefTypeHandler();
 extern void nativeNfcTag_acquireRfInterfaceMutexLock();
 extern void nativeNfcTag_releaseRfInterfaceMutexLock();
@@ -87,7 +97,7 @@ extern void updateNfcID0Param(uint8_t* nfcID0);
 **
 *****************************************************************************/
 bool gActivated = false;
-SyncEvent gDeactivatedEvent;
+SyncEvent gDeactivatedEvent("gDeactivatedEvent");
 SyncEvent sNfaSetPowerSubState;
 int recovery_option = 0;
 int always_on_nfcee_power_and_link_conf = 0;
@@ -133,15 +143,17 @@ bool isDiscoveryStarted();
 **
 *****************************************************************************/
 namespace android {
-static SyncEvent sNfaEnableEvent;                // event for NFA_Enable()
-static SyncEvent sNfaDisableEvent;               // event for NFA_Disable()
-static SyncEvent sNfaEnableDisablePollingEvent;  // event for
-                                                 // NFA_EnablePolling(),
-                                                 // NFA_DisablePolling()
-SyncEvent gNfaSetConfigEvent;                    // event for Set_Config....
-SyncEvent gNfaGetConfigEvent;                    // event for Get_Config....
-SyncEvent gNfaVsCommand;                         // event for VS commands
-SyncEvent gSendRawVsCmdEvent;  // event for NFA_SendRawVsCommand()
+// event for NFA_Enable()
+static SyncEvent sNfaEnableEvent("sNfaEnableEvent");
+// event for NFA_Disable()
+static SyncEvent sNfaDisableEvent("sNfaDisableEvent");
+// event for NFA_EnablePolling(), NFA_DisablePolling()
+static SyncEvent sNfaEnableDisablePollingEvent("sNfaEnableDisablePollingEvent");
+SyncEvent gNfaSetConfigEvent("gNfaSetConfigEvent");  // event for Set_Config
+SyncEvent gNfaGetConfigEvent("gNfaGetConfigEvent");  // event for Get_Config
+LatchedSyncEvent gNfaVsCommand("gNfaVsCommand");     // event for VS commands
+LatchedSyncEvent gSendRawVsCmdEvent(
+    "gSendRawVsCmdEvent");  // event for NFA_SendRawVsCommand()
 static bool sIsNfaEnabled = false;
 static bool sDiscoveryEnabled = false;  // is polling or listening
 static bool sPollingEnabled = false;    // is polling for tag?
@@ -227,6 +239,48 @@ void initializeDisableAlwaysOnNfceePowerAndLinkConf() {
              << disable_always_on_nfcee_power_and_link_conf;
 }
 
+void initializeAdaptiveTransceiveTimeout() {
+  bool enabled =
+      property_get_bool("persist.nfc.adaptive_transceive_timeout", false);
+  NfcTag::getInstance().setAdaptiveTransceiveTimeout(enabled);
+}
+
+void initializeNdefPrefetch() {
+  bool enabled = property_get_bool("persist.nfc.ndef_prefetch", false);
+  nativeNfcTag_setNdefPrefetch(enabled);
+
+  LOG(DEBUG) << __func__ << ": NDEF prefetch=" << enabled;
+}
+
+void initializeNdefCache() {
+  bool enabled = property_get_bool("persist.nfc.ndef_cache", false);
+  nativeNfcTag_setNdefCache(enabled);
+
+  LOG(DEBUG) << __func__ << ": NDEF cache=" << enabled;
+}
+
+void initializeAdaptivePresenceCheck() {
+  bool enabled =
+      property_get_bool("persist.nfc.adaptive_presence_check", false);
+  nativeNfcTag_setAdaptivePresenceCheck(enabled);
+
+  LOG(DEBUG) << __func__ << ": adaptive presence check=" << enabled;
+}
+
+void initializeFastReselect() {
+  bool enabled = property_get_bool("persist.nfc.fast_reselect", false);
+  nativeNfcTag_setFastReselect(enabled);
+
+  LOG(DEBUG) << __func__ << ": fast reselect=" << enabled;
+}
+
+void initializeMutexProfiling() {
+  bool enabled = property_get_bool("persist.nfc.debug_mutex_profiling", false);
+  Mutex::setProfilingEnabled(enabled);
+
+  LOG(DEBUG) << __func__ << ": mutex profiling=" << enabled;
+}
+
 }  // namespace
 
 /*******************************************************************************
@@ -447,14 +501,23 @@ static void nfaConnectionCallback(uint8_t connEvent,
       }
 
       nativeNfcTag_resetPresenceCheck();
+      bool isDeactivating = false;
       if (!isListenMode(eventData->activated) &&
           (prevScreenState == NFA_SCREEN_STATE_OFF_LOCKED ||
            prevScreenState == NFA_SCREEN_STATE_OFF_UNLOCKED)) {
         if (!sIsAlwaysPolling) {
           NFA_Deactivate(FALSE);
+          isDeactivating = true;
         }
       }
 
+      // start reading NDEF while the tag is dispatched to the service;
+      // multiprotocol tags are still being probed
+      if (!isDeactivating && !isListenMode(eventData->activated) &&
+          (activatedProtocol != NFA_PROTOCOL_NFC_DEP) &&
+          (NfcTag::getInstance().getNumDiscNtf() == 0)) {
+        nativeNfcTag_startNdefPrefetch(activatedProtocol);
+      }
       NfcTag::getInstance().connectionEventHandler(connEvent, eventData);
       if (NfcTag::getInstance().getNumDiscNtf()) {
         /*If its multiprotocol tag, deactivate tag with current selected
@@ -508,6 +571,7 @@ static void nfaConnectionCallback(uint8_t connEvent,
         NfcTag::getInstance().connectionEventHandler(connEvent, eventData);
         nativeNfcTag_abortWaits();
         NfcTag::getInstance().abort();
+        if (!gIsSelectingRfInterface) nativeNfcTag_notifyTagLost();
       } else if (gIsTagDeactivating) {
         NfcTag::getInstance().setActive(false);
         nativeNfcTag_doDeactivateStatus(0);
@@ -674,6 +738,12 @@ static jboolean nfcManager_initNativeStruc(JNIEnv* e, jobject o) {
   initializeRecoveryOption();
   initializeNfceePowerAndLinkConf();
   initializeDisableAlwaysOnNfceePowerAndLinkConf();
+  initializeMutexProfiling();
+  initializeAdaptiveTransceiveTimeout();
+  initializeNdefPrefetch();
+  initializeNdefCache();
+  initializeAdaptivePresenceCheck();
+  initializeFastReselect();
   LOG(DEBUG) << StringPrintf("%s: enter", __func__);
 
   nfc_jni_native_data* nat =
@@ -1221,6 +1291,7 @@ static jboolean nfcManager_isObserveModeEnabled(JNIEnv* e, jobject o) {
 
   uint8_t cmd[] = {NCI_QUERY_ANDROID_PASSIVE_OBSERVE};
   SyncEventGuard guard(gNfaVsCommand);
+  gNfaVsCommand.reset();
   tNFA_STATUS status =
       NFA_SendVsCommand(NCI_MSG_PROP_ANDROID, sizeof(cmd), cmd, nfaVSCallback);
 
@@ -1287,6 +1358,7 @@ static jboolean nfcManager_setObserveMode(JNIEnv* e, jobject o,
                                : NCI_ANDROID_PASSIVE_OBSERVE_PARAM_DISABLE)};
   {
     SyncEventGuard guard(gNfaVsCommand);
+    gNfaVsCommand.reset();
     tNFA_STATUS status = NFA_SendVsCommand(NCI_MSG_PROP_ANDROID, sizeof(cmd),
                                            cmd, nfaVSCallback);
 
@@ -1978,7 +2050,7 @@ static bool nfcManager_doSetTimeout(JNIEnv*, jobject, jint tech, jint timeout) {
   }
   LOG(DEBUG) << StringPrintf("%s: tech=%d, timeout=%d", __func__, tech,
                              timeout);
-  NfcTag::getInstance().setTransceiveTimeout(tech, timeout);
+  NfcTag::getInstance().setTransceiveTimeout(tech, timeout, true);
   return true;
 }
 
@@ -2019,6 +2091,38 @@ static void nfcManager_doDump(JNIEnv* e, jobject obj, jobject fdobj) {
 
   NfcAdaptation& theInstance = NfcAdaptation::GetInstance();
   theInstance.Dump(fd);
+  BufferPool::getInstance().dump(fd);
+  nativeNfcTag_dumpNdefCache(fd);
+  SyncEvent::dumpAll(fd);
+  PhaseStats::dumpAll(fd);
+  TransceiveTrace::getInstance().dump(fd);
+  Mutex::dumpProfiles(fd);
+}
+
+/*******************************************************************************
+**
+** Function:        nfcManager_doGetTransceiveTrace
+**
+** Description:     Get the trace of the latest tag transceive calls.
+**                  e: JVM environment.
+**                  o: Java object.
+**
+** Returns:         TransceiveTrace::Record of each call, oldest first, in
+**                  host byte order; NULL if out of memory.
+**
+*******************************************************************************/
+static jbyteArray nfcManager_doGetTransceiveTrace(JNIEnv* e, jobject) {
+  TransceiveTrace::Record records[TransceiveTrace::kCapacity];
+  size_t const count = TransceiveTrace::getInstance().snapshot(
+      records, TransceiveTrace::kCapacity);
+  jsize const len = (jsize)(count * sizeof(records[0]));
+  jbyteArray trace = e->NewByteArray(len);
+  if (trace == NULL) {
+    LOG(ERROR) << StringPrintf("%s: fail allocate array", __func__);
+    return NULL;
+  }
+  e->SetByteArrayRegion(trace, 0, len, (const jbyte*)records);
+  return trace;
 }
 
 static jint nfcManager_doGetNciVersion(JNIEnv*, jobject) {
@@ -2430,6 +2534,7 @@ static jobject nfcManager_nativeSendRawVendorCmd(JNIEnv* env, jobject o,
   }
 
   SyncEventGuard guard(gSendRawVsCmdEvent);
+  gSendRawVsCmdEvent.reset();
   mStatus = NFA_SendRawVsCommand(command.size(), command.data(),
                                  sendRawVsCmdCallback);
   if (mStatus == NFA_STATUS_OK) {
@@ -2521,6 +2626,8 @@ static JNINativeMethod gMethods[] = {
 
     {"doDump", "(Ljava/io/FileDescriptor;)V", (void*)nfcManager_doDump},
 
+    {"doGetTransceiveTrace", "()[B", (void*)nfcManager_doGetTransceiveTrace},
+
     {"getNciVersion", "()I", (void*)nfcManager_doGetNciVersion},
     {"doEnableDtaMode", "()V", (void*)nfcManager_doEnableDtaMode},
     {"doDisableDtaMode", "()V", (void*)nfcManager_doDisableDtaMode},
@@ -2776,6 +2883,7 @@ static jboolean nfcManager_doSetPowerSavingMode(JNIEnv* e, jobject o,
                 : NCI_ANDROID_POWER_SAVING_PARAM_DISABLE;
 
   SyncEventGuard guard(gNfaVsCommand);
+  gNfaVsCommand.reset();
   tNFA_STATUS status =
       NFA_SendRawVsCommand(sizeof(cmd), cmd, nfaSendRawVsCmdCallback);
   if (status == NFA_STATUS_OK) {
@@ -2793,6 +2901,7 @@ static jbyteArray nfcManager_getProprietaryCaps(JNIEnv* e, jobject o) {
                    NCI_MSG_PROP_ANDROID, NCI_ANDROID_GET_CAPS_PARAM_SIZE,
                    NCI_ANDROID_GET_CAPS};
   SyncEventGuard guard(gNfaVsCommand);
+  gNfaVsCommand.reset();
 
   tNFA_STATUS status = NFA_SendRawVsCommand(sizeof(cmd), cmd, nfaVSCallback);
   if (status == NFA_STATUS_OK) {
@@ -25,11 +25,20 @@
 #include <string.h>
 #include <time.h>
 
+#include <algorithm>
+
+#include "ApduChain.h"
+#include "BufferPool.h"
+#include "Deadline.h"
 #include "IntervalTimer.h"
 #include "JavaClassConstants.h"
 #include "Mutex.h"
+#include "NdefCache.h"
 #include "NfcJniUtil.h"
 #include "NfcTag.h"
+#include "PhaseStats.h"
+#include "PresenceCheckScheduler.h"
+#include "TransceiveTrace.h"
 #include "ndef_utils.h"
 #include "nfa_api.h"
 #include "nfa_rw_api.h"
@@ -78,6 +87,27 @@ namespace android {
 #define NDEF_MIFARE_CLASSIC_TAG 101
 
 #define STATUS_CODE_TARGET_LOST 146  // this error code comes from the service
+// time a connect or reconnect may take to select and activate the tag
+// again, on top of the deactivation; see reselectBudgetMs()
+#define RESELECT_SELECT_BUDGET_MS 500
+// time to wait for the tag to go idle once a reselect has run out of time
+#define RESELECT_ABANDON_WAIT_MS 100
+// SELECT of the NDEF tag application, version 2
+#define T4T_SELECT_NDEF_APP \
+  0x00, 0xA4, 0x04, 0x00, 0x07, 0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01, 0x00
+// room reserved for a chained response; it grows if the tag sends more
+#define CHAINED_RESPONSE_RESERVE 1024
+// most round trips of one chained transceive, against looping tags
+#define MAX_CHAINED_ROUNDS 64
+// longest wait for an NDEF prefetch started at activation
+#define NDEF_PREFETCH_WAIT_MS 2000
+// tags whose NDEF message is kept for repeat taps
+#define NDEF_CACHE_ENTRIES 32
+// longest NDEF message kept for repeat taps
+#define NDEF_CACHE_MAX_MESSAGE 8192
+// bounds of a chunk of a streamed NDEF read, and so of its native buffer
+#define NDEF_STREAM_MIN_CHUNK 16
+#define NDEF_STREAM_MAX_CHUNK 4096
 
 static uint32_t sCheckNdefCurrentSize = 0;
 static tNFA_STATUS sCheckNdefStatus =
@@ -88,21 +118,26 @@ static tNFA_INTF_TYPE sCurrentRfInterface = NFA_INTERFACE_ISO_DEP;
 static tNFA_INTF_TYPE sCurrentActivatedProtocl = NFA_INTERFACE_ISO_DEP;
 static uint8_t sCurrentActivatedMode = 0;
 static std::vector<uint8_t> sRxDataBuffer;
+// caller-owned buffer that receives the response instead of sRxDataBuffer;
+// sRxDirectLen may exceed sRxDirectMax, and then no more is copied
+static uint8_t* sRxDirect = NULL;
+static size_t sRxDirectMax = 0;
+static size_t sRxDirectLen = 0;
 static tNFA_STATUS sRxDataStatus = NFA_STATUS_OK;
 static bool sWaitingForTransceive = false;
 static bool sIsISODepActivatedByApp = false;
 static bool sTransceiveRfTimeout = false;
-static Mutex sRfInterfaceMutex;
+static Mutex sRfInterfaceMutex("sRfInterfaceMutex");
 static uint32_t sReadDataLen = 0;
 static uint8_t* sReadData = NULL;
 static bool sIsReadingNdefMessage = false;
-static SyncEvent sReadEvent;
+static SyncEvent sReadEvent("sReadEvent");
 static sem_t sWriteSem;
 static sem_t sFormatSem;
-static SyncEvent sTransceiveEvent;
-static SyncEvent sReconnectEvent;
+static LatchedSyncEvent sTransceiveEvent("sTransceiveEvent");
+static LatchedSyncEvent sReconnectEvent("sReconnectEvent");
 static sem_t sCheckNdefSem;
-static SyncEvent sPresenceCheckEvent;
+static LatchedSyncEvent sPresenceCheckEvent("sPresenceCheckEvent");
 static sem_t sMakeReadonlySem;
 static IntervalTimer sSwitchBackTimer;  // timer used to tell us to switch back
                                         // to ISO_DEP frame interface
@@ -127,13 +162,356 @@ static int sCurrentConnectedTargetIdx = 0;
 static int sIsoDepPresCheckCnt = 0;
 static bool sIsoDepPresCheckAlternate = false;
 static int sPresCheckErrCnt = 0;
+static bool sAdaptivePresenceCheck = false;
+// presence-check method of the activated ISO-DEP tag, once probed or learned
+static bool sPresCheckMethodKnown = false;
+static tNFA_RW_PRES_CHK_OPTION sPresCheckMethod = NFA_RW_PRES_CHK_DEFAULT;
+static Mutex sPresenceScheduleMutex("sPresenceScheduleMutex");
+static PresenceCheckScheduler sPresenceScheduler;
 static bool sReselectTagIdle = false;
 
 static int sPresCheckStatus = 0;
 
-static int reSelect(tNFA_INTF_TYPE rfInterface, bool fSwitchIfNeeded);
+// NDEF detection and read started at activation; see
+// nativeNfcTag_startNdefPrefetch()
+enum NdefPrefetchState {
+  NDEF_PREFETCH_IDLE,
+  NDEF_PREFETCH_DETECTING,  // waiting for NFA_NDEF_DETECT_EVT
+  NDEF_PREFETCH_READING,    // waiting for NFA_READ_CPLT_EVT
+  NDEF_PREFETCH_DONE,       // result held for doCheckNdef and doRead
+};
+static bool sNdefPrefetchEnabled = false;
+static NdefPrefetchState sNdefPrefetchState = NDEF_PREFETCH_IDLE;
+static bool sNdefPrefetchCheckTaken = false;  // doCheckNdef used the result
+static uint8_t* sNdefPrefetchData = NULL;     // message; NULL if not read
+static uint32_t sNdefPrefetchDataLen = 0;
+static SyncEvent sNdefPrefetchEvent("sNdefPrefetchEvent");
+static bool sNdefCacheEnabled = false;
+static NdefCache sNdefCache(NDEF_CACHE_ENTRIES, NDEF_CACHE_MAX_MESSAGE);
+static bool sFastReselect = false;
+// time taken by the phases of the last reSelect(), in microseconds
+static struct {
+  uint32_t haltUs;
+  uint32_t deactivateUs;
+  uint32_t selectUs;
+} sReselectTiming;
+// asynchronous transceive in flight; guarded by sTransceiveEvent
+static uint32_t sAsyncTransceiveId = 0;  // 0 if none is in flight
+static uint32_t sLastAsyncTransceiveId = 0;
+static jobject sAsyncTransceiveTag = NULL;  // global ref to the Java tag
+static uint64_t sAsyncTransceiveDeadlineNs = 0;
+static uint64_t sAsyncTransceiveSentNs = 0;
+static int sAsyncTransceiveTechId = 0;
+static uint8_t sAsyncTransceiveCmd[2];  // enough to classify the command
+static size_t sAsyncTransceiveCmdLen = 0;
+static IntervalTimer sAsyncTransceiveTimer;
+static jmethodID sOnTransceiveComplete = NULL;
+// times of the transceive in progress, for TransceiveTrace
+static uint64_t sTraceSentNs = 0;
+static uint64_t sTraceCallbackNs = 0;
+static PhaseStats sHaltPhase("reSelect.halt");
+static PhaseStats sDeactivatePhase("reSelect.deactivate");
+static PhaseStats sSelectPhase("reSelect.select");
+static PhaseStats sPresenceSleepPhase("presenceCheck.sleep");
+
+static int reselectBudgetMs();
+static void abandonReselect();
+static int reSelect(tNFA_INTF_TYPE rfInterface, bool fSwitchIfNeeded,
+                    const Deadline& deadline);
 extern bool gIsDtaEnabled;
-static tNFA_STATUS performHaltPICC();
+static tNFA_STATUS performHaltPICC(int hltaWaitMs, bool* acknowledged);
+static uint64_t nowNs();
+// an asynchronous transceive taken off sTransceiveEvent, to be finished
+struct AsyncTransceive {
+  uint32_t id;  // 0 if none was in flight
+  jobject tag;  // global ref to the Java tag
+  uint64_t sentNs;
+  int techId;
+  uint8_t cmd[2];
+  size_t cmdLen;
+};
+static bool takeTransceiveAsync(AsyncTransceive* async);
+static void finishTransceiveAsync(const AsyncTransceive& async,
+                                  std::vector<uint8_t>* response, int status);
+static void recordTransceiveAsync(const AsyncTransceive& async,
+                                  bool responded);
+
+/*******************************************************************************
+**
+** Function:        nativeNfcTag_setNdefCache
+**
+** Description:     Enable or disable keeping NDEF messages for repeat taps.
+**                  enabled: whether to keep messages.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void nativeNfcTag_setNdefCache(bool enabled) {
+  LOG(DEBUG) << StringPrintf("%s: enabled=%d", __func__, enabled);
+  sNdefCacheEnabled = enabled;
+  if (!enabled) sNdefCache.clear();
+}
+
+/*******************************************************************************
+**
+** Function:        nativeNfcTag_dumpNdefCache
+**
+** Description:     Write the counters of the NDEF cache, if enabled.
+**                  fd: file descriptor.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void nativeNfcTag_dumpNdefCache(int fd) {
+  if (sNdefCacheEnabled) sNdefCache.dump(fd);
+}
+
+/*******************************************************************************
+**
+** Function:        getNdefCacheKey
+**
+** Description:     Build the cache key of the activated tag from its ID,
+**                  protocol and the capability reported by the last NDEF
+**                  detection.
+**                  key: receives the key.
+**
+** Returns:         False if the cache is disabled, no NDEF was detected or
+**                  the tag ID is not stable across taps.
+**
+*******************************************************************************/
+static bool getNdefCacheKey(NdefCache::Key* key) {
+  if (!sNdefCacheEnabled || (sCheckNdefStatus != NFA_STATUS_OK)) return false;
+
+  NfcTag& natTag = NfcTag::getInstance();
+  memset(key, 0, sizeof(*key));
+  key->uidLen = natTag.getTagUid(key->uid, sizeof(key->uid));
+  if ((key->uidLen == 0) || !natTag.hasStableTagId()) return false;
+  key->protocol = sCurrentActivatedProtocl;
+  key->maxSize = sCheckNdefMaxSize;
+  key->currentSize = sCheckNdefCurrentSize;
+  key->readOnly = sCheckNdefCardReadOnly;
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        invalidateNdefCache
+**
+** Description:     Forget the cached message of the activated tag, before
+**                  anything that may change it.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void invalidateNdefCache() {
+  if (!sNdefCacheEnabled) return;
+
+  uint8_t uid[NdefCache::kMaxUidLen];
+  size_t uidLen = NfcTag::getInstance().getTagUid(uid, sizeof(uid));
+  if (uidLen > 0) sNdefCache.invalidate(uid, uidLen);
+}
+
+/*******************************************************************************
+**
+** Function:        nativeNfcTag_setNdefPrefetch
+**
+** Description:     Enable or disable NDEF prefetch at tag activation.
+**                  enabled: whether to prefetch.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void nativeNfcTag_setNdefPrefetch(bool enabled) {
+  LOG(DEBUG) << StringPrintf("%s: enabled=%d", __func__, enabled);
+  sNdefPrefetchEnabled = enabled;
+}
+
+/*******************************************************************************
+**
+** Function:        dropNdefPrefetchLocked
+**
+** Description:     Forget the prefetch result; a prefetch still in flight
+**                  completes unnoticed.  The caller must have started
+**                  sNdefPrefetchEvent.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void dropNdefPrefetchLocked() {
+  if (sNdefPrefetchState == NDEF_PREFETCH_READING)
+    sIsReadingNdefMessage = false;
+  if (sNdefPrefetchData) {
+    BufferPool::getInstance().release(sNdefPrefetchData);
+    sNdefPrefetchData = NULL;
+  }
+  sNdefPrefetchDataLen = 0;
+  sNdefPrefetchCheckTaken = false;
+  sNdefPrefetchState = NDEF_PREFETCH_IDLE;
+  sNdefPrefetchEvent.notifyOne();
+}
+
+/*******************************************************************************
+**
+** Function:        nativeNfcTag_startNdefPrefetch
+**
+** Description:     Start NDEF detection as soon as a tag is activated, so
+**                  that the detection and the read of the message overlap
+**                  the dispatch of the tag to the NFC service.  The result
+**                  answers the next doCheckNdef and doRead.  Called on the
+**                  NFA callback thread by NFA_ACTIVATED_EVT.
+**                  protocol: activated protocol.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void nativeNfcTag_startNdefPrefetch(uint8_t protocol) {
+  if (!sNdefPrefetchEnabled) return;
+
+  SyncEventGuard g(sNdefPrefetchEvent);
+  dropNdefPrefetchLocked();
+  if ((protocol != NFA_PROTOCOL_T1T) && (protocol != NFA_PROTOCOL_T2T) &&
+      (protocol != NFA_PROTOCOL_T3T) && (protocol != NFA_PROTOCOL_ISO_DEP) &&
+      (protocol != NFA_PROTOCOL_T5T))
+    return;
+
+  sCheckNdefWaitingForComplete = JNI_FALSE;
+  tNFA_STATUS status = NFA_RwDetectNDef();
+  if (status != NFA_STATUS_OK) {
+    LOG(ERROR) << StringPrintf("%s: NFA_RwDetectNDef failed, status = 0x%X",
+                               __func__, status);
+    return;
+  }
+  LOG(DEBUG) << StringPrintf("%s: detecting; protocol=0x%X", __func__,
+                             protocol);
+  sNdefPrefetchState = NDEF_PREFETCH_DETECTING;
+}
+
+/*******************************************************************************
+**
+** Function:        continueNdefPrefetch
+**
+** Description:     After the prefetch detected NDEF, read the message if
+**                  there is one.  Called on the NFA callback thread.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void continueNdefPrefetch() {
+  SyncEventGuard g(sNdefPrefetchEvent);
+  if (sNdefPrefetchState != NDEF_PREFETCH_DETECTING) return;  // dropped
+
+  sNdefPrefetchState = NDEF_PREFETCH_DONE;
+  NdefCache::Key cacheKey;
+  std::vector<uint8_t> cached;
+  if ((sCheckNdefCurrentSize > 0) && getNdefCacheKey(&cacheKey) &&
+      sNdefCache.lookup(cacheKey, &cached)) {
+    sNdefPrefetchData =
+        (uint8_t*)BufferPool::getInstance().allocate(cached.size());
+    memcpy(sNdefPrefetchData, cached.data(), cached.size());
+    sNdefPrefetchDataLen = cached.size();
+  } else if ((sCheckNdefStatus == NFA_STATUS_OK) &&
+             (sCheckNdefCurrentSize > 0)) {
+    if (sReadData) BufferPool::getInstance().release(sReadData);
+    sReadData = NULL;
+    sReadDataLen = 0;
+    sIsReadingNdefMessage = true;
+    if (NFA_RwReadNDef() == NFA_STATUS_OK) {
+      sNdefPrefetchState = NDEF_PREFETCH_READING;
+      return;
+    }
+    sIsReadingNdefMessage = false;
+  }
+  sNdefPrefetchEvent.notifyOne();
+}
+
+/*******************************************************************************
+**
+** Function:        finishNdefPrefetch
+**
+** Description:     Wait for a prefetch in flight, so that the caller's own
+**                  RF commands do not interleave with it.
+**                  drop: whether to also forget the result, e.g. because
+**                  the caller changes the tag or its activation.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void finishNdefPrefetch(bool drop) {
+  if (!sNdefPrefetchEnabled) return;
+
+  SyncEventGuard g(sNdefPrefetchEvent);
+  Deadline const deadline = Deadline::fromNow(NDEF_PREFETCH_WAIT_MS);
+  while ((sNdefPrefetchState == NDEF_PREFETCH_DETECTING) ||
+         (sNdefPrefetchState == NDEF_PREFETCH_READING)) {
+    if (!sNdefPrefetchEvent.wait(deadline)) {
+      LOG(ERROR) << StringPrintf("%s: prefetch timeout", __func__);
+      drop = true;
+      break;
+    }
+  }
+  if (drop) dropNdefPrefetchLocked();
+}
+
+/*******************************************************************************
+**
+** Function:        takeNdefPrefetchCheck
+**
+** Description:     Whether the prefetch detected NDEF for the first
+**                  doCheckNdef; its outcome is in sCheckNdefStatus and the
+**                  other sCheckNdef variables.
+**
+** Returns:         True if doCheckNdef can use the prefetched result.
+**
+*******************************************************************************/
+static bool takeNdefPrefetchCheck() {
+  finishNdefPrefetch(false);
+  SyncEventGuard g(sNdefPrefetchEvent);
+  if ((sNdefPrefetchState != NDEF_PREFETCH_DONE) || sNdefPrefetchCheckTaken)
+    return false;
+  sNdefPrefetchCheckTaken = true;
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        takeNdefPrefetchMessage
+**
+** Description:     Hand the prefetched NDEF message to doRead.
+**                  data: receives the message, from BufferPool.
+**                  dataLen: receives the length of the message.
+**
+** Returns:         True if a message was prefetched.
+**
+*******************************************************************************/
+static bool takeNdefPrefetchMessage(uint8_t** data, uint32_t* dataLen) {
+  finishNdefPrefetch(false);
+  SyncEventGuard g(sNdefPrefetchEvent);
+  if ((sNdefPrefetchState != NDEF_PREFETCH_DONE) ||
+      (sNdefPrefetchData == NULL))
+    return false;
+  *data = sNdefPrefetchData;
+  *dataLen = sNdefPrefetchDataLen;
+  sNdefPrefetchData = NULL;
+  sNdefPrefetchDataLen = 0;
+  sNdefPrefetchState = NDEF_PREFETCH_IDLE;
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        hasNdefPrefetchMessage
+**
+** Description:     Whether doRead would be served a prefetched message.
+**
+** Returns:         True if a message was prefetched.
+**
+*******************************************************************************/
+static bool hasNdefPrefetchMessage() {
+  finishNdefPrefetch(false);
+  SyncEventGuard g(sNdefPrefetchEvent);
+  return (sNdefPrefetchState == NDEF_PREFETCH_DONE) &&
+         (sNdefPrefetchData != NULL);
+}
 
 /*******************************************************************************
 **
@@ -152,10 +530,14 @@ void nativeNfcTag_abortWaits() {
   }
   sem_post(&sWriteSem);
   sem_post(&sFormatSem);
+  AsyncTransceive async = {};
   {
     SyncEventGuard g(sTransceiveEvent);
     sTransceiveEvent.notifyOne();
+    takeTransceiveAsync(&async);
   }
+  if (async.id != 0)
+    finishTransceiveAsync(async, NULL, STATUS_CODE_TARGET_LOST);
   {
     SyncEventGuard g(sReconnectEvent);
     sReconnectEvent.notifyOne();
@@ -167,6 +549,10 @@ void nativeNfcTag_abortWaits() {
     sPresenceCheckEvent.notifyOne();
   }
   sem_post(&sMakeReadonlySem);
+  {
+    SyncEventGuard g(sNdefPrefetchEvent);
+    dropNdefPrefetchLocked();
+  }
   sCurrentRfInterface = NFA_INTERFACE_ISO_DEP;
   sCurrentActivatedProtocl = NFA_INTERFACE_ISO_DEP;
   if (!gIsTagDeactivating) {
@@ -200,9 +586,26 @@ void nativeNfcTag_doReadCompleted(tNFA_STATUS status) {
 
   if (status != NFA_STATUS_OK) {
     sReadDataLen = 0;
-    if (sReadData) free(sReadData);
+    BufferPool::getInstance().release(sReadData);
     sReadData = NULL;
   }
+  {
+    SyncEventGuard g(sNdefPrefetchEvent);
+    if (sNdefPrefetchState == NDEF_PREFETCH_READING) {
+      // keep the message for doRead
+      NdefCache::Key cacheKey;
+      if ((sReadDataLen > 0) && getNdefCacheKey(&cacheKey))
+        sNdefCache.store(cacheKey, sReadData, sReadDataLen);
+      sIsReadingNdefMessage = false;
+      sNdefPrefetchData = sReadData;
+      sNdefPrefetchDataLen = sReadDataLen;
+      sReadData = NULL;
+      sReadDataLen = 0;
+      sNdefPrefetchState = NDEF_PREFETCH_DONE;
+      sNdefPrefetchEvent.notifyOne();
+      return;
+    }
+  }
   SyncEventGuard g(sReadEvent);
   sReadEvent.notifyOne();
 }
@@ -294,7 +697,7 @@ static void ndefHandlerCallback(tNFA_NDEF_EVT event,
       LOG(DEBUG) << StringPrintf("%s: NFA_NDEF_DATA_EVT; data_len = %u",
                                  __func__, eventData->ndef_data.len);
       sReadDataLen = eventData->ndef_data.len;
-      sReadData = (uint8_t*)malloc(sReadDataLen);
+      sReadData = (uint8_t*)BufferPool::getInstance().allocate(sReadDataLen);
       memcpy(sReadData, eventData->ndef_data.p_data, eventData->ndef_data.len);
     } break;
 
@@ -322,10 +725,32 @@ static jbyteArray nativeNfcTag_doRead(JNIEnv* e, jobject) {
 
   sReadDataLen = 0;
   if (sReadData != NULL) {
-    free(sReadData);
+    BufferPool::getInstance().release(sReadData);
     sReadData = NULL;
   }
 
+  uint8_t* prefetched = NULL;
+  uint32_t prefetchedLen = 0;
+  if (takeNdefPrefetchMessage(&prefetched, &prefetchedLen)) {
+    LOG(DEBUG) << StringPrintf("%s: prefetched %u bytes", __func__,
+                               prefetchedLen);
+    buf = e->NewByteArray(prefetchedLen);
+    e->SetByteArrayRegion(buf, 0, prefetchedLen, (jbyte*)prefetched);
+    BufferPool::getInstance().release(prefetched);
+    return buf;
+  }
+
+  NdefCache::Key cacheKey;
+  bool cacheable = (sCheckNdefCurrentSize > 0) && getNdefCacheKey(&cacheKey);
+  std::vector<uint8_t> cached;
+  if (cacheable && sNdefCache.lookup(cacheKey, &cached)) {
+    LOG(DEBUG) << StringPrintf("%s: cached %zu bytes", __func__,
+                               cached.size());
+    buf = e->NewByteArray(cached.size());
+    e->SetByteArrayRegion(buf, 0, cached.size(), (jbyte*)cached.data());
+    return buf;
+  }
+
   if (sCheckNdefCurrentSize > 0) {
     {
       SyncEventGuard g(sReadEvent);
@@ -340,17 +765,18 @@ static jbyteArray nativeNfcTag_doRead(JNIEnv* e, jobject) {
       LOG(DEBUG) << StringPrintf("%s: read %u bytes", __func__, sReadDataLen);
       buf = e->NewByteArray(sReadDataLen);
       e->SetByteArrayRegion(buf, 0, sReadDataLen, (jbyte*)sReadData);
+      if (cacheable) sNdefCache.store(cacheKey, sReadData, sReadDataLen);
     }
   } else {
     LOG(DEBUG) << StringPrintf("%s: create empty buffer", __func__);
     sReadDataLen = 0;
-    sReadData = (uint8_t*)malloc(1);
+    sReadData = (uint8_t*)BufferPool::getInstance().allocate(1);
     buf = e->NewByteArray(sReadDataLen);
     e->SetByteArrayRegion(buf, 0, sReadDataLen, (jbyte*)sReadData);
   }
 
   if (sReadData) {
-    free(sReadData);
+    BufferPool::getInstance().release(sReadData);
     sReadData = NULL;
   }
   sReadDataLen = 0;
@@ -413,6 +839,8 @@ static jboolean nativeNfcTag_doWrite(JNIEnv* e, jobject, jbyteArray buf) {
   uint8_t buffer[maxBufferSize] = {0};
   uint32_t curDataSize = 0;
 
+  finishNdefPrefetch(true);  // the message is about to change
+  invalidateNdefCache();
   ScopedByteArrayRO bytes(e, buf);
   uint8_t* p_data = const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(
       &bytes[0]));  // TODO: const-ness API bug in NFA_RwWriteNDef!
@@ -539,6 +967,7 @@ void nativeNfcTag_doDeactivateStatus(int status) {
 *******************************************************************************/
 static jint nativeNfcTag_doConnect(JNIEnv*, jobject, jint targetIdx) {
   LOG(DEBUG) << StringPrintf("%s: targetIdx = %d", __func__, targetIdx);
+  finishNdefPrefetch(false);
   int i = targetIdx;
   NfcTag& natTag = NfcTag::getInstance();
   int retCode = NFCSTATUS_SUCCESS;
@@ -588,7 +1017,14 @@ static jint nativeNfcTag_doConnect(JNIEnv*, jobject, jint targetIdx) {
     intfType = NFA_INTERFACE_ISO_DEP;
   }
 
-  retCode = reSelect(intfType, true);
+  {
+    uint64_t const startNs = nowNs();
+    retCode = reSelect(intfType, true, Deadline::fromNow(reselectBudgetMs()));
+    LOG(DEBUG) << StringPrintf(
+        "%s: reselect took %u us; halt=%u deactivate=%u select=%u", __func__,
+        (uint32_t)((nowNs() - startNs) / 1000), sReselectTiming.haltUs,
+        sReselectTiming.deactivateUs, sReselectTiming.selectUs);
+  }
   if (retCode == STATUS_CODE_TARGET_LOST) sIsISODepActivatedByApp = false;
 
   // Check we are connected to requested protocol/tech
@@ -615,27 +1051,93 @@ TheEnd:
   return retCode;
 }
 
+/*******************************************************************************
+**
+** Function:        reselectBudgetMs
+**
+** Description:     Get the time a connect or reconnect may spend from end
+**                  to end.  Deactivation may take the transceive timeout of
+**                  the connected technology, which an application may have
+**                  changed; the select then has RESELECT_SELECT_BUDGET_MS.
+**
+** Returns:         Time in millisecond.
+**
+*******************************************************************************/
+static int reselectBudgetMs() {
+  return NfcTag::getInstance().getTransceiveTimeout(
+             sCurrentConnectedTargetType) +
+         RESELECT_SELECT_BUDGET_MS;
+}
+
+/*******************************************************************************
+**
+** Function:        abandonReselect
+**
+** Description:     Give up a reselect that ran out of time after the tag was
+**                  deactivated.  The tag is deactivated to idle, so that a
+**                  late activation does not leave the stack and the service
+**                  disagreeing on the interface; the tag is then discovered
+**                  again as a new tag.  Must be called with
+**                  gIsSelectingRfInterface set.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void abandonReselect() {
+  SyncEventGuard g(sReconnectEvent);
+  // a late NFA_ACTIVATED_EVT no longer completes the select
+  sConnectWaitingForComplete = JNI_FALSE;
+  if (NfcTag::getInstance().getActivationState() == NfcTag::Idle) return;
+  sReconnectEvent.reset();
+  tNFA_STATUS const status = NFA_Deactivate(FALSE);
+  if (status != NFA_STATUS_OK) {
+    LOG(ERROR) << StringPrintf("%s: deactivate failed, status = %d", __func__,
+                               status);
+    return;
+  }
+  // nativeNfcTag_abortWaits() posts the event once the tag is idle
+  if (!sReconnectEvent.wait(RESELECT_ABANDON_WAIT_MS))
+    LOG(ERROR) << StringPrintf("%s: timeout waiting for idle", __func__);
+}
+
 /*******************************************************************************
 **
 ** Function:        reSelect
 **
 ** Description:     Deactivates the tag and re-selects it with the specified
 **                  rf interface.
+**                  deadline: every step ends by this time.  If it passes
+**                  once the tag is deactivated, the tag is deactivated to
+**                  idle and reported lost.
 **
 ** Returns:         status code, 0 on success, 1 on failure,
 **                  146 (defined in service) on tag lost
 **
 *******************************************************************************/
-static int reSelect(tNFA_INTF_TYPE rfInterface, bool fSwitchIfNeeded) {
+static int reSelect(tNFA_INTF_TYPE rfInterface, bool fSwitchIfNeeded,
+                    const Deadline& deadline) {
   LOG(DEBUG) << StringPrintf("%s: enter; rf intf = 0x%x, current intf = 0x%x",
                              __func__, rfInterface, sCurrentRfInterface);
   sRfInterfaceMutex.lock();
+  memset(&sReselectTiming, 0, sizeof(sReselectTiming));
 
   if (fSwitchIfNeeded && (rfInterface == sCurrentRfInterface)) {
     // already in the requested interface
     sRfInterfaceMutex.unlock();
     return 0;  // success
   }
+  {
+    // its response would be lost in the halt and reactivation
+    SyncEventGuard g(sTransceiveEvent);
+    if (sAsyncTransceiveId != 0) {
+      LOG(ERROR) << StringPrintf("%s: async transceive %u in flight", __func__,
+                                 sAsyncTransceiveId);
+      sRfInterfaceMutex.unlock();
+      return 1;  // failure
+    }
+  }
+  // the stack detects NDEF again after the tag is reactivated
+  finishNdefPrefetch(true);
 
   if (gIsDtaEnabled == true) {
     LOG(DEBUG) << StringPrintf("%s: DTA; bypass reselection of T2T or T4T tag",
@@ -660,9 +1162,28 @@ static int reSelect(tNFA_INTF_TYPE rfInterface, bool fSwitchIfNeeded) {
     if ((sCurrentRfInterface == NFA_INTERFACE_FRAME) &&
         (NFC_GetNCIVersion() >= NCI_VERSION_2_0)) {
       {
+        PhaseStats::Scope phase(sHaltPhase, &sReselectTiming.haltUs);
+        NfcTag::HaltSequence sequence = NfcTag::HaltWaitReport;
+        bool const learned =
+            sFastReselect &&
+            natTag.getLearnedHaltSequence(sCurrentActivatedProtocl, &sequence);
+        // S(DESELECT) says nothing about how the tag ends HLTA
+        bool const deselect = sIsISODepActivatedByApp;
+        bool acknowledged = false;
         SyncEventGuard g3(sReconnectEvent);
-        status = performHaltPICC();
-        sReconnectEvent.wait(4);
+        sReconnectEvent.reset();
+        status = performHaltPICC(
+            (sequence == NfcTag::HaltGuardTime) ? 0 : deadline.clampMs(10),
+            &acknowledged);
+        if (sFastReselect && !learned && !deselect &&
+            (status == NFA_STATUS_OK)) {
+          natTag.setLearnedHaltSequence(sCurrentActivatedProtocl,
+                                        acknowledged ? NfcTag::HaltWaitReport
+                                                     : NfcTag::HaltGuardTime);
+        }
+        // a reported halt has already taken the tag's guard time
+        if (!sFastReselect || !acknowledged)
+          sReconnectEvent.wait(deadline.clampMs(4));
         if (status != NFA_STATUS_OK) {
           LOG(ERROR) << StringPrintf("%s: send error=%d", __func__, status);
           break;
@@ -673,12 +1194,15 @@ static int reSelect(tNFA_INTF_TYPE rfInterface, bool fSwitchIfNeeded) {
       // If tag does not answer to S(DESELECT), this might be because no data
       // was sent before. Send empty I-frame in that case
       SyncEventGuard g4(sReconnectEvent);
+      sReconnectEvent.reset();
       status = NFA_SendRawFrame(nullptr, 0, 0);
-      sReconnectEvent.wait(30);
+      sReconnectEvent.wait(deadline.clampMs(30));
     }
 
     {
+      PhaseStats::Scope phase(sDeactivatePhase, &sReselectTiming.deactivateUs);
       SyncEventGuard g(sReconnectEvent);
+      sReconnectEvent.reset();
       gIsTagDeactivating = true;
       LOG(DEBUG) << StringPrintf("%s: deactivate to sleep", __func__);
       if (NFA_STATUS_OK !=
@@ -689,13 +1213,20 @@ static int reSelect(tNFA_INTF_TYPE rfInterface, bool fSwitchIfNeeded) {
         break;
       }
 
-      if (sReconnectEvent.wait(natTag.getTransceiveTimeout(
-              sCurrentConnectedTargetType)) == false)  // if timeout occurred
+      if (sReconnectEvent.wait(deadline.clampMs(natTag.getTransceiveTimeout(
+              sCurrentConnectedTargetType))) == false)  // if timeout occurred
       {
         LOG(ERROR) << StringPrintf("%s: timeout waiting for deactivate",
                                    __func__);
       }
     }
+    if (deadline.expired()) {
+      LOG(ERROR) << StringPrintf("%s: budget used up in deactivate", __func__);
+      gIsTagDeactivating = false;
+      abandonReselect();
+      rVal = STATUS_CODE_TARGET_LOST;
+      break;
+    }
 
     if (NfcTag::getInstance().getActivationState() == NfcTag::Idle) {
       LOG(ERROR) << StringPrintf("%s: tag is in Idle state", __func__);
@@ -707,7 +1238,9 @@ static int reSelect(tNFA_INTF_TYPE rfInterface, bool fSwitchIfNeeded) {
     gIsTagDeactivating = false;
 
     {
+      PhaseStats::Scope phase(sSelectPhase, &sReselectTiming.selectUs);
       SyncEventGuard g2(sReconnectEvent);
+      sReconnectEvent.reset();
 
       sConnectWaitingForComplete = JNI_TRUE;
       gIsSelectingRfInterface = true;
@@ -726,9 +1259,14 @@ static int reSelect(tNFA_INTF_TYPE rfInterface, bool fSwitchIfNeeded) {
         }
       }
       sConnectOk = false;
-      if (sReconnectEvent.wait(1000) == false)  // if timeout occurred
+      if (sReconnectEvent.wait(deadline.clampMs(1000)) ==
+          false)  // if timeout occurred
       {
         LOG(ERROR) << StringPrintf("%s: timeout waiting for select", __func__);
+        if (deadline.expired()) {
+          abandonReselect();
+          rVal = STATUS_CODE_TARGET_LOST;
+        }
         break;
       }
     }
@@ -741,13 +1279,20 @@ static int reSelect(tNFA_INTF_TYPE rfInterface, bool fSwitchIfNeeded) {
       sConnectWaitingForComplete = JNI_TRUE;
       do {
         SyncEventGuard reselectEvent(sReconnectEvent);
-        if (sReconnectEvent.wait(500) == false) {  // if timeout occurred
+        if (sReconnectEvent.wait(deadline.clampMs(500)) ==
+            false) {  // if timeout occurred
           LOG(ERROR) << StringPrintf("%s: timeout ", __func__);
         }
         retry++;
         LOG(ERROR) << StringPrintf("%s: waiting for Card to be activated %x %x",
                                    __func__, retry, sConnectOk);
-      } while (sConnectOk == false && retry < 3);
+      } while (sConnectOk == false && retry < 3 && !deadline.expired());
+      if ((sConnectOk == false) && deadline.expired()) {
+        LOG(ERROR) << StringPrintf("%s: budget used up in select", __func__);
+        abandonReselect();
+        rVal = STATUS_CODE_TARGET_LOST;
+        break;
+      }
     }
 
     LOG(DEBUG) << StringPrintf("%s: select completed; sConnectOk=%d", __func__,
@@ -790,6 +1335,7 @@ static jint nativeNfcTag_doReconnect(JNIEnv*, jobject) {
                              __func__, sCurrentConnectedTargetIdx);
   int retCode = NFCSTATUS_SUCCESS;
   NfcTag& natTag = NfcTag::getInstance();
+  Deadline const deadline = Deadline::fromNow(reselectBudgetMs());
 
   if (natTag.getActivationState() != NfcTag::Active) {
     LOG(ERROR) << StringPrintf("%s: tag already deactivated", __func__);
@@ -806,13 +1352,13 @@ static jint nativeNfcTag_doReconnect(JNIEnv*, jobject) {
   // this is only supported for type 2 or 4 (ISO_DEP) tags
   if (sCurrentConnectedTargetProtocol == NFA_PROTOCOL_ISO_DEP) {
     sCurrentConnectedTargetType = TARGET_TYPE_ISO14443_4;
-    retCode = reSelect(NFA_INTERFACE_ISO_DEP, false);
+    retCode = reSelect(NFA_INTERFACE_ISO_DEP, false, deadline);
   } else if (sCurrentConnectedTargetProtocol == NFA_PROTOCOL_T2T) {
     sCurrentConnectedTargetType = TARGET_TYPE_ISO14443_3A;
-    retCode = reSelect(NFA_INTERFACE_FRAME, false);
+    retCode = reSelect(NFA_INTERFACE_FRAME, false, deadline);
   } else if (sCurrentConnectedTargetProtocol == NFC_PROTOCOL_MIFARE) {
     sCurrentConnectedTargetType = TARGET_TYPE_MIFARE_CLASSIC;
-    retCode = reSelect(NFA_INTERFACE_MIFARE, false);
+    retCode = reSelect(NFA_INTERFACE_MIFARE, false, deadline);
   }
 
   // Check what we are connected to
@@ -850,6 +1396,7 @@ jboolean nativeNfcTag_doDisconnect(JNIEnv*, jobject) {
   LOG(DEBUG) << StringPrintf("%s: enter", __func__);
   tNFA_STATUS nfaStat = NFA_STATUS_OK;
 
+  finishNdefPrefetch(true);
   NfcTag::getInstance().resetAllTransceiveTimeouts();
   sReselectTagIdle = false;
 
@@ -883,128 +1430,367 @@ TheEnd:
 *******************************************************************************/
 void nativeNfcTag_doTransceiveStatus(tNFA_STATUS status, uint8_t* buf,
                                      uint32_t bufLen) {
-  SyncEventGuard g(sTransceiveEvent);
-  LOG(DEBUG) << StringPrintf("%s: data len=%d", __func__, bufLen);
+  AsyncTransceive async = {};
+  std::vector<uint8_t> asyncResponse;
+  {
+    SyncEventGuard g(sTransceiveEvent);
+    LOG(DEBUG) << StringPrintf("%s: data len=%d", __func__, bufLen);
 
-  if (!sWaitingForTransceive) {
-    LOG(ERROR) << StringPrintf("%s: drop data", __func__);
-    return;
-  }
-  sRxDataStatus = status;
-  if (sRxDataStatus == NFA_STATUS_OK || sRxDataStatus == NFC_STATUS_CONTINUE)
-    sRxDataBuffer.insert(sRxDataBuffer.end(), buf, buf + bufLen);
+    if (!sWaitingForTransceive) {
+      LOG(ERROR) << StringPrintf("%s: drop data", __func__);
+      return;
+    }
+    if (sTraceCallbackNs == 0) sTraceCallbackNs = nowNs();
+    sRxDataStatus = status;
+    if (sRxDataStatus == NFA_STATUS_OK ||
+        sRxDataStatus == NFC_STATUS_CONTINUE) {
+      if (sRxDirect != NULL) {
+        if (sRxDirectLen + bufLen <= sRxDirectMax)
+          memcpy(sRxDirect + sRxDirectLen, buf, bufLen);
+        sRxDirectLen += bufLen;
+      } else
+        sRxDataBuffer.insert(sRxDataBuffer.end(), buf, buf + bufLen);
+    }
 
-  if (sRxDataStatus == NFA_STATUS_OK) sTransceiveEvent.notifyOne();
+    if (sRxDataStatus == NFA_STATUS_OK) {
+      if (takeTransceiveAsync(&async))
+        asyncResponse.swap(sRxDataBuffer);
+      else
+        sTransceiveEvent.notifyOne();
+    }
+  }
+  if (async.id != 0) {
+    recordTransceiveAsync(async, true);
+    finishTransceiveAsync(async, &asyncResponse, 0);
+  }
 }
 
 void nativeNfcTag_notifyRfTimeout() {
-  SyncEventGuard g(sTransceiveEvent);
-  LOG(DEBUG) << StringPrintf("%s: waiting for transceive: %d", __func__,
-                             sWaitingForTransceive);
-  if (!sWaitingForTransceive) return;
+  AsyncTransceive async = {};
+  {
+    SyncEventGuard g(sTransceiveEvent);
+    LOG(DEBUG) << StringPrintf("%s: waiting for transceive: %d", __func__,
+                               sWaitingForTransceive);
+    if (!sWaitingForTransceive) return;
 
-  sTransceiveRfTimeout = true;
+    sTransceiveRfTimeout = true;
 
-  sTransceiveEvent.notifyOne();
+    if (!takeTransceiveAsync(&async)) sTransceiveEvent.notifyOne();
+  }
+  if (async.id != 0) {
+    recordTransceiveAsync(async, false);
+    finishTransceiveAsync(async, NULL, STATUS_CODE_TARGET_LOST);
+  }
 }
 
 /*******************************************************************************
 **
-** Function:        nativeNfcTag_doTransceive
+** Function:        sendFrameAndWait
 **
-** Description:     Send raw data to the tag; receive tag's response.
-**                  e: JVM environment.
-**                  o: Java object.
-**                  raw: Not used.
-**                  statusTargetLost: Whether tag responds or times out.
+** Description:     Send a frame the tag may not answer, such as HLTA, and
+**                  wait until the controller reports a response or an RF
+**                  timeout, but no longer than maxMs.  The response is
+**                  discarded.
+**                  buf: frame to send.
+**                  bufLen: length of the frame.
+**                  maxMs: longest wait in millisecond; 0 to not wait.
+**                  completed: if not NULL, set to whether the response or
+**                  the timeout was reported in time.
 **
-** Returns:         Response from tag.
+** Returns:         Status of sending the frame; NFA_STATUS_BUSY if an
+**                  asynchronous transceive is in flight.
 **
 *******************************************************************************/
-static jbyteArray nativeNfcTag_doTransceive(JNIEnv* e, jobject o,
-                                            jbyteArray data, jboolean raw,
-                                            jintArray statusTargetLost) {
-  int timeout =
-      NfcTag::getInstance().getTransceiveTimeout(sCurrentConnectedTargetType);
-  LOG(DEBUG) << StringPrintf("%s: enter; raw=%u; timeout = %d", __func__, raw,
-                             timeout);
-
-  bool waitOk = false;
-  bool isNack = false;
-  jint* targetLost = NULL;
-  tNFA_STATUS status;
-
-  if (NfcTag::getInstance().getActivationState() != NfcTag::Active) {
-    if (statusTargetLost) {
-      targetLost = e->GetIntArrayElements(statusTargetLost, 0);
-      if (targetLost)
-        *targetLost = 1;  // causes NFC service to throw TagLostException
-      e->ReleaseIntArrayElements(statusTargetLost, targetLost, 0);
-    }
-    LOG(DEBUG) << StringPrintf("%s: tag not active", __func__);
-    return NULL;
+static tNFA_STATUS sendFrameAndWait(uint8_t* buf, size_t bufLen, int maxMs,
+                                    bool* completed) {
+  SyncEventGuard g(sTransceiveEvent);
+  if (completed) *completed = false;
+  if (sAsyncTransceiveId != 0) {
+    // the response would be taken for that of the transceive in flight
+    LOG(ERROR) << StringPrintf("%s: async transceive %u in flight", __func__,
+                               sAsyncTransceiveId);
+    return NFA_STATUS_BUSY;
   }
+  sTransceiveEvent.reset();
+  sTransceiveRfTimeout = false;
+  sWaitingForTransceive = true;
+  sRxDataStatus = NFA_STATUS_OK;
+  sRxDataBuffer.clear();
+
+  tNFA_STATUS status = NFA_SendRawFrame(buf, bufLen, 0);
+  bool reported = false;
+  if ((status == NFA_STATUS_OK) && (maxMs > 0))
+    reported = sTransceiveEvent.wait(maxMs);
+  if (completed) *completed = reported;
+  sWaitingForTransceive = false;
+  sRxDataBuffer.clear();
+  return status;
+}
 
-  NfcTag& natTag = NfcTag::getInstance();
-
-  // get input buffer and length from java call
-  ScopedByteArrayRO bytes(e, data);
-  uint8_t* buf = const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(
-      &bytes[0]));  // TODO: API bug; NFA_SendRawFrame should take const*!
-  size_t bufLen = bytes.size();
+/*******************************************************************************
+**
+** Function:        nowNs
+**
+** Description:     Read the monotonic clock.
+**
+** Returns:         Time in nanoseconds.
+**
+*******************************************************************************/
+static uint64_t nowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
 
-  if (statusTargetLost) {
-    targetLost = e->GetIntArrayElements(statusTargetLost, 0);
-    if (targetLost) *targetLost = 0;  // success, tag is still present
+/*******************************************************************************
+**
+** Function:        noteIsoDepActivation
+**
+** Description:     Remember that the application activates ISO-DEP itself
+**                  if the frame sent is RATS or ATTRIB.
+**                  buf: frame sent.
+**                  bufLen: length of the frame.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void noteIsoDepActivation(const uint8_t* buf, size_t bufLen) {
+  if (((bufLen >= 2) &&
+       (memcmp(buf, RW_TAG_RATS, sizeof(RW_TAG_RATS)) == 0)) ||
+      ((bufLen >= 5) &&
+       (memcmp(buf, RW_ATTRIB_REQ, sizeof(RW_ATTRIB_REQ)) == 0) &&
+       (memcmp((buf + 1), mNfcID0, sizeof(mNfcID0)) == 0))) {
+    sIsISODepActivatedByApp = true;
   }
+}
 
-  sSwitchBackTimer.kill();
-  ScopedLocalRef<jbyteArray> result(e, NULL);
-  do {
-    {
-      SyncEventGuard g(sTransceiveEvent);
-      sTransceiveRfTimeout = false;
-      sWaitingForTransceive = true;
-      sRxDataStatus = NFA_STATUS_OK;
-      sRxDataBuffer.clear();
+/*******************************************************************************
+**
+** Function:        endTransceive
+**
+** Description:     Stop accepting responses after transceiveFrame().  The
+**                  flag is left alone if transceiveFrame() was refused
+**                  because an asynchronous transceive owns it.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void endTransceive() {
+  SyncEventGuard g(sTransceiveEvent);
+  if (sAsyncTransceiveId == 0) sWaitingForTransceive = false;
+}
 
-      status = NFA_SendRawFrame(buf, bufLen,
-                                NFA_DM_DEFAULT_PRESENCE_CHECK_START_DELAY);
-      if (status != NFA_STATUS_OK) {
-        LOG(ERROR) << StringPrintf("%s: fail send; error=%d", __func__, status);
-        break;
-      }
-      if (((bufLen >= 2) &&
-           (memcmp(buf, RW_TAG_RATS, sizeof(RW_TAG_RATS)) == 0)) ||
-          ((bufLen >= 5) &&
-           (memcmp(buf, RW_ATTRIB_REQ, sizeof(RW_ATTRIB_REQ)) == 0) &&
-           (memcmp((buf + 1), mNfcID0, sizeof(mNfcID0)) == 0))) {
-        sIsISODepActivatedByApp = true;
-      }
-      waitOk = sTransceiveEvent.wait(timeout);
+/*******************************************************************************
+**
+** Function:        takeRxDirect
+**
+** Description:     Stop writing responses to the buffer given to
+**                  transceiveFrame(), before anything else is sent to the tag
+**                  and before the buffer may go away.
+**
+** Returns:         Length of the response; more than the size of the buffer
+**                  if it did not fit.
+**
+*******************************************************************************/
+static size_t takeRxDirect() {
+  SyncEventGuard g(sTransceiveEvent);
+  sRxDirect = NULL;
+  return sRxDirectLen;
+}
+
+/*******************************************************************************
+**
+** Function:        transceiveFrame
+**
+** Description:     Send one frame to the tag and wait for its response,
+**                  which is left in sRxDataBuffer, or in rxDirect if given.
+**                  The response latency
+**                  feeds the adaptive transceive timeout.  Once done with
+**                  the response, the caller must call endTransceive().
+**                  buf: frame to send.
+**                  bufLen: length of the frame.
+**                  tagLost: set to true if the tag did not respond or was
+**                  deactivated.
+**                  mayWrite: false for a command known not to change the
+**                  NDEF message, which keeps the cached message.
+**                  rxDirect: buffer to write the response to, without
+**                  staging it; the caller must then call takeRxDirect().
+**                  rxDirectMax: size of rxDirect.
+**
+** Returns:         True if the tag responded.
+**
+*******************************************************************************/
+static bool transceiveFrame(uint8_t* buf, size_t bufLen, bool* tagLost,
+                            bool mayWrite = true, uint8_t* rxDirect = NULL,
+                            size_t rxDirectMax = 0) {
+  finishNdefPrefetch(false);
+  if (mayWrite) invalidateNdefCache();  // raw commands may write the message
+  NfcTag& natTag = NfcTag::getInstance();
+  int const timeout =
+      natTag.getTransceiveTimeout(sCurrentConnectedTargetType, buf, bufLen);
+  bool waitOk = false;
+  uint64_t startNs = 0;
+  {
+    SyncEventGuard g(sTransceiveEvent);
+    if (sAsyncTransceiveId != 0) {
+      LOG(ERROR) << StringPrintf("%s: async transceive %u in flight", __func__,
+                                 sAsyncTransceiveId);
+      sTraceSentNs = 0;
+      return false;
     }
-    gTagJustActivated = false;
-    if (waitOk == false || sTransceiveRfTimeout)  // if timeout occurred
-    {
-      LOG(ERROR) << StringPrintf("%s: wait response timeout", __func__);
+    sTransceiveEvent.reset();
+    sTransceiveRfTimeout = false;
+    sWaitingForTransceive = true;
+    sRxDataStatus = NFA_STATUS_OK;
+    sRxDataBuffer.clear();
+    sRxDirect = rxDirect;
+    sRxDirectMax = rxDirectMax;
+    sRxDirectLen = 0;
+    sTraceSentNs = 0;
+    sTraceCallbackNs = 0;
+
+    tNFA_STATUS status =
+        NFA_SendRawFrame(buf, bufLen, NFA_DM_DEFAULT_PRESENCE_CHECK_START_DELAY);
+    if (status != NFA_STATUS_OK) {
+      LOG(ERROR) << StringPrintf("%s: fail send; error=%d", __func__, status);
+      sWaitingForTransceive = false;
+      sRxDirect = NULL;
+      return false;
+    }
+    noteIsoDepActivation(buf, bufLen);
+    startNs = nowNs();
+    sTraceSentNs = startNs;
+    waitOk = sTransceiveEvent.wait(timeout);
+  }
+  gTagJustActivated = false;
+  bool const responded = waitOk && !sTransceiveRfTimeout;
+  uint64_t const endNs = nowNs();
+  natTag.recordTransceive(sCurrentConnectedTargetType, buf, bufLen,
+                          (uint32_t)((endNs - startNs) / 1000), responded);
+  if (responded && sAdaptivePresenceCheck) {
+    AutoMutex lock(sPresenceScheduleMutex);
+    sPresenceScheduler.recordActivity(endNs);
+  }
+  if (!responded)  // if timeout occurred
+  {
+    LOG(ERROR) << StringPrintf("%s: wait response timeout; timeout=%d",
+                               __func__, timeout);
+    *tagLost = true;
+    return false;
+  }
+
+  if (natTag.getActivationState() != NfcTag::Active) {
+    LOG(ERROR) << StringPrintf("%s: already deactivated", __func__);
+    *tagLost = true;
+    return false;
+  }
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        traceTransceive
+**
+** Description:     Add the transceive call that just ended to the trace.
+**                  entryNs: time the call was entered.
+**                  txLen: octets sent.
+**                  rxLen: octets received.
+**                  flags: TransceiveTrace flags.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void traceTransceive(uint64_t entryNs, size_t txLen, size_t rxLen,
+                            uint8_t flags) {
+  TransceiveTrace::Record record = {};
+  record.entryNs = entryNs;
+  record.txLen = (uint32_t)txLen;
+  record.rxLen = (uint32_t)rxLen;
+  record.status = sRxDataStatus;
+  record.flags = flags;
+  if (sTraceSentNs > entryNs)
+    record.sentUs = (uint32_t)((sTraceSentNs - entryNs) / 1000);
+  if (sTraceCallbackNs > entryNs)
+    record.callbackUs = (uint32_t)((sTraceCallbackNs - entryNs) / 1000);
+  record.returnUs = (uint32_t)((nowNs() - entryNs) / 1000);
+  TransceiveTrace::getInstance().add(record);
+}
+
+/*******************************************************************************
+**
+** Function:        nativeNfcTag_doTransceive
+**
+** Description:     Send raw data to the tag; receive tag's response.
+**                  e: JVM environment.
+**                  o: Java object.
+**                  raw: Not used.
+**                  statusTargetLost: Whether tag responds or times out.
+**
+** Returns:         Response from tag.
+**
+*******************************************************************************/
+static jbyteArray nativeNfcTag_doTransceive(JNIEnv* e, jobject o,
+                                            jbyteArray data, jboolean raw,
+                                            jintArray statusTargetLost) {
+  LOG(DEBUG) << StringPrintf("%s: enter; raw=%u", __func__, raw);
+  uint64_t const entryNs = nowNs();
+
+  bool isNack = false;
+  jint* targetLost = NULL;
+  uint8_t traceFlags = 0;
+  size_t rxLen = 0;
+
+  if (NfcTag::getInstance().getActivationState() != NfcTag::Active) {
+    if (statusTargetLost) {
+      targetLost = e->GetIntArrayElements(statusTargetLost, 0);
       if (targetLost)
         *targetLost = 1;  // causes NFC service to throw TagLostException
-      break;
+      e->ReleaseIntArrayElements(statusTargetLost, targetLost, 0);
     }
+    LOG(DEBUG) << StringPrintf("%s: tag not active", __func__);
+    sTraceSentNs = sTraceCallbackNs = 0;
+    size_t const txLen = (data != NULL) ? e->GetArrayLength(data) : 0;
+    traceTransceive(entryNs, txLen, 0,
+                    TransceiveTrace::kNotSent | TransceiveTrace::kTagLost);
+    return NULL;
+  }
 
-    if (NfcTag::getInstance().getActivationState() != NfcTag::Active) {
-      LOG(ERROR) << StringPrintf("%s: already deactivated", __func__);
-      if (targetLost)
+  NfcTag& natTag = NfcTag::getInstance();
+
+  // get input buffer and length from java call
+  ScopedByteArrayRO bytes(e, data);
+  uint8_t* buf = const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(
+      &bytes[0]));  // TODO: API bug; NFA_SendRawFrame should take const*!
+  size_t bufLen = bytes.size();
+
+  if (statusTargetLost) {
+    targetLost = e->GetIntArrayElements(statusTargetLost, 0);
+    if (targetLost) *targetLost = 0;  // success, tag is still present
+  }
+
+  sSwitchBackTimer.disarm();
+  ScopedLocalRef<jbyteArray> result(e, NULL);
+  do {
+    bool tagLost = false;
+    if (!transceiveFrame(buf, bufLen, &tagLost)) {
+      if (tagLost && targetLost)
         *targetLost = 1;  // causes NFC service to throw TagLostException
+      if (sTraceSentNs == 0)
+        traceFlags |= TransceiveTrace::kNotSent;
+      else if (sTraceCallbackNs == 0)
+        traceFlags |= TransceiveTrace::kTimeout;
+      else if (tagLost)
+        traceFlags |= TransceiveTrace::kTagLost;
       break;
     }
 
-    LOG(DEBUG) << StringPrintf("%s: response %zu bytes", __func__,
-                               sRxDataBuffer.size());
+    rxLen = sRxDataBuffer.size();
+    LOG(DEBUG) << StringPrintf("%s: response %zu bytes", __func__, rxLen);
 
     if ((natTag.getProtocol() == NFA_PROTOCOL_T2T) &&
         natTag.isT2tNackResponse(sRxDataBuffer.data(), sRxDataBuffer.size())) {
       isNack = true;
+      traceFlags |= TransceiveTrace::kNack;
     }
 
     if (sRxDataBuffer.size() > 0) {
@@ -1051,13 +1837,805 @@ static jbyteArray nativeNfcTag_doTransceive(JNIEnv* e, jobject o,
     }
   } while (0);
 
-  sWaitingForTransceive = false;
+  endTransceive();
   if (targetLost) e->ReleaseIntArrayElements(statusTargetLost, targetLost, 0);
 
+  traceTransceive(entryNs, bufLen, rxLen, traceFlags);
   LOG(DEBUG) << StringPrintf("%s: exit", __func__);
   return result.release();
 }
 
+/*******************************************************************************
+**
+** Function:        takeTransceiveAsync
+**
+** Description:     End the asynchronous transceive in flight, if any.  The
+**                  caller must hold sTransceiveEvent and then pass async to
+**                  finishTransceiveAsync() once it is released.
+**                  async: receives the request.
+**
+** Returns:         True if an asynchronous transceive was in flight.
+**
+*******************************************************************************/
+static bool takeTransceiveAsync(AsyncTransceive* async) {
+  if (sAsyncTransceiveId == 0) return false;
+  async->id = sAsyncTransceiveId;
+  async->tag = sAsyncTransceiveTag;
+  async->sentNs = sAsyncTransceiveSentNs;
+  async->techId = sAsyncTransceiveTechId;
+  memcpy(async->cmd, sAsyncTransceiveCmd, sizeof(async->cmd));
+  async->cmdLen = sAsyncTransceiveCmdLen;
+  sAsyncTransceiveId = 0;
+  sAsyncTransceiveTag = NULL;
+  sWaitingForTransceive = false;
+  sAsyncTransceiveTimer.disarm();
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        finishTransceiveAsync
+**
+** Description:     Hand the result of an asynchronous transceive to the
+**                  Java tag through onTransceiveComplete().  It runs on the
+**                  thread that delivers tag responses, so the Java tag posts
+**                  the application's callback elsewhere.
+**                  async: request; its global ref to the Java tag is
+**                  deleted here.
+**                  response: response of the tag; NULL if it failed.
+**                  status: 0 if ok, else the status code for the service.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void finishTransceiveAsync(const AsyncTransceive& async,
+                                  std::vector<uint8_t>* response, int status) {
+  LOG(DEBUG) << StringPrintf("%s: id=%u status=%d", __func__, async.id,
+                             status);
+  if (status == 0) gTagJustActivated = false;
+
+  struct nfc_jni_native_data* nat = getNative(NULL, NULL);
+  if (nat == NULL) return;
+  JNIEnv* e = NULL;
+  ScopedAttach attach(nat->vm, &e);
+  if (e == NULL) {
+    LOG(ERROR) << StringPrintf("%s: jni env is null", __func__);
+    return;
+  }
+  ScopedLocalRef<jbyteArray> result(e, NULL);
+  if ((status == 0) && response) {
+    result.reset(e->NewByteArray(response->size()));
+    if (result.get() != NULL) {
+      e->SetByteArrayRegion(result.get(), 0, response->size(),
+                            (const jbyte*)response->data());
+    } else {
+      LOG(ERROR) << StringPrintf("%s: Failed to allocate java byte array",
+                                 __func__);
+      status = 1;
+    }
+  }
+  e->CallVoidMethod(async.tag, sOnTransceiveComplete, (jint)async.id,
+                    result.get(), (jint)status);
+  if (e->ExceptionCheck()) {
+    LOG(ERROR) << StringPrintf("%s: fail notify", __func__);
+    e->ExceptionClear();
+  }
+  e->DeleteGlobalRef(async.tag);
+}
+
+/*******************************************************************************
+**
+** Function:        recordTransceiveAsync
+**
+** Description:     Feed an asynchronous transceive that got a response or
+**                  timed out to the adaptive transceive timeout and the
+**                  presence-check scheduler, like a blocking one.
+**                  async: request.
+**                  responded: false if it timed out.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void recordTransceiveAsync(const AsyncTransceive& async,
+                                  bool responded) {
+  uint64_t const endNs = nowNs();
+  NfcTag::getInstance().recordTransceive(
+      async.techId, async.cmd, async.cmdLen,
+      (uint32_t)((endNs - async.sentNs) / 1000), responded);
+  if (responded && sAdaptivePresenceCheck) {
+    AutoMutex lock(sPresenceScheduleMutex);
+    sPresenceScheduler.recordActivity(endNs);
+  }
+}
+
+/*******************************************************************************
+**
+** Function:        transceiveAsyncTimeout
+**
+** Description:     Fail the asynchronous transceive whose deadline passed.
+**                  Runs on the timer thread.
+**
+** Returns:         None
+**
+*******************************************************************************/
+static void transceiveAsyncTimeout(union sigval) {
+  AsyncTransceive async = {};
+  {
+    SyncEventGuard g(sTransceiveEvent);
+    // a late expiry must not end a newer request
+    if (nowNs() < sAsyncTransceiveDeadlineNs) return;
+    if (!takeTransceiveAsync(&async)) return;
+    sRxDataBuffer.clear();
+  }
+  LOG(ERROR) << StringPrintf("%s: id=%u", __func__, async.id);
+  recordTransceiveAsync(async, false);
+  finishTransceiveAsync(async, NULL, STATUS_CODE_TARGET_LOST);
+}
+
+/*******************************************************************************
+**
+** Function:        nativeNfcTag_doTransceiveAsync
+**
+** Description:     Send raw data to the tag without waiting for its
+**                  response.  The response, a timeout or the loss of the
+**                  tag is reported later by onTransceiveComplete().  One
+**                  transceive can be in flight at a time.
+**                  e: JVM environment.
+**                  o: Java object.
+**                  data: frame to send.
+**
+** Returns:         Request id passed to onTransceiveComplete(); 0 if the
+**                  frame was not sent.
+**
+*******************************************************************************/
+static jint nativeNfcTag_doTransceiveAsync(JNIEnv* e, jobject o,
+                                           jbyteArray data) {
+  if (sOnTransceiveComplete == NULL) return 0;
+  NfcTag& natTag = NfcTag::getInstance();
+  if (natTag.getActivationState() != NfcTag::Active) {
+    LOG(DEBUG) << StringPrintf("%s: tag not active", __func__);
+    return 0;
+  }
+  finishNdefPrefetch(false);
+  invalidateNdefCache();  // raw commands may write the message
+  sSwitchBackTimer.disarm();
+
+  ScopedByteArrayRO bytes(e, data);
+  uint8_t* buf = const_cast<uint8_t*>(
+      reinterpret_cast<const uint8_t*>(bytes.get()));
+  size_t bufLen = bytes.size();
+  int const timeout =
+      natTag.getTransceiveTimeout(sCurrentConnectedTargetType, buf, bufLen);
+
+  uint32_t id = 0;
+  {
+    SyncEventGuard g(sTransceiveEvent);
+    if (sWaitingForTransceive) {
+      LOG(ERROR) << StringPrintf("%s: transceive in flight", __func__);
+      return 0;
+    }
+    sTransceiveEvent.reset();
+    sTransceiveRfTimeout = false;
+    sRxDataStatus = NFA_STATUS_OK;
+    sRxDataBuffer.clear();
+    id = ++sLastAsyncTransceiveId;
+    if (id == 0) id = ++sLastAsyncTransceiveId;
+    sAsyncTransceiveId = id;
+    sAsyncTransceiveTag = e->NewGlobalRef(o);
+    sAsyncTransceiveSentNs = nowNs();
+    sAsyncTransceiveDeadlineNs =
+        sAsyncTransceiveSentNs + (uint64_t)timeout * 1000000;
+    sAsyncTransceiveTechId = sCurrentConnectedTargetType;
+    sAsyncTransceiveCmdLen = std::min(bufLen, sizeof(sAsyncTransceiveCmd));
+    if (sAsyncTransceiveCmdLen > 0)
+      memcpy(sAsyncTransceiveCmd, buf, sAsyncTransceiveCmdLen);
+    sWaitingForTransceive = true;
+
+    tNFA_STATUS status =
+        NFA_SendRawFrame(buf, bufLen, NFA_DM_DEFAULT_PRESENCE_CHECK_START_DELAY);
+    if (status != NFA_STATUS_OK) {
+      LOG(ERROR) << StringPrintf("%s: fail send; error=%d", __func__, status);
+      e->DeleteGlobalRef(sAsyncTransceiveTag);
+      sAsyncTransceiveTag = NULL;
+      sAsyncTransceiveId = 0;
+      sWaitingForTransceive = false;
+      return 0;
+    }
+    noteIsoDepActivation(buf, bufLen);
+    // an expiry for an earlier request is ignored; see transceiveAsyncTimeout
+    sAsyncTransceiveTimer.set(timeout, transceiveAsyncTimeout);
+  }
+  LOG(DEBUG) << StringPrintf("%s: id=%u timeout=%d", __func__, id, timeout);
+  return id;
+}
+
+/*******************************************************************************
+**
+** Function:        nativeNfcTag_doTransceiveChained
+**
+** Description:     Send an APDU to an ISO-DEP tag and collect its whole
+**                  response.  A command longer than the controller's limit
+**                  is sent as a command chain; a 61xx response is followed
+**                  by GET RESPONSE and a 6Cxx response repeats the command
+**                  with the right Le, all without returning to Java.
+**                  e: JVM environment.
+**                  o: Java object.
+**                  data: command APDU.
+**                  statusTargetLost: Whether tag responds or times out.
+**
+** Returns:         Response data of all parts followed by the final status
+**                  word; NULL if failed.
+**
+*******************************************************************************/
+static jbyteArray nativeNfcTag_doTransceiveChained(JNIEnv* e, jobject,
+                                                   jbyteArray data,
+                                                   jintArray statusTargetLost) {
+  LOG(DEBUG) << StringPrintf("%s: enter", __func__);
+  // same limit as nfcManager_getIsoDepMaxTransceiveLength()
+  size_t const maxLen = NfcConfig::getUnsigned(NAME_ISO_DEP_MAX_TRANSCEIVE, 261);
+
+  jint* targetLost = NULL;
+  if (statusTargetLost) {
+    targetLost = e->GetIntArrayElements(statusTargetLost, 0);
+    if (targetLost) *targetLost = 0;  // success, tag is still present
+  }
+
+  if (NfcTag::getInstance().getActivationState() != NfcTag::Active) {
+    LOG(DEBUG) << StringPrintf("%s: tag not active", __func__);
+    if (targetLost) {
+      *targetLost = 1;  // causes NFC service to throw TagLostException
+      e->ReleaseIntArrayElements(statusTargetLost, targetLost, 0);
+    }
+    return NULL;
+  }
+  if (sCurrentConnectedTargetProtocol != NFA_PROTOCOL_ISO_DEP) {
+    LOG(ERROR) << StringPrintf("%s: not ISO-DEP; protocol=%d", __func__,
+                               sCurrentConnectedTargetProtocol);
+    if (targetLost) e->ReleaseIntArrayElements(statusTargetLost, targetLost, 0);
+    return NULL;
+  }
+
+  ScopedByteArrayRO bytes(e, data);
+  // CLA INS P1 P2 at least; GET RESPONSE copies the CLA of the command
+  if (bytes.size() < 4) {
+    LOG(ERROR) << StringPrintf("%s: not an APDU; len=%zu", __func__,
+                               bytes.size());
+    if (targetLost) e->ReleaseIntArrayElements(statusTargetLost, targetLost, 0);
+    return NULL;
+  }
+  const uint8_t* apdu = reinterpret_cast<const uint8_t*>(bytes.get());
+  std::vector<ApduChain::Apdu> chain;
+  if (!ApduChain::splitCommand(apdu, bytes.size(), maxLen, &chain))
+    chain.emplace_back(apdu, apdu + bytes.size());
+
+  sSwitchBackTimer.disarm();
+  std::vector<uint8_t> response;
+  response.reserve(CHAINED_RESPONSE_RESERVE);
+  ApduChain::Apdu getResponse;
+  ApduChain::Apdu* command = &chain[0];
+  size_t link = 0;
+  bool ok = true;
+  for (int round = 1;; round++) {
+    bool tagLost = false;
+    if (!transceiveFrame(command->data(), command->size(), &tagLost)) {
+      if (tagLost && targetLost)
+        *targetLost = 1;  // causes NFC service to throw TagLostException
+      ok = false;
+      break;
+    }
+    size_t const rxLen = sRxDataBuffer.size();
+    uint8_t const sw1 = (rxLen >= 2) ? sRxDataBuffer[rxLen - 2] : 0;
+    uint8_t const sw2 = (rxLen >= 2) ? sRxDataBuffer[rxLen - 1] : 0;
+
+    if (link + 1 < chain.size()) {
+      // every link but the last must be accepted; else return the refusal
+      if ((rxLen == 2) && (sw1 == 0x90) && (sw2 == 0x00)) {
+        command = &chain[++link];
+        continue;
+      }
+    } else if (round < MAX_CHAINED_ROUNDS) {
+      if (sw1 == 0x61) {
+        response.insert(response.end(), sRxDataBuffer.begin(),
+                        sRxDataBuffer.end() - 2);
+        getResponse = ApduChain::getResponse(chain[0][0], sw2);
+        command = &getResponse;
+        continue;
+      }
+      if ((rxLen == 2) && (sw1 == 0x6C) && ApduChain::setLe(command, sw2))
+        continue;
+    }
+    response.insert(response.end(), sRxDataBuffer.begin(),
+                    sRxDataBuffer.end());
+    break;
+  }
+  sRxDataBuffer.clear();
+  endTransceive();
+
+  ScopedLocalRef<jbyteArray> result(e, NULL);
+  if (ok) {
+    result.reset(e->NewByteArray(response.size()));
+    if (result.get() != NULL) {
+      e->SetByteArrayRegion(result.get(), 0, response.size(),
+                            (const jbyte*)response.data());
+    } else
+      LOG(ERROR) << StringPrintf("%s: Failed to allocate java byte array",
+                                 __func__);
+  }
+  if (targetLost) e->ReleaseIntArrayElements(statusTargetLost, targetLost, 0);
+  LOG(DEBUG) << StringPrintf("%s: exit; response %zu bytes", __func__,
+                             response.size());
+  return result.release();
+}
+
+/*******************************************************************************
+**
+** Function:        deliverNdefChunk
+**
+** Description:     Hand a chunk of an NDEF message to a Java listener.
+**                  e: JVM environment.
+**                  listener: NativeNfcTag.NdefChunkListener.
+**                  onChunk: its onNdefChunk method.
+**                  data: chunk.
+**                  len: length of the chunk.
+**                  offset: position of the chunk in the message.
+**                  total: length of the message.
+**
+** Returns:         False if the listener stopped the read or threw.
+**
+*******************************************************************************/
+static bool deliverNdefChunk(JNIEnv* e, jobject listener, jmethodID onChunk,
+                             const uint8_t* data, size_t len, uint32_t offset,
+                             uint32_t total) {
+  ScopedLocalRef<jbyteArray> chunk(e, e->NewByteArray(len));
+  if (chunk.get() == NULL) {
+    LOG(ERROR) << StringPrintf("%s: Failed to allocate java byte array",
+                               __func__);
+    return false;
+  }
+  e->SetByteArrayRegion(chunk.get(), 0, len, (const jbyte*)data);
+  jboolean more = e->CallBooleanMethod(listener, onChunk, chunk.get(),
+                                       (jint)offset, (jint)total);
+  // a pending exception is thrown when the native method returns
+  return !e->ExceptionCheck() && more;
+}
+
+/*******************************************************************************
+**
+** Function:        streamT4tCommand
+**
+** Description:     Send a SELECT or READ BINARY command of a streamed type 4
+**                  tag read.
+**                  cmd: command APDU.
+**                  cmdLen: length of the command.
+**                  tagLost: set if the tag did not respond.
+**
+** Returns:         True if the tag answered 9000; the response is in
+**                  sRxDataBuffer.
+**
+*******************************************************************************/
+static bool streamT4tCommand(uint8_t* cmd, size_t cmdLen, bool* tagLost) {
+  // SELECT and READ BINARY leave the message as it is
+  if (!transceiveFrame(cmd, cmdLen, tagLost, false)) return false;
+  size_t const rxLen = sRxDataBuffer.size();
+  return (rxLen >= 2) && (sRxDataBuffer[rxLen - 2] == 0x90) &&
+         (sRxDataBuffer[rxLen - 1] == 0x00);
+}
+
+/*******************************************************************************
+**
+** Function:        streamT4tNdef
+**
+** Description:     Read the NDEF file of a type 4 tag with READ BINARY
+**                  commands and hand each chunkSize bytes to the listener
+**                  as soon as they arrive, so that only one chunk is held
+**                  natively.
+**                  e: JVM environment.
+**                  listener: NativeNfcTag.NdefChunkListener.
+**                  onChunk: its onNdefChunk method.
+**                  chunkSize: largest chunk.
+**                  ndefFile: receives the ID of the NDEF file once the CC
+**                  file is read; left 0000 before.
+**                  tagLost: set if the tag did not respond.
+**                  started: set once a chunk was handed over.
+**
+** Returns:         Length of the message; -1 if failed.
+**
+*******************************************************************************/
+static int streamT4tNdef(JNIEnv* e, jobject listener, jmethodID onChunk,
+                         size_t chunkSize, uint8_t ndefFile[2], bool* tagLost,
+                         bool* started) {
+  uint8_t selectApp[] = {T4T_SELECT_NDEF_APP};
+  uint8_t selectCc[] = {0x00, 0xA4, 0x00, 0x0C, 0x02, 0xE1, 0x03};
+  uint8_t readBinary[] = {0x00, 0xB0, 0x00, 0x00, 0x0F};
+
+  if (!streamT4tCommand(selectApp, sizeof(selectApp), tagLost) ||
+      !streamT4tCommand(selectCc, sizeof(selectCc), tagLost) ||
+      !streamT4tCommand(readBinary, sizeof(readBinary), tagLost) ||
+      (sRxDataBuffer.size() < 15 + 2))
+    return -1;
+
+  // CC: CCLEN(2) version(1) MLe(2) MLc(2) then the NDEF file control TLV,
+  // T=04 with a 2-byte NLEN or T=06 with a 4-byte ENLEN
+  const uint8_t* cc = sRxDataBuffer.data();
+  size_t const mle = (cc[3] << 8) | cc[4];
+  size_t const nlenSize = (cc[7] == 0x06) ? 4 : 2;
+  if (((cc[7] != 0x04) && (cc[7] != 0x06)) || (mle < 0x0F)) return -1;
+  ndefFile[0] = cc[9];
+  ndefFile[1] = cc[10];
+  uint8_t selectNdef[] = {0x00, 0xA4, 0x00, 0x0C, 0x02, cc[9], cc[10]};
+
+  readBinary[4] = nlenSize;
+  if (!streamT4tCommand(selectNdef, sizeof(selectNdef), tagLost) ||
+      !streamT4tCommand(readBinary, sizeof(readBinary), tagLost) ||
+      (sRxDataBuffer.size() < nlenSize + 2))
+    return -1;
+  uint32_t total = 0;
+  for (size_t i = 0; i < nlenSize; i++) total = (total << 8) | sRxDataBuffer[i];
+  // READ BINARY with a plain offset reaches 0x7FFF
+  if (total > 0x7FFF - nlenSize) return -1;
+
+  size_t const maxLe = std::min<size_t>(mle, 0xFF);
+  std::vector<uint8_t> chunk;
+  chunk.reserve(chunkSize);
+  uint32_t offset = 0;
+  while (offset < total) {
+    size_t const le =
+        std::min({maxLe, (size_t)(total - offset), chunkSize - chunk.size()});
+    uint32_t const fileOffset = nlenSize + offset;
+    readBinary[2] = (uint8_t)(fileOffset >> 8);
+    readBinary[3] = (uint8_t)fileOffset;
+    readBinary[4] = (uint8_t)le;
+    if (!streamT4tCommand(readBinary, sizeof(readBinary), tagLost)) return -1;
+    size_t const got = sRxDataBuffer.size() - 2;
+    if ((got == 0) || (got > le)) return -1;
+    chunk.insert(chunk.end(), sRxDataBuffer.begin(),
+                 sRxDataBuffer.begin() + got);
+    offset += got;
+    if ((chunk.size() == chunkSize) || (offset == total)) {
+      *started = true;
+      if (!deliverNdefChunk(e, listener, onChunk, chunk.data(), chunk.size(),
+                            offset - chunk.size(), total))
+        return -1;
+      chunk.clear();
+    }
+  }
+  return total;
+}
+
+/*******************************************************************************
+**
+** Function:        restoreT4tNdefFile
+**
+** Description:     Select the NDEF file again after a streamed read failed,
+**                  since the stack reads whichever file is selected.
+**                  ndefFile: ID of the NDEF file.
+**                  tagLost: set if the tag did not respond.
+**
+** Returns:         True if the NDEF file is selected.
+**
+*******************************************************************************/
+static bool restoreT4tNdefFile(const uint8_t ndefFile[2], bool* tagLost) {
+  uint8_t selectApp[] = {T4T_SELECT_NDEF_APP};
+  uint8_t selectNdef[] = {0x00, 0xA4, 0x00, 0x0C, 0x02, ndefFile[0],
+                          ndefFile[1]};
+  return streamT4tCommand(selectApp, sizeof(selectApp), tagLost) &&
+         streamT4tCommand(selectNdef, sizeof(selectNdef), tagLost);
+}
+
+/*******************************************************************************
+**
+** Function:        deliverNdefMessage
+**
+** Description:     Hand a whole NDEF message to a Java listener in chunks.
+**                  e: JVM environment.
+**                  listener: NativeNfcTag.NdefChunkListener.
+**                  onChunk: its onNdefChunk method.
+**                  data: message.
+**                  total: length of the message.
+**                  chunkSize: largest chunk.
+**
+** Returns:         False if the listener stopped the read or threw.
+**
+*******************************************************************************/
+static bool deliverNdefMessage(JNIEnv* e, jobject listener, jmethodID onChunk,
+                               const uint8_t* data, uint32_t total,
+                               size_t chunkSize) {
+  for (uint32_t offset = 0; offset < total; offset += chunkSize) {
+    size_t const len = std::min<size_t>(chunkSize, total - offset);
+    if (!deliverNdefChunk(e, listener, onChunk, data + offset, len, offset,
+                          total))
+      return false;
+  }
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        nativeNfcTag_doReadStreaming
+**
+** Description:     Read the NDEF message on the tag and hand it to a Java
+**                  listener in chunks.  A prefetched or cached message is
+**                  handed over as it is; a large message on a type 4 tag is
+**                  read and handed over part by part; otherwise the message
+**                  is read by doRead and then handed over in chunks.
+**                  e: JVM environment.
+**                  o: Java object.
+**                  listener: NativeNfcTag.NdefChunkListener.
+**                  chunkSize: largest chunk.
+**
+** Returns:         Length of the message; -1 if failed or stopped.
+**
+*******************************************************************************/
+static jint nativeNfcTag_doReadStreaming(JNIEnv* e, jobject o,
+                                         jobject listener, jint chunkSize) {
+  LOG(DEBUG) << StringPrintf("%s: enter; chunk=%d", __func__, chunkSize);
+  if (listener == NULL) return -1;
+  ScopedLocalRef<jclass> cls(e, e->GetObjectClass(listener));
+  jmethodID onChunk = e->GetMethodID(cls.get(), "onNdefChunk", "([BII)Z");
+  if (onChunk == NULL) return -1;
+  size_t const chunk = std::clamp<jint>(chunkSize, NDEF_STREAM_MIN_CHUNK,
+                                        NDEF_STREAM_MAX_CHUNK);
+
+  if (NfcTag::getInstance().getActivationState() != NfcTag::Active) {
+    LOG(DEBUG) << StringPrintf("%s: tag not active", __func__);
+    return -1;
+  }
+
+  bool const prefetched = hasNdefPrefetchMessage();
+  NdefCache::Key cacheKey;
+  std::vector<uint8_t> cached;
+  if (!prefetched && (sCheckNdefCurrentSize > 0) &&
+      getNdefCacheKey(&cacheKey) && sNdefCache.lookup(cacheKey, &cached)) {
+    LOG(DEBUG) << StringPrintf("%s: exit; cached %zu bytes", __func__,
+                               cached.size());
+    if (!deliverNdefMessage(e, listener, onChunk, cached.data(), cached.size(),
+                            chunk))
+      return -1;
+    return cached.size();
+  }
+
+  if ((sCurrentConnectedTargetProtocol == NFA_PROTOCOL_ISO_DEP) &&
+      (sCheckNdefCurrentSize > chunk) && !prefetched) {
+    bool tagLost = false;
+    bool started = false;
+    uint8_t ndefFile[2] = {0x00, 0x00};
+    sSwitchBackTimer.disarm();
+    int total = streamT4tNdef(e, listener, onChunk, chunk, ndefFile, &tagLost,
+                              &started);
+    bool const failed =
+        (total < 0) && !started && !tagLost && !e->ExceptionCheck();
+    // without the NDEF file selected again, doRead would read another file
+    bool const restored =
+        failed && ((ndefFile[0] != 0x00) || (ndefFile[1] != 0x00)) &&
+        restoreT4tNdefFile(ndefFile, &tagLost);
+    sRxDataBuffer.clear();
+    endTransceive();
+    if (!restored) {
+      LOG(DEBUG) << StringPrintf("%s: exit; streamed %d bytes", __func__,
+                                 total);
+      return total;
+    }
+    LOG(DEBUG) << StringPrintf("%s: read the message whole", __func__);
+  }
+
+  ScopedLocalRef<jbyteArray> message(e, nativeNfcTag_doRead(e, o));
+  if (message.get() == NULL) return -1;
+  ScopedByteArrayRO bytes(e, message.get());
+  uint32_t const total = bytes.size();
+  if (!deliverNdefMessage(e, listener, onChunk,
+                          reinterpret_cast<const uint8_t*>(bytes.get()),
+                          total, chunk))
+    return -1;
+  LOG(DEBUG) << StringPrintf("%s: exit; %u bytes", __func__, total);
+  return total;
+}
+
+/*******************************************************************************
+**
+** Function:        nativeNfcTag_doTransceiveDirect
+**
+** Description:     Send raw data to the tag and receive the tag's response
+**                  through caller-owned direct buffers, without allocating
+**                  Java arrays.
+**                  e: JVM environment.
+**                  o: Java object.
+**                  cmd: direct buffer holding the command.
+**                  cmdOffset: offset of the command in cmd.
+**                  cmdLen: length of the command.
+**                  rsp: direct buffer receiving the response.
+**                  rspOffset: offset in rsp at which to write.
+**                  rspMax: room for the response in rsp.
+**                  statusTargetLost: Whether tag responds or times out.
+**
+** Returns:         Length of the response; -1 if failed, the response is
+**                  empty or a NACK, or it does not fit in rspMax.
+**
+*******************************************************************************/
+static jint nativeNfcTag_doTransceiveDirect(JNIEnv* e, jobject o, jobject cmd,
+                                            jint cmdOffset, jint cmdLen,
+                                            jobject rsp, jint rspOffset,
+                                            jint rspMax,
+                                            jintArray statusTargetLost) {
+  NfcTag& natTag = NfcTag::getInstance();
+  LOG(DEBUG) << StringPrintf("%s: enter; len=%d", __func__, cmdLen);
+
+  uint8_t* cmdBuf = static_cast<uint8_t*>(e->GetDirectBufferAddress(cmd));
+  uint8_t* rspBuf = static_cast<uint8_t*>(e->GetDirectBufferAddress(rsp));
+  if ((cmdBuf == NULL) || (rspBuf == NULL) || (cmdOffset < 0) ||
+      (cmdLen < 0) || (rspOffset < 0) || (rspMax < 0) ||
+      ((jlong)cmdOffset + cmdLen > e->GetDirectBufferCapacity(cmd)) ||
+      ((jlong)rspOffset + rspMax > e->GetDirectBufferCapacity(rsp))) {
+    LOG(ERROR) << StringPrintf("%s: invalid buffer", __func__);
+    return -1;
+  }
+
+  jint* targetLost = NULL;
+  if (statusTargetLost) {
+    targetLost = e->GetIntArrayElements(statusTargetLost, 0);
+    if (targetLost) *targetLost = 0;  // success, tag is still present
+  }
+
+  jint rspLen = -1;
+  if (natTag.getActivationState() != NfcTag::Active) {
+    LOG(DEBUG) << StringPrintf("%s: tag not active", __func__);
+    if (targetLost)
+      *targetLost = 1;  // causes NFC service to throw TagLostException
+  } else {
+    sSwitchBackTimer.disarm();
+    uint8_t* const response = rspBuf + rspOffset;
+    bool tagLost = false;
+    bool const responded = transceiveFrame(cmdBuf + cmdOffset, cmdLen,
+                                           &tagLost, true, response, rspMax);
+    size_t const len = takeRxDirect();
+    if (!responded) {
+      if (tagLost && targetLost)
+        *targetLost = 1;  // causes NFC service to throw TagLostException
+    } else if (len > (size_t)rspMax) {
+      LOG(ERROR) << StringPrintf("%s: response %zu bytes exceeds %d",
+                                 __func__, len, rspMax);
+    } else if (len == 0) {
+      // an empty response is a transceive failure, as in doTransceive
+      LOG(ERROR) << StringPrintf("%s: empty response", __func__);
+    } else if ((natTag.getProtocol() == NFA_PROTOCOL_T2T) &&
+               natTag.isT2tNackResponse(response, len)) {
+      // a nack is treated as a transceive failure, as in doTransceive
+      LOG(DEBUG) << StringPrintf("%s: try reconnect", __func__);
+      nativeNfcTag_doReconnect(NULL, NULL);
+    } else if ((sCurrentConnectedTargetProtocol == NFC_PROTOCOL_MIFARE) &&
+               (len == 1) && (response[0] != 0x00)) {
+      nativeNfcTag_doReconnect(e, o);
+    } else {
+      rspLen = len;
+    }
+    endTransceive();
+  }
+
+  if (targetLost) e->ReleaseIntArrayElements(statusTargetLost, targetLost, 0);
+  LOG(DEBUG) << StringPrintf("%s: exit; response %d bytes", __func__, rspLen);
+  return rspLen;
+}
+
+/*******************************************************************************
+**
+** Function:        isBatchValid
+**
+** Description:     Check the APDUs of a batch before any is sent, so that an
+**                  empty frame never costs a round trip.
+**                  e: JVM environment.
+**                  cmds: APDUs of the batch.
+**                  count: number of APDUs.
+**
+** Returns:         False if an APDU is null or empty.
+**
+*******************************************************************************/
+static bool isBatchValid(JNIEnv* e, jobjectArray cmds, jsize count) {
+  for (jsize i = 0; i < count; i++) {
+    ScopedLocalRef<jbyteArray> data(
+        e, reinterpret_cast<jbyteArray>(e->GetObjectArrayElement(cmds, i)));
+    if ((data.get() == NULL) || (e->GetArrayLength(data.get()) == 0))
+      return false;
+  }
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        nativeNfcTag_doTransceiveBatch
+**
+** Description:     Send a sequence of APDUs to an ISO-DEP tag back to back
+**                  and collect the responses, crossing JNI only once.
+**                  e: JVM environment.
+**                  o: Java object.
+**                  cmds: APDUs to send in order.
+**                  stopOnSwMask: bits of the status word compared with 9000;
+**                  the batch stops after the first response that differs in
+**                  these bits.  0 runs every APDU.
+**                  statusTargetLost: Whether tag responds or times out.
+**
+** Returns:         Responses in the order of cmds; the entries of APDUs that
+**                  were not run or failed are null.  NULL if the tag is not
+**                  active or not ISO-DEP, or an APDU is null or empty.
+**
+*******************************************************************************/
+static jobjectArray nativeNfcTag_doTransceiveBatch(JNIEnv* e, jobject,
+                                                   jobjectArray cmds,
+                                                   jint stopOnSwMask,
+                                                   jintArray statusTargetLost) {
+  NfcTag& natTag = NfcTag::getInstance();
+  jsize const count = (cmds != NULL) ? e->GetArrayLength(cmds) : 0;
+  LOG(DEBUG) << StringPrintf("%s: enter; count=%d; stop mask=0x%04X",
+                             __func__, count, stopOnSwMask);
+
+  jint* targetLost = NULL;
+  if (statusTargetLost) {
+    targetLost = e->GetIntArrayElements(statusTargetLost, 0);
+    if (targetLost) *targetLost = 0;  // success, tag is still present
+  }
+
+  ScopedLocalRef<jobjectArray> results(e, NULL);
+  if (natTag.getActivationState() != NfcTag::Active) {
+    LOG(DEBUG) << StringPrintf("%s: tag not active", __func__);
+    if (targetLost)
+      *targetLost = 1;  // causes NFC service to throw TagLostException
+  } else if (sCurrentConnectedTargetProtocol != NFA_PROTOCOL_ISO_DEP) {
+    LOG(ERROR) << StringPrintf("%s: not ISO-DEP; protocol=%d", __func__,
+                               sCurrentConnectedTargetProtocol);
+  } else if (!isBatchValid(e, cmds, count)) {
+    LOG(ERROR) << StringPrintf("%s: null or empty APDU", __func__);
+  } else {
+    ScopedLocalRef<jclass> byteArrayClass(e, e->FindClass("[B"));
+    results.reset(e->NewObjectArray(count, byteArrayClass.get(), NULL));
+  }
+  if (results.get() == NULL) {
+    if (targetLost) e->ReleaseIntArrayElements(statusTargetLost, targetLost, 0);
+    return NULL;
+  }
+
+  sSwitchBackTimer.disarm();
+  std::vector<uint8_t> cmd;  // reused for every APDU
+  for (jsize i = 0; i < count; i++) {
+    ScopedLocalRef<jbyteArray> data(
+        e, reinterpret_cast<jbyteArray>(e->GetObjectArrayElement(cmds, i)));
+    cmd.resize(e->GetArrayLength(data.get()));
+    e->GetByteArrayRegion(data.get(), 0, cmd.size(),
+                          reinterpret_cast<jbyte*>(cmd.data()));
+
+    bool tagLost = false;
+    if (!transceiveFrame(cmd.data(), cmd.size(), &tagLost)) {
+      if (tagLost && targetLost)
+        *targetLost = 1;  // causes NFC service to throw TagLostException
+      break;
+    }
+
+    size_t const rspLen = sRxDataBuffer.size();
+    ScopedLocalRef<jbyteArray> rsp(e, e->NewByteArray(rspLen));
+    if (rsp.get() == NULL) {
+      LOG(ERROR) << StringPrintf("%s: Failed to allocate java byte array",
+                                 __func__);
+      break;
+    }
+    e->SetByteArrayRegion(rsp.get(), 0, rspLen,
+                          (const jbyte*)sRxDataBuffer.data());
+    e->SetObjectArrayElement(results.get(), i, rsp.get());
+
+    // a response too short to carry a status word never matches 9000
+    uint16_t const sw =
+        (rspLen >= 2) ? (uint16_t)((sRxDataBuffer[rspLen - 2] << 8) |
+                                   sRxDataBuffer[rspLen - 1])
+                      : 0;
+    sRxDataBuffer.clear();
+    if ((sw & stopOnSwMask) != (0x9000 & stopOnSwMask)) {
+      LOG(DEBUG) << StringPrintf("%s: stop at %d; sw=0x%04X", __func__, i, sw);
+      break;
+    }
+  }
+
+  endTransceive();
+  if (targetLost) e->ReleaseIntArrayElements(statusTargetLost, targetLost, 0);
+  LOG(DEBUG) << StringPrintf("%s: exit", __func__);
+  return results.release();
+}
+
 /*******************************************************************************
 **
 ** Function:        nativeNfcTag_doGetNdefType
@@ -1123,7 +2701,12 @@ void nativeNfcTag_doCheckNdefResult(tNFA_STATUS status, uint32_t maxSize,
   // capable/formatted/read only */ #define RW_NDEF_FL_FORMATABLE 0x10    /* Tag
   // supports format operation */
 
-  if (!sCheckNdefWaitingForComplete) {
+  bool prefetching = false;
+  {
+    SyncEventGuard g(sNdefPrefetchEvent);
+    prefetching = (sNdefPrefetchState == NDEF_PREFETCH_DETECTING);
+  }
+  if (!sCheckNdefWaitingForComplete && !prefetching) {
     LOG(ERROR) << StringPrintf("%s: not waiting", __func__);
     return;
   }
@@ -1167,6 +2750,10 @@ void nativeNfcTag_doCheckNdefResult(tNFA_STATUS status, uint32_t maxSize,
     sCheckNdefCurrentSize = 0;
     sCheckNdefCardReadOnly = false;
   }
+  if (prefetching) {
+    continueNdefPrefetch();
+    return;
+  }
   sem_post(&sCheckNdefSem);
 }
 
@@ -1211,23 +2798,27 @@ static jint nativeNfcTag_doCheckNdef(JNIEnv* e, jobject o, jintArray ndefInfo) {
     goto TheEnd;
   }
 
-  LOG(DEBUG) << StringPrintf("%s: try NFA_RwDetectNDef", __func__);
-  sCheckNdefWaitingForComplete = JNI_TRUE;
+  if (takeNdefPrefetchCheck()) {
+    LOG(DEBUG) << StringPrintf("%s: detected at activation", __func__);
+  } else {
+    LOG(DEBUG) << StringPrintf("%s: try NFA_RwDetectNDef", __func__);
+    sCheckNdefWaitingForComplete = JNI_TRUE;
 
-  status = NFA_RwDetectNDef();
+    status = NFA_RwDetectNDef();
 
-  if (status != NFA_STATUS_OK) {
-    LOG(ERROR) << StringPrintf("%s: NFA_RwDetectNDef failed, status = 0x%X",
-                               __func__, status);
-    goto TheEnd;
-  }
+    if (status != NFA_STATUS_OK) {
+      LOG(ERROR) << StringPrintf("%s: NFA_RwDetectNDef failed, status = 0x%X",
+                                 __func__, status);
+      goto TheEnd;
+    }
 
-  /* Wait for check NDEF completion status */
-  if (sem_wait(&sCheckNdefSem)) {
-    LOG(ERROR) << StringPrintf(
-        "%s: Failed to wait for check NDEF semaphore (errno=0x%08x)", __func__,
-        errno);
-    goto TheEnd;
+    /* Wait for check NDEF completion status */
+    if (sem_wait(&sCheckNdefSem)) {
+      LOG(ERROR) << StringPrintf(
+          "%s: Failed to wait for check NDEF semaphore (errno=0x%08x)",
+          __func__, errno);
+      goto TheEnd;
+    }
   }
 
   if (sCheckNdefStatus == NFA_STATUS_OK) {
@@ -1289,6 +2880,79 @@ void nativeNfcTag_resetPresenceCheck() {
   sPresCheckErrCnt = 0;
   sIsoDepPresCheckAlternate = false;
   sPresCheckStatus = 0;
+  sPresCheckMethodKnown = false;
+  AutoMutex lock(sPresenceScheduleMutex);
+  sPresenceScheduler.reset();
+}
+
+/*******************************************************************************
+**
+** Function:        nativeNfcTag_setAdaptivePresenceCheck
+**
+** Description:     Enable or disable adapting the presence-check interval,
+**                  skipping checks after recent traffic and reporting a
+**                  lost tag as soon as it is deactivated.
+**                  enabled: whether to adapt.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void nativeNfcTag_setAdaptivePresenceCheck(bool enabled) {
+  LOG(DEBUG) << StringPrintf("%s: enabled=%d", __func__, enabled);
+  sAdaptivePresenceCheck = enabled;
+}
+
+/*******************************************************************************
+**
+** Function:        nativeNfcTag_setFastReselect
+**
+** Description:     Enable or disable the fast reselect path: connecting
+**                  without reselection when the tag is usable as it is,
+**                  and ending the halt of a tag the way learned for it.
+**                  enabled: whether to take the fast path.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void nativeNfcTag_setFastReselect(bool enabled) {
+  LOG(DEBUG) << StringPrintf("%s: enabled=%d", __func__, enabled);
+  sFastReselect = enabled;
+}
+
+/*******************************************************************************
+**
+** Function:        nativeNfcTag_notifyTagLost
+**
+** Description:     Tell the Java tag that it was deactivated, so that its
+**                  presence-check watchdog ends without waiting for the
+**                  next check.  Called on the NFA callback thread by
+**                  NFA_DEACTIVATED_EVT.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void nativeNfcTag_notifyTagLost() {
+  if (!sAdaptivePresenceCheck) return;
+
+  struct nfc_jni_native_data* nat = getNative(NULL, NULL);
+  if ((nat == NULL) || (nat->tag == NULL)) return;
+  JNIEnv* e = NULL;
+  ScopedAttach attach(nat->vm, &e);
+  if (e == NULL) {
+    LOG(ERROR) << StringPrintf("%s: jni env is null", __func__);
+    return;
+  }
+  ScopedLocalRef<jclass> cls(e, e->GetObjectClass(nat->tag));
+  jmethodID onTagLost = e->GetMethodID(cls.get(), "onTagLost", "()V");
+  if (onTagLost == NULL) {
+    e->ExceptionClear();
+    return;
+  }
+  e->CallVoidMethod(nat->tag, onTagLost);
+  if (e->ExceptionCheck()) {
+    LOG(ERROR) << StringPrintf("%s: fail notify", __func__);
+    e->ExceptionClear();
+  }
 }
 
 /*******************************************************************************
@@ -1308,6 +2972,57 @@ void nativeNfcTag_doPresenceCheckResult(tNFA_STATUS status) {
   sPresenceCheckEvent.notifyOne();
 }
 
+/*******************************************************************************
+**
+** Function:        runPresenceCheck
+**
+** Description:     Check once whether the tag is in the RF field.  The
+**                  caller must have started sPresenceCheckEvent.
+**                  method: presence-check method.
+**
+** Returns:         True if the tag answered.
+**
+*******************************************************************************/
+static bool runPresenceCheck(tNFA_RW_PRES_CHK_OPTION method) {
+  sPresenceCheckEvent.reset();
+  if (NFA_RwPresenceCheck(method) != NFA_STATUS_OK) return false;
+  return sPresenceCheckEvent.wait(2000) && sIsTagPresent;
+}
+
+/*******************************************************************************
+**
+** Function:        probePresenceCheck
+**
+** Description:     Find the cheapest presence-check method the activated
+**                  ISO-DEP tag answers, and remember it for the tag.  The
+**                  caller must have started sPresenceCheckEvent.
+**
+** Returns:         True if the tag answered one of the methods.
+**
+*******************************************************************************/
+static bool probePresenceCheck() {
+  // cheapest first: an R(NAK), an empty I-block, then the stack's default
+  static const tNFA_RW_PRES_CHK_OPTION kMethods[] = {
+      NFA_RW_PRES_CHK_ISO_DEP_NAK, NFA_RW_PRES_CHK_I_BLOCK,
+      NFA_RW_PRES_CHK_DEFAULT};
+
+  for (tNFA_RW_PRES_CHK_OPTION method : kMethods) {
+    uint64_t const startNs = nowNs();
+    if (runPresenceCheck(method)) {
+      LOG(DEBUG) << StringPrintf("%s: method %u answered in %llu us",
+                                 __func__, method,
+                                 (unsigned long long)(nowNs() - startNs) / 1000);
+      sPresCheckMethod = method;
+      sPresCheckMethodKnown = true;
+      NfcTag::getInstance().setLearnedPresenceCheck(
+          sCurrentConnectedTargetProtocol, method);
+      return true;
+    }
+    if (!NfcTag::getInstance().isActivated()) break;
+  }
+  return false;
+}
+
 /*******************************************************************************
 **
 ** Function:        nativeNfcTag_doPresenceCheck
@@ -1324,6 +3039,8 @@ static jboolean nativeNfcTag_doPresenceCheck(JNIEnv*, jobject) {
   tNFA_STATUS status = NFA_STATUS_OK;
   bool isPresent = false;
 
+  finishNdefPrefetch(false);
+
   // Special case for Kovio.  The deactivation would have already occurred
   // but was ignored so that normal tag opertions could complete.  Now we
   // want to process as if the deactivate just happened.
@@ -1363,12 +3080,33 @@ static jboolean nativeNfcTag_doPresenceCheck(JNIEnv*, jobject) {
     LOG(DEBUG) << StringPrintf("%s: tag already deactivated", __func__);
     return JNI_FALSE;
   }
-  {
+  if (sAdaptivePresenceCheck) {
+    AutoMutex lock(sPresenceScheduleMutex);
+    if (sPresenceScheduler.shouldSkip(nowNs())) {
+      LOG(DEBUG) << StringPrintf("%s: tag answered recently", __func__);
+      return JNI_TRUE;
+    }
+  }
+  bool retried = false;
+  bool probe = false;
+  if (sAdaptivePresenceCheck && !sPresCheckMethodKnown &&
+      (sCurrentConnectedTargetProtocol == NFC_PROTOCOL_ISO_DEP)) {
+    // first check of this activation; probe unless the tag was seen before
+    sPresCheckMethodKnown = NfcTag::getInstance().getLearnedPresenceCheck(
+        sCurrentConnectedTargetProtocol, &sPresCheckMethod);
+    probe = !sPresCheckMethodKnown;
+  }
+  if (probe) {
+    SyncEventGuard guard(sPresenceCheckEvent);
+    isPresent = probePresenceCheck();
+  } else {
     SyncEventGuard guard(sPresenceCheckEvent);
+    sPresenceCheckEvent.reset();
     tNFA_RW_PRES_CHK_OPTION method =
         NfcTag::getInstance().getPresenceCheckAlgorithm();
 
     if (sCurrentConnectedTargetProtocol == NFC_PROTOCOL_ISO_DEP) {
+      if (sPresCheckMethodKnown) method = sPresCheckMethod;
       if (method == NFA_RW_PRES_CHK_ISO_DEP_NAK) {
         sIsoDepPresCheckCnt++;
       }
@@ -1382,8 +3120,9 @@ static jboolean nativeNfcTag_doPresenceCheck(JNIEnv*, jobject) {
       /* Only applicable for Type2 tag which has SAK value other than 0
        (as defined in NFC Digital Protocol, section 4.8.2(SEL_RES)) */
       uint8_t RW_TAG_SLP_REQ[] = {0x50, 0x00};
-      status = NFA_SendRawFrame(RW_TAG_SLP_REQ, sizeof(RW_TAG_SLP_REQ), 0);
-      usleep(4 * 1000);
+      PhaseStats::Scope phase(sPresenceSleepPhase);
+      status =
+          sendFrameAndWait(RW_TAG_SLP_REQ, sizeof(RW_TAG_SLP_REQ), 4, NULL);
       if (status != NFA_STATUS_OK) {
         LOG(ERROR) << StringPrintf(
             "%s: failed to send RW_TAG_SLP_REQ, status=%d", __func__, status);
@@ -1407,6 +3146,7 @@ static jboolean nativeNfcTag_doPresenceCheck(JNIEnv*, jobject) {
              (sCurrentConnectedTargetProtocol == NFC_PROTOCOL_CI))) ||
            (sCurrentConnectedTargetProtocol == NFC_PROTOCOL_T3T))) {
         sPresCheckErrCnt++;
+        retried = true;
 
         int retryCount =
             NfcConfig::getUnsigned(NAME_PRESENCE_CHECK_RETRY_COUNT,
@@ -1416,6 +3156,7 @@ static jboolean nativeNfcTag_doPresenceCheck(JNIEnv*, jobject) {
               "%s(%d): pres check failed, try again (attempt #%d/%d)",
               __FUNCTION__, __LINE__, sPresCheckErrCnt, retryCount);
 
+          sPresenceCheckEvent.reset();
           status = NFA_RwPresenceCheck(method);
 
           if (status == NFA_STATUS_OK) {
@@ -1442,12 +3183,17 @@ static jboolean nativeNfcTag_doPresenceCheck(JNIEnv*, jobject) {
 
         method = NFA_RW_PRES_CHK_I_BLOCK;
         sIsoDepPresCheckAlternate = true;
+        retried = true;
+        sPresenceCheckEvent.reset();
         status = NFA_RwPresenceCheck(method);
 
         if (status == NFA_STATUS_OK) {
           isPresent = sPresenceCheckEvent.wait(2000);
           LOG(DEBUG) << StringPrintf("%s(%d): isPresent = %d", __FUNCTION__,
                                      __LINE__, isPresent);
+          if (isPresent && sIsTagPresent && sAdaptivePresenceCheck)
+            NfcTag::getInstance().setLearnedPresenceCheck(
+                sCurrentConnectedTargetProtocol, method);
         }
       }
 
@@ -1455,6 +3201,10 @@ static jboolean nativeNfcTag_doPresenceCheck(JNIEnv*, jobject) {
     }
   }
 
+  if (sAdaptivePresenceCheck) {
+    AutoMutex lock(sPresenceScheduleMutex);
+    sPresenceScheduler.recordCheck(isPresent, retried);
+  }
   if (!isPresent) {
     LOG(DEBUG) << StringPrintf("%s: tag absent", __func__);
 
@@ -1464,6 +3214,26 @@ static jboolean nativeNfcTag_doPresenceCheck(JNIEnv*, jobject) {
   return isPresent ? JNI_TRUE : JNI_FALSE;
 }
 
+/*******************************************************************************
+**
+** Function:        nativeNfcTag_doGetPresenceCheckDelay
+**
+** Description:     Get the wait before the next presence check.
+**                  e: JVM environment.
+**                  o: Java object.
+**                  baseDelay: interval configured by the NFC service.
+**
+** Returns:         Wait in milliseconds; baseDelay unless the interval is
+**                  adapted.
+**
+*******************************************************************************/
+static jint nativeNfcTag_doGetPresenceCheckDelay(JNIEnv*, jobject,
+                                                 jint baseDelay) {
+  if (!sAdaptivePresenceCheck) return baseDelay;
+  AutoMutex lock(sPresenceScheduleMutex);
+  return sPresenceScheduler.nextIntervalMs(baseDelay);
+}
+
 /*******************************************************************************
 **
 ** Function:        nativeNfcTag_doIsNdefFormatable
@@ -1573,6 +3343,9 @@ static jboolean nativeNfcTag_doNdefFormat(JNIEnv* e, jobject o, jbyteArray) {
   LOG(DEBUG) << StringPrintf("%s: enter", __func__);
   tNFA_STATUS status = NFA_STATUS_OK;
 
+  finishNdefPrefetch(true);  // the message is about to change
+  invalidateNdefCache();
+
   // Do not try to format if tag is already deactivated.
   if (NfcTag::getInstance().isActivated() == false) {
     LOG(DEBUG) << StringPrintf("%s: tag already deactivated(no need to format)",
@@ -1641,6 +3414,8 @@ static jboolean nativeNfcTag_doMakeReadonly(JNIEnv* e, jobject o, jbyteArray) {
   tNFA_STATUS status;
 
   LOG(DEBUG) << StringPrintf("%s", __func__);
+  finishNdefPrefetch(true);
+  invalidateNdefCache();
 
   /* Create the make_readonly semaphore */
   if (sem_init(&sMakeReadonlySem, 0, 0) == -1) {
@@ -1763,11 +3538,24 @@ static JNINativeMethod gMethods[] = {
     {"doDisconnect", "()Z", (void*)nativeNfcTag_doDisconnect},
     {"doReconnect", "()I", (void*)nativeNfcTag_doReconnect},
     {"doTransceive", "([BZ[I)[B", (void*)nativeNfcTag_doTransceive},
+    {"doTransceiveChained", "([B[I)[B",
+     (void*)nativeNfcTag_doTransceiveChained},
+    {"doTransceiveAsync", "([B)I", (void*)nativeNfcTag_doTransceiveAsync},
+    {"doTransceiveBatch", "([[BI[I)[[B",
+     (void*)nativeNfcTag_doTransceiveBatch},
+    {"doTransceiveDirect",
+     "(Ljava/nio/ByteBuffer;IILjava/nio/ByteBuffer;II[I)I",
+     (void*)nativeNfcTag_doTransceiveDirect},
     {"doGetNdefType", "(II)I", (void*)nativeNfcTag_doGetNdefType},
     {"doCheckNdef", "([I)I", (void*)nativeNfcTag_doCheckNdef},
     {"doRead", "()[B", (void*)nativeNfcTag_doRead},
+    {"doReadStreaming",
+     "(Lcom/android/nfc/dhimpl/NativeNfcTag$NdefChunkListener;I)I",
+     (void*)nativeNfcTag_doReadStreaming},
     {"doWrite", "([B)Z", (void*)nativeNfcTag_doWrite},
     {"doPresenceCheck", "()Z", (void*)nativeNfcTag_doPresenceCheck},
+    {"doGetPresenceCheckDelay", "(I)I",
+     (void*)nativeNfcTag_doGetPresenceCheckDelay},
     {"doIsIsoDepNdefFormatable", "([B[B)Z",
      (void*)nativeNfcTag_doIsIsoDepNdefFormatable},
     {"doNdefFormat", "([B)Z", (void*)nativeNfcTag_doNdefFormat},
@@ -1786,6 +3574,18 @@ static JNINativeMethod gMethods[] = {
 *******************************************************************************/
 int register_com_android_nfc_NativeNfcTag(JNIEnv* e) {
   LOG(DEBUG) << StringPrintf("%s", __func__);
+  ScopedLocalRef<jclass> cls(e, e->FindClass(gNativeNfcTagClassName));
+  if (cls.get() != NULL) {
+    sOnTransceiveComplete =
+        e->GetMethodID(cls.get(), "onTransceiveComplete", "(I[BI)V");
+  }
+  if (sOnTransceiveComplete == NULL) {
+    LOG(ERROR) << StringPrintf("%s: no onTransceiveComplete", __func__);
+    e->ExceptionClear();
+  }
+  if (!NfcTag::cacheJavaIds(e)) {
+    LOG(ERROR) << StringPrintf("%s: fail cache tag ids", __func__);
+  }
   return jniRegisterNativeMethods(e, gNativeNfcTagClassName, gMethods,
                                   NELEM(gMethods));
 }
@@ -1795,44 +3595,44 @@ int register_com_android_nfc_NativeNfcTag(JNIEnv* e) {
 ** Function:        performHaltPICC()
 **
 ** Description:     Issue HALT as per the current activated protocol & mode
+**                  hltaWaitMs: longest wait for the end of HLTA to be
+**                  reported; 0 to not wait.
+**                  acknowledged: set to whether the end of the halt was
+**                  reported.
 **
 ** Returns:         tNFA_STATUS.
 **
 *******************************************************************************/
-static tNFA_STATUS performHaltPICC() {
+static tNFA_STATUS performHaltPICC(int hltaWaitMs, bool* acknowledged) {
   tNFA_STATUS status = NFA_STATUS_OK;
+  *acknowledged = false;
   if ((sCurrentActivatedProtocl == NFA_PROTOCOL_T2T) ||
       (sCurrentActivatedProtocl == NFC_PROTOCOL_MIFARE)) {
-    status = NFA_SendRawFrame(RW_TAG_SLP_REQ, sizeof(RW_TAG_SLP_REQ), 0);
-    usleep(10 * 1000);
+    status = sendFrameAndWait(RW_TAG_SLP_REQ, sizeof(RW_TAG_SLP_REQ),
+                              hltaWaitMs, acknowledged);
   } else if (sCurrentActivatedProtocl == NFA_PROTOCOL_ISO_DEP) {
     if (sIsISODepActivatedByApp) {
-      status = NFA_SendRawFrame(RW_DESELECT_REQ, sizeof(RW_DESELECT_REQ), 0);
-      usleep(10 * 1000);
+      // the tag answers S(DESELECT), so always wait for it
+      status = sendFrameAndWait(RW_DESELECT_REQ, sizeof(RW_DESELECT_REQ), 10,
+                                acknowledged);
       sIsISODepActivatedByApp = false;
     } else {
       if (sCurrentActivatedMode == TARGET_TYPE_ISO14443_3A) {
-        status = NFA_SendRawFrame(RW_TAG_SLP_REQ, sizeof(RW_TAG_SLP_REQ), 0);
-        usleep(10 * 1000);
+        status = sendFrameAndWait(RW_TAG_SLP_REQ, sizeof(RW_TAG_SLP_REQ),
+                                  hltaWaitMs, acknowledged);
       } else if (sCurrentActivatedMode == TARGET_TYPE_ISO14443_3B) {
         uint8_t halt_b[5] = {0x50, 0, 0, 0, 0};
         memcpy(&halt_b[1], mNfcID0, 4);
-        android::nativeNfcTag_setTransceiveFlag(true);
-        SyncEventGuard g(android::sTransceiveEvent);
-        status = NFA_SendRawFrame(halt_b, sizeof(halt_b), 0);
+        status = sendFrameAndWait(halt_b, sizeof(halt_b), 100, acknowledged);
         if (status != NFA_STATUS_OK) {
           LOG(DEBUG) << StringPrintf("%s: fail send; error=%d", __func__,
                                      status);
-        } else {
-          if (android::sTransceiveEvent.wait(100) == false) {
-            status = NCI_STATUS_FAILED;
-            LOG(DEBUG) << StringPrintf("%s: timeout on HALTB", __func__);
-          }
+        } else if (!*acknowledged) {
+          status = NCI_STATUS_FAILED;
+          LOG(DEBUG) << StringPrintf("%s: timeout on HALTB", __func__);
         }
-        android::nativeNfcTag_setTransceiveFlag(false);
       }
     }
-    android::nativeNfcTag_setTransceiveFlag(false);
   }
   return status;
 }
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Bounded LRU cache of NDEF messages read from tags, for repeat taps.
+ */
+
+#include "NdefCache.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*******************************************************************************
+**
+** Function:        NdefCache
+**
+** Description:     Initialize member variables.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+NdefCache::NdefCache(size_t maxEntries, uint32_t maxMessageSize)
+    : mMaxEntries(maxEntries),
+      mMaxMessageSize(maxMessageSize),
+      mHits(0),
+      mMisses(0),
+      mInvalidations(0) {}
+
+/*******************************************************************************
+**
+** Function:        sameTag
+**
+** Description:     Whether a key belongs to the tag with the given ID.
+**
+** Returns:         True if the IDs match.
+**
+*******************************************************************************/
+bool NdefCache::sameTag(const Key& key, const uint8_t* uid, size_t uidLen) {
+  return (key.uidLen == uidLen) && (memcmp(key.uid, uid, uidLen) == 0);
+}
+
+/*******************************************************************************
+**
+** Function:        lookup
+**
+** Description:     Find the message stored for a key and mark it as the
+**                  most recently used.
+**
+** Returns:         True if the message was found.
+**
+*******************************************************************************/
+bool NdefCache::lookup(const Key& key, std::vector<uint8_t>* message) {
+  AutoMutex lock(mMutex);
+  for (auto it = mEntries.begin(); it != mEntries.end(); ++it) {
+    if (!sameTag(it->key, key.uid, key.uidLen)) continue;
+    // a tag rewritten elsewhere usually reports another size
+    if ((it->key.protocol != key.protocol) ||
+        (it->key.maxSize != key.maxSize) ||
+        (it->key.currentSize != key.currentSize) ||
+        (it->key.readOnly != key.readOnly)) {
+      mEntries.erase(it);
+      break;
+    }
+    mEntries.splice(mEntries.begin(), mEntries, it);
+    *message = mEntries.front().message;
+    mHits++;
+    return true;
+  }
+  mMisses++;
+  return false;
+}
+
+/*******************************************************************************
+**
+** Function:        store
+**
+** Description:     Keep the message read for a key, replacing any message
+**                  stored for the same tag.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void NdefCache::store(const Key& key, const uint8_t* message, uint32_t len) {
+  if ((key.uidLen == 0) || (key.uidLen > kMaxUidLen)) return;
+
+  AutoMutex lock(mMutex);
+  for (auto it = mEntries.begin(); it != mEntries.end(); ++it) {
+    if (sameTag(it->key, key.uid, key.uidLen)) {
+      mEntries.erase(it);
+      break;
+    }
+  }
+  if ((len > mMaxMessageSize) || (mMaxEntries == 0)) return;
+  if (mEntries.size() >= mMaxEntries) mEntries.pop_back();
+  mEntries.push_front(Entry{key, std::vector<uint8_t>(message, message + len)});
+}
+
+/*******************************************************************************
+**
+** Function:        invalidate
+**
+** Description:     Forget the message of a tag.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void NdefCache::invalidate(const uint8_t* uid, size_t uidLen) {
+  AutoMutex lock(mMutex);
+  for (auto it = mEntries.begin(); it != mEntries.end(); ++it) {
+    if (sameTag(it->key, uid, uidLen)) {
+      mEntries.erase(it);
+      mInvalidations++;
+      return;
+    }
+  }
+}
+
+/*******************************************************************************
+**
+** Function:        clear
+**
+** Description:     Forget all messages.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void NdefCache::clear() {
+  AutoMutex lock(mMutex);
+  mEntries.clear();
+}
+
+/*******************************************************************************
+**
+** Function:        getStats
+**
+** Description:     Get a snapshot of the counters.
+**
+** Returns:         Counters.
+**
+*******************************************************************************/
+NdefCache::Stats NdefCache::getStats() {
+  AutoMutex lock(mMutex);
+  Stats stats;
+  stats.hits = mHits;
+  stats.misses = mMisses;
+  stats.invalidations = mInvalidations;
+  stats.entries = mEntries.size();
+  return stats;
+}
+
+/*******************************************************************************
+**
+** Function:        dump
+**
+** Description:     Write the counters to a file descriptor.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void NdefCache::dump(int fd) {
+  Stats stats = getStats();
+  dprintf(fd, "NdefCache: entries=%zu hits=%llu misses=%llu "
+              "invalidations=%llu\n",
+          stats.entries, (unsigned long long)stats.hits,
+          (unsigned long long)stats.misses,
+          (unsigned long long)stats.invalidations);
+}
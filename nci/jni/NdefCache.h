@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Bounded LRU cache of NDEF messages read from tags, for repeat taps.
+ */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <vector>
+
+#include "Mutex.h"
+
+class NdefCache {
+ public:
+  static constexpr size_t kMaxUidLen = 10;
+
+  // identifies a message: the tag and the NDEF capability it reported
+  struct Key {
+    uint8_t uid[kMaxUidLen];
+    size_t uidLen;
+    uint8_t protocol;
+    uint32_t maxSize;      // NDEF capacity from the capability container
+    uint32_t currentSize;  // length of the stored message
+    bool readOnly;
+  };
+
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t invalidations;
+    size_t entries;
+  };
+
+  /*******************************************************************************
+  **
+  ** Function:        NdefCache
+  **
+  ** Description:     Initialize member variables.
+  **                  maxEntries: number of messages kept; the least recently
+  **                  used one is evicted first.
+  **                  maxMessageSize: larger messages are not kept.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  NdefCache(size_t maxEntries, uint32_t maxMessageSize);
+
+  /*******************************************************************************
+  **
+  ** Function:        lookup
+  **
+  ** Description:     Find the message stored for a key and mark it as the
+  **                  most recently used.
+  **                  key: tag and NDEF capability.
+  **                  message: receives a copy of the message.
+  **
+  ** Returns:         True if the message was found.
+  **
+  *******************************************************************************/
+  bool lookup(const Key& key, std::vector<uint8_t>* message);
+
+  /*******************************************************************************
+  **
+  ** Function:        store
+  **
+  ** Description:     Keep the message read for a key, replacing any message
+  **                  stored for the same tag.
+  **                  key: tag and NDEF capability.
+  **                  message: NDEF message.
+  **                  len: length of the message.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void store(const Key& key, const uint8_t* message, uint32_t len);
+
+  /*******************************************************************************
+  **
+  ** Function:        invalidate
+  **
+  ** Description:     Forget the message of a tag, e.g. because it is being
+  **                  written.
+  **                  uid: ID of the tag.
+  **                  uidLen: length of the ID.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void invalidate(const uint8_t* uid, size_t uidLen);
+
+  /*******************************************************************************
+  **
+  ** Function:        clear
+  **
+  ** Description:     Forget all messages.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void clear();
+
+  /*******************************************************************************
+  **
+  ** Function:        getStats
+  **
+  ** Description:     Get a snapshot of the counters.
+  **
+  ** Returns:         Counters.
+  **
+  *******************************************************************************/
+  Stats getStats();
+
+  /*******************************************************************************
+  **
+  ** Function:        dump
+  **
+  ** Description:     Write the counters to a file descriptor.
+  **                  fd: file descriptor.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void dump(int fd);
+
+ private:
+  struct Entry {
+    Key key;
+    std::vector<uint8_t> message;
+  };
+
+  static bool sameTag(const Key& key, const uint8_t* uid, size_t uidLen);
+
+  const size_t mMaxEntries;
+  const uint32_t mMaxMessageSize;
+  Mutex mMutex{"NdefCache::mMutex"};
+  std::list<Entry> mEntries;  // most recently used first
+  uint64_t mHits;
+  uint64_t mMisses;
+  uint64_t mInvalidations;
+};
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "NdefCache.h"
+
+class NdefCacheTest : public ::testing::Test {
+ protected:
+  NdefCacheTest() : cache(2, 16) {}
+
+  static NdefCache::Key makeKey(uint8_t id, uint32_t currentSize) {
+    NdefCache::Key key = {};
+    key.uid[0] = 0x04;
+    key.uid[1] = id;
+    key.uidLen = 7;
+    key.protocol = 2;
+    key.maxSize = 46;
+    key.currentSize = currentSize;
+    return key;
+  }
+
+  NdefCache cache;
+  const uint8_t message[4] = {0xD1, 0x01, 0x00, 0x54};
+};
+
+// Test a stored message is served for the same tag and capability
+TEST_F(NdefCacheTest, Hit) {
+  cache.store(makeKey(1, 4), message, sizeof(message));
+  std::vector<uint8_t> found;
+  ASSERT_TRUE(cache.lookup(makeKey(1, 4), &found));
+  ASSERT_EQ(found, std::vector<uint8_t>(message, message + 4));
+  ASSERT_EQ(cache.getStats().hits, 1u);
+}
+
+// Test a tag that reports another NDEF size is not served
+TEST_F(NdefCacheTest, CapabilityMismatch) {
+  cache.store(makeKey(1, 4), message, sizeof(message));
+  std::vector<uint8_t> found;
+  ASSERT_FALSE(cache.lookup(makeKey(1, 8), &found));
+  // the stale message is gone
+  ASSERT_FALSE(cache.lookup(makeKey(1, 4), &found));
+  ASSERT_EQ(cache.getStats().entries, 0u);
+}
+
+// Test the least recently used message is evicted first
+TEST_F(NdefCacheTest, EvictsLeastRecentlyUsed) {
+  std::vector<uint8_t> found;
+  cache.store(makeKey(1, 4), message, sizeof(message));
+  cache.store(makeKey(2, 4), message, sizeof(message));
+  ASSERT_TRUE(cache.lookup(makeKey(1, 4), &found));
+  cache.store(makeKey(3, 4), message, sizeof(message));
+  ASSERT_TRUE(cache.lookup(makeKey(1, 4), &found));
+  ASSERT_FALSE(cache.lookup(makeKey(2, 4), &found));
+  ASSERT_TRUE(cache.lookup(makeKey(3, 4), &found));
+}
+
+// Test invalidate() and oversized messages
+TEST_F(NdefCacheTest, InvalidateAndOversized) {
+  std::vector<uint8_t> found;
+  NdefCache::Key key = makeKey(1, 4);
+  cache.store(key, message, sizeof(message));
+  cache.invalidate(key.uid, key.uidLen);
+  ASSERT_FALSE(cache.lookup(key, &found));
+  ASSERT_EQ(cache.getStats().invalidations, 1u);
+
+  uint8_t large[17] = {};
+  cache.store(makeKey(2, 17), large, sizeof(large));
+  ASSERT_EQ(cache.getStats().entries, 0u);
+}
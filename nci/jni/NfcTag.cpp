@@ -33,10 +33,30 @@
 
 using android::base::StringPrintf;
 
-static void deleteglobaldata(JNIEnv* e);
-static jobjectArray sTechPollBytes;
-static jobjectArray gtechActBytes;
+// looked up once by NfcTag::cacheJavaIds()
+static jclass sNativeNfcTagClass = NULL;
+static jclass sByteArrayClass = NULL;
+static jmethodID sNativeNfcTagCtor = NULL;
 static int sLastSelectedTagId = 0;
+// Short fixed-format poll and activation bytes (ATQA, SAK, empty arrays)
+// repeat from one activation to the next, so one array per value is kept and
+// shared.  Longer ones, such as historical bytes or PMm and system code, are
+// often unique to a card and are not kept.  The shared arrays end up in Tag
+// extras (NfcA.EXTRA_ATQA, IsoDep.EXTRA_HIST_BYTES, ...) and must never be
+// modified in-process.  When the table is full the oldest entry is replaced.
+// Only used on the stack's callback thread.
+static const size_t kMaxInternedLen = 2;
+static const size_t kMaxInterned = 32;
+struct InternedBytes {
+  size_t len;
+  uint8_t data[kMaxInternedLen];
+  jbyteArray array;  // global reference
+};
+static InternedBytes sInterned[kMaxInterned];
+static size_t sNumInterned = 0;
+static size_t sNextInterned = 0;  // slot to replace once the table is full
+static_assert(NfcTag::MAX_NUM_TECHNOLOGY <= TechBytesArena::kMaxEntries,
+              "arena too small for all technologies");
 
 /*******************************************************************************
 **
@@ -66,7 +86,11 @@ NfcTag::NfcTag()
       mNumDiscNtf(0),
       mNumDiscTechList(0),
       mTechListTail(0),
-      mIsMultiProtocolTag(false) {
+      mIsMultiProtocolTag(false),
+      mAdaptiveTimeout(false),
+      mAppTimeouts(MAX_NUM_TECHNOLOGY, false),
+      mLatencyMutex("NfcTag::mLatencyMutex"),
+      mLearnedMutex("NfcTag::mLearnedMutex") {
   memset(mTechList, 0, sizeof(mTechList));
   memset(mTechHandles, 0, sizeof(mTechHandles));
   memset(mTechLibNfcTypes, 0, sizeof(mTechLibNfcTypes));
@@ -479,6 +503,41 @@ TheEnd:
   LOG(DEBUG) << StringPrintf("%s: exit", fn);
 }
 
+/*******************************************************************************
+**
+** Function:        cacheJavaIds
+**
+** Description:     Look up the Java NativeNfcTag class and its constructor
+**                  once, when the natives are registered.
+**                  e: JVM environment.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool NfcTag::cacheJavaIds(JNIEnv* e) {
+  static const char fn[] = "NfcTag::cacheJavaIds";
+  ScopedLocalRef<jclass> tagClass(e,
+                                  e->FindClass(android::gNativeNfcTagClassName));
+  ScopedLocalRef<jclass> byteArrayClass(e, e->FindClass("[B"));
+  if ((tagClass.get() == NULL) || (byteArrayClass.get() == NULL)) {
+    e->ExceptionClear();
+    LOG(ERROR) << StringPrintf("%s: fail find class", fn);
+    return false;
+  }
+  // all members of a new tag are passed in one call
+  jmethodID ctor = e->GetMethodID(tagClass.get(), "<init>",
+                                  "([I[I[I[[B[[B[B)V");
+  if (ctor == NULL) {
+    e->ExceptionClear();
+    LOG(ERROR) << StringPrintf("%s: fail find constructor", fn);
+    return false;
+  }
+  sNativeNfcTagClass = (jclass)e->NewGlobalRef(tagClass.get());
+  sByteArrayClass = (jclass)e->NewGlobalRef(byteArrayClass.get());
+  sNativeNfcTagCtor = ctor;
+  return true;
+}
+
 /*******************************************************************************
 **
 ** Function:        createNativeNfcTag
@@ -507,32 +566,44 @@ void NfcTag::createNativeNfcTag(tNFA_ACTIVATED& activationData) {
     return;
   }
 
-  ScopedLocalRef<jclass> tag_cls(e,
-                                 e->GetObjectClass(mNativeData->cached_NfcTag));
-  if (e->ExceptionCheck()) {
-    e->ExceptionClear();
-    LOG(ERROR) << StringPrintf("%s: failed to get class", fn);
+  if (sNativeNfcTagCtor == NULL) {
+    LOG(ERROR) << StringPrintf("%s: Java ids not cached", fn);
     return;
   }
 
-  // create a new Java NativeNfcTag object
-  jmethodID ctor = e->GetMethodID(tag_cls.get(), "<init>", "()V");
-  ScopedLocalRef<jobject> tag(e, e->NewObject(tag_cls.get(), ctor));
+  // make NativeNfcTag's mProtocols, mTechList, mTechHandles, mTechLibNfcTypes
+  ScopedLocalRef<jintArray> techList(e, NULL);
+  ScopedLocalRef<jintArray> handleList(e, NULL);
+  ScopedLocalRef<jintArray> typeList(e, NULL);
+  fillNativeNfcTagMembers1(e, &techList, &handleList, &typeList);
 
-  // fill NativeNfcTag's mProtocols, mTechList, mTechHandles, mTechLibNfcTypes
-  fillNativeNfcTagMembers1(e, tag_cls.get(), tag.get());
+  // a new tag starts a new arena; a tag selected before on a multiprotocol
+  // tag keeps its bytes there
+  if (mTechListTail == 0) mTechBytes.reset();
 
-  // fill NativeNfcTag's members: mHandle, mConnectedTechnology
-  fillNativeNfcTagMembers2(e, tag_cls.get(), tag.get(), activationData);
+  // make NativeNfcTag's members: mTechPollBytes
+  ScopedLocalRef<jobjectArray> techPollBytes(e, NULL);
+  fillNativeNfcTagMembers3(e, activationData, &techPollBytes);
 
-  // fill NativeNfcTag's members: mTechPollBytes
-  fillNativeNfcTagMembers3(e, tag_cls.get(), tag.get(), activationData);
+  // make NativeNfcTag's members: mTechActBytes
+  ScopedLocalRef<jobjectArray> techActBytes(e, NULL);
+  fillNativeNfcTagMembers4(e, activationData, &techActBytes);
 
-  // fill NativeNfcTag's members: mTechActBytes
-  fillNativeNfcTagMembers4(e, tag_cls.get(), tag.get(), activationData);
-
-  // fill NativeNfcTag's members: mUid
-  fillNativeNfcTagMembers5(e, tag_cls.get(), tag.get(), activationData);
+  // make NativeNfcTag's members: mUid
+  ScopedLocalRef<jbyteArray> uid(e, NULL);
+  fillNativeNfcTagMembers5(e, activationData, &uid);
+
+  // create a new Java NativeNfcTag object holding all members at once;
+  // mConnectedTechIndex starts at 0
+  ScopedLocalRef<jobject> tag(
+      e, e->NewObject(sNativeNfcTagClass, sNativeNfcTagCtor, techList.get(),
+                      handleList.get(), typeList.get(), techPollBytes.get(),
+                      techActBytes.get(), uid.get()));
+  if (tag.get() == NULL) {
+    e->ExceptionClear();
+    LOG(ERROR) << StringPrintf("%s: fail create tag", fn);
+    return;
+  }
 
   if (mNativeData->tag != NULL) {
     e->DeleteGlobalRef(mNativeData->tag);
@@ -551,7 +622,6 @@ void NfcTag::createNativeNfcTag(tNFA_ACTIVATED& activationData) {
       e->ExceptionClear();
       LOG(ERROR) << StringPrintf("%s: fail notify nfc service", fn);
     }
-    deleteglobaldata(e);
   } else {
     LOG(DEBUG) << StringPrintf("%s: Selecting next tag", fn);
   }
@@ -559,54 +629,36 @@ void NfcTag::createNativeNfcTag(tNFA_ACTIVATED& activationData) {
   LOG(DEBUG) << StringPrintf("%s: exit", fn);
 }
 
-/*******************************************************************************
-**
-** Function:        deleteglobaldata
-**
-** Description:     Deletes the global data reference after notifying to service
-**                  e: JVM environment.
-**
-** Returns:         None
-**
-*******************************************************************************/
-static void deleteglobaldata(JNIEnv* e) {
-  static const char fn[] = "deleteglobaldata";
-  LOG(DEBUG) << StringPrintf("%s: enter", fn);
-  if (sTechPollBytes != NULL) {
-    e->DeleteGlobalRef(sTechPollBytes);
-  }
-  if (gtechActBytes != NULL) {
-    e->DeleteGlobalRef(gtechActBytes);
-  }
-  LOG(DEBUG) << StringPrintf("%s: exit", fn);
-}
-
 /*******************************************************************************
 **
 ** Function:        fillNativeNfcTagMembers1
 **
-** Description:     Fill NativeNfcTag's members: mProtocols, mTechList,
-*mTechHandles, mTechLibNfcTypes.
+** Description:     Make NativeNfcTag's members: mTechList, mTechHandles,
+**                  mTechLibNfcTypes; also fill mProtocols of native data.
 **                  e: JVM environment.
-**                  tag_cls: Java NativeNfcTag class.
-**                  tag: Java NativeNfcTag object.
+**                  techList: receives mTechList.
+**                  handleList: receives mTechHandles.
+**                  typeList: receives mTechLibNfcTypes.
 **
 ** Returns:         None
 **
 *******************************************************************************/
-void NfcTag::fillNativeNfcTagMembers1(JNIEnv* e, jclass tag_cls, jobject tag) {
+void NfcTag::fillNativeNfcTagMembers1(JNIEnv* e,
+                                      ScopedLocalRef<jintArray>* techList,
+                                      ScopedLocalRef<jintArray>* handleList,
+                                      ScopedLocalRef<jintArray>* typeList) {
   static const char fn[] = "NfcTag::fillNativeNfcTagMembers1";
   LOG(DEBUG) << StringPrintf("%s", fn);
 
   // create objects that represent NativeNfcTag's member variables
-  ScopedLocalRef<jintArray> techList(e, e->NewIntArray(mNumTechList));
-  ScopedLocalRef<jintArray> handleList(e, e->NewIntArray(mNumTechList));
-  ScopedLocalRef<jintArray> typeList(e, e->NewIntArray(mNumTechList));
+  techList->reset(e->NewIntArray(mNumTechList));
+  handleList->reset(e->NewIntArray(mNumTechList));
+  typeList->reset(e->NewIntArray(mNumTechList));
 
   {
-    ScopedIntArrayRW technologies(e, techList.get());
-    ScopedIntArrayRW handles(e, handleList.get());
-    ScopedIntArrayRW types(e, typeList.get());
+    ScopedIntArrayRW technologies(e, techList->get());
+    ScopedIntArrayRW handles(e, handleList->get());
+    ScopedIntArrayRW types(e, typeList->get());
     for (int i = 0; i < mNumTechList; i++) {
       mNativeData->tProtocols[i] = mTechLibNfcTypes[i];
       mNativeData->handles[i] = mTechHandles[i];
@@ -615,94 +667,36 @@ void NfcTag::fillNativeNfcTagMembers1(JNIEnv* e, jclass tag_cls, jobject tag) {
       types[i] = mTechLibNfcTypes[i];
     }
   }
-
-  jfieldID f = NULL;
-
-  f = e->GetFieldID(tag_cls, "mTechList", "[I");
-  e->SetObjectField(tag, f, techList.get());
-
-  f = e->GetFieldID(tag_cls, "mTechHandles", "[I");
-  e->SetObjectField(tag, f, handleList.get());
-
-  f = e->GetFieldID(tag_cls, "mTechLibNfcTypes", "[I");
-  e->SetObjectField(tag, f, typeList.get());
-}
-
-/*******************************************************************************
-**
-** Function:        fillNativeNfcTagMembers2
-**
-** Description:     Fill NativeNfcTag's members: mConnectedTechIndex or
-*mConnectedTechnology.
-**                  The original Google's implementation is in
-*set_target_pollBytes(
-**                  in com_android_nfc_NativeNfcTag.cpp;
-**                  e: JVM environment.
-**                  tag_cls: Java NativeNfcTag class.
-**                  tag: Java NativeNfcTag object.
-**                  activationData: data from activation.
-**
-** Returns:         None
-**
-*******************************************************************************/
-void NfcTag::fillNativeNfcTagMembers2(JNIEnv* e, jclass tag_cls, jobject tag,
-                                      tNFA_ACTIVATED& /*activationData*/) {
-  static const char fn[] = "NfcTag::fillNativeNfcTagMembers2";
-  LOG(DEBUG) << StringPrintf("%s", fn);
-  jfieldID f = e->GetFieldID(tag_cls, "mConnectedTechIndex", "I");
-  e->SetIntField(tag, f, (jint)0);
 }
 
 /*******************************************************************************
 **
 ** Function:        fillNativeNfcTagMembers3
 **
-** Description:     Fill NativeNfcTag's members: mTechPollBytes.
+** Description:     Make NativeNfcTag's member: mTechPollBytes.
 **                  The original Google's implementation is in
 *set_target_pollBytes(
 **                  in com_android_nfc_NativeNfcTag.cpp;
 **                  e: JVM environment.
-**                  tag_cls: Java NativeNfcTag class.
-**                  tag: Java NativeNfcTag object.
 **                  activationData: data from activation.
+**                  techPollBytes: receives mTechPollBytes.
 **
 ** Returns:         None
 **
 *******************************************************************************/
-void NfcTag::fillNativeNfcTagMembers3(JNIEnv* e, jclass tag_cls, jobject tag,
-                                      tNFA_ACTIVATED& activationData) {
+void NfcTag::fillNativeNfcTagMembers3(
+    JNIEnv* e, tNFA_ACTIVATED& activationData,
+    ScopedLocalRef<jobjectArray>* techPollBytes) {
   static const char fn[] = "NfcTag::fillNativeNfcTagMembers3";
-  ScopedLocalRef<jbyteArray> pollBytes(e, e->NewByteArray(0));
-  ScopedLocalRef<jclass> byteArrayClass(e, e->GetObjectClass(pollBytes.get()));
-  ScopedLocalRef<jobjectArray> techPollBytes(
-      e, e->NewObjectArray(mNumTechList, byteArrayClass.get(), 0));
   int len = 0;
-  if (mTechListTail == 0) {
-    sTechPollBytes =
-        reinterpret_cast<jobjectArray>(e->NewGlobalRef(techPollBytes.get()));
-  } else {
-    if (sTechPollBytes == NULL) {
-      sTechPollBytes =
-          reinterpret_cast<jobjectArray>(e->NewGlobalRef(techPollBytes.get()));
-    }
-    /* Add previously activated tag's tech poll bytes also in the
-    list for multiprotocol tag*/
-    jobject techPollBytesObject;
-    for (int j = 0; j < mTechListTail; j++) {
-      techPollBytesObject = e->GetObjectArrayElement(sTechPollBytes, j);
-      e->SetObjectArrayElement(techPollBytes.get(), j, techPollBytesObject);
-    }
-  }
-
   for (int i = mTechListTail; i < mNumTechList; i++) {
     LOG(DEBUG) << StringPrintf("%s: index=%d; rf tech params mode=%u", fn, i,
                                mTechParams[i].mode);
     if (NFC_DISCOVERY_TYPE_POLL_A == mTechParams[i].mode ||
         NFC_DISCOVERY_TYPE_LISTEN_A == mTechParams[i].mode) {
       LOG(DEBUG) << StringPrintf("%s: tech A", fn);
-      pollBytes.reset(e->NewByteArray(2));
-      e->SetByteArrayRegion(pollBytes.get(), 0, 2,
-                            (jbyte*)mTechParams[i].param.pa.sens_res);
+      setTechBytes(TechBytesArena::Poll, i, mTechParams[i].param.pa.sens_res,
+                   2);
     } else if (NFC_DISCOVERY_TYPE_POLL_B == mTechParams[i].mode ||
                NFC_DISCOVERY_TYPE_POLL_B_PRIME == mTechParams[i].mode ||
                NFC_DISCOVERY_TYPE_LISTEN_B == mTechParams[i].mode ||
@@ -726,11 +720,10 @@ void NfcTag::fillNativeNfcTagMembers3(JNIEnv* e, jclass tag_cls, jobject tag,
           LOG(ERROR) << StringPrintf("%s: sensb_res_len error", fn);
           len = 0;
         }
-        pollBytes.reset(e->NewByteArray(len));
-        e->SetByteArrayRegion(pollBytes.get(), 0, len,
-                              (jbyte*)(mTechParams[i].param.pb.sensb_res + 4));
+        setTechBytes(TechBytesArena::Poll, i,
+                     mTechParams[i].param.pb.sensb_res + 4, len);
       } else {
-        pollBytes.reset(e->NewByteArray(0));
+        setTechBytes(TechBytesArena::Poll, i, NULL, 0);
       }
     } else if (NFC_DISCOVERY_TYPE_POLL_F == mTechParams[i].mode ||
                NFC_DISCOVERY_TYPE_LISTEN_F == mTechParams[i].mode) {
@@ -763,8 +756,7 @@ void NfcTag::fillNativeNfcTagMembers3(JNIEnv* e, jclass tag_cls, jobject tag,
         LOG(DEBUG) << StringPrintf("%s: tech F; sys code=0x%X 0x%X", fn,
                                    result[8], result[9]);
       }
-      pollBytes.reset(e->NewByteArray(len));
-      e->SetByteArrayRegion(pollBytes.get(), 0, len, (jbyte*)result);
+      setTechBytes(TechBytesArena::Poll, i, result, len);
     } else if (NFC_DISCOVERY_TYPE_POLL_V == mTechParams[i].mode ||
                NFC_DISCOVERY_TYPE_LISTEN_ISO15693 == mTechParams[i].mode) {
       LOG(DEBUG) << StringPrintf("%s: tech iso 15693", fn);
@@ -773,56 +765,35 @@ void NfcTag::fillNativeNfcTagMembers3(JNIEnv* e, jclass tag_cls, jobject tag,
       // used by public API: NfcV.getDsfId(), NfcV.getResponseFlags();
       uint8_t data[2] = {activationData.params.i93.afi,
                          activationData.params.i93.dsfid};
-      pollBytes.reset(e->NewByteArray(2));
-      e->SetByteArrayRegion(pollBytes.get(), 0, 2, (jbyte*)data);
+      setTechBytes(TechBytesArena::Poll, i, data, 2);
     } else {
       LOG(ERROR) << StringPrintf("%s: tech unknown ????", fn);
-      pollBytes.reset(e->NewByteArray(0));
+      setTechBytes(TechBytesArena::Poll, i, NULL, 0);
     }  // switch: every type of technology
-    e->SetObjectArrayElement(techPollBytes.get(), i, pollBytes.get());
   }  // for: every technology in the array
-  if (sTechPollBytes != NULL && mTechListTail != 0) {
-    /* Save tech poll bytes of all activated tags of a multiprotocol tag in
-     * sTechPollBytes*/
-    e->DeleteGlobalRef(sTechPollBytes);
-    sTechPollBytes =
-        reinterpret_cast<jobjectArray>(e->NewGlobalRef(techPollBytes.get()));
-  }
-  jfieldID f = e->GetFieldID(tag_cls, "mTechPollBytes", "[[B");
-  e->SetObjectField(tag, f, techPollBytes.get());
+  // technologies below mTechListTail come from tags selected before
+  makeTechBytesArray(e, TechBytesArena::Poll, techPollBytes);
 }
 
 /*******************************************************************************
 **
 ** Function:        fillNativeNfcTagMembers4
 **
-** Description:     Fill NativeNfcTag's members: mTechActBytes.
+** Description:     Make NativeNfcTag's member: mTechActBytes.
 **                  The original Google's implementation is in
 *set_target_activationBytes()
 **                  in com_android_nfc_NativeNfcTag.cpp;
 **                  e: JVM environment.
-**                  tag_cls: Java NativeNfcTag class.
-**                  tag: Java NativeNfcTag object.
 **                  activationData: data from activation.
+**                  techActBytes: receives mTechActBytes.
 **
 ** Returns:         None
 **
 *******************************************************************************/
-void NfcTag::fillNativeNfcTagMembers4(JNIEnv* e, jclass tag_cls, jobject tag,
-                                      tNFA_ACTIVATED& activationData) {
+void NfcTag::fillNativeNfcTagMembers4(
+    JNIEnv* e, tNFA_ACTIVATED& activationData,
+    ScopedLocalRef<jobjectArray>* techActBytes) {
   static const char fn[] = "NfcTag::fillNativeNfcTagMembers4";
-  ScopedLocalRef<jbyteArray> actBytes(e, e->NewByteArray(0));
-  ScopedLocalRef<jclass> byteArrayClass(e, e->GetObjectClass(actBytes.get()));
-  ScopedLocalRef<jobjectArray> techActBytes(
-      e, e->NewObjectArray(mNumTechList, byteArrayClass.get(), 0));
-  jobject gtechActBytesObject;
-  // Restore previously selected tag information from the gtechActBytes to
-  // techActBytes.
-  for (int j = 0; j < mTechListTail; j++) {
-    gtechActBytesObject = e->GetObjectArrayElement(gtechActBytes, j);
-    e->SetObjectArrayElement(techActBytes.get(), j, gtechActBytesObject);
-  }
-
   // merging sak for combi tag
   if (activationData.activate_ntf.protocol &
       (NFC_PROTOCOL_T1T | NFC_PROTOCOL_T2T | NFC_PROTOCOL_MIFARE |
@@ -834,27 +805,7 @@ void NfcTag::fillNativeNfcTagMembers4(JNIEnv* e, jclass tag_cls, jobject tag,
     for (int i = 0; i < mNumTechList; i++) {
       if (TARGET_TYPE_ISO14443_3A == mTechList[i]) {
         mTechParams[i].param.pa.sel_rsp = merge_sak;
-        actBytes.reset(e->NewByteArray(1));
-        e->SetByteArrayRegion(actBytes.get(), 0, 1,
-                              (jbyte*)&mTechParams[i].param.pa.sel_rsp);
-        e->SetObjectArrayElement(techActBytes.get(), i, actBytes.get());
-      }
-    }
-  }
-
-  if (mTechListTail == 0) {
-    // Keep the backup of the selected tag information to restore back with
-    // multi selection.
-    gtechActBytes =
-        reinterpret_cast<jobjectArray>(e->NewGlobalRef(techActBytes.get()));
-  } else {
-    for (int j = 0; j < mTechListTail; j++) {
-      if (gtechActBytes == NULL) {
-        gtechActBytes =
-            reinterpret_cast<jobjectArray>(e->NewGlobalRef(techActBytes.get()));
       }
-      gtechActBytesObject = e->GetObjectArrayElement(gtechActBytes, j);
-      e->SetObjectArrayElement(techActBytes.get(), j, gtechActBytesObject);
     }
   }
 
@@ -866,19 +817,17 @@ void NfcTag::fillNativeNfcTagMembers4(JNIEnv* e, jclass tag_cls, jobject tag,
         LOG(DEBUG) << StringPrintf("%s: T1T; tech A", fn);
       else if (mTechLibNfcTypes[i] == NFC_PROTOCOL_T2T)
         LOG(DEBUG) << StringPrintf("%s: T2T; tech A", fn);
-      actBytes.reset(e->NewByteArray(1));
-      e->SetByteArrayRegion(actBytes.get(), 0, 1,
-                            (jbyte*)&mTechParams[i].param.pa.sel_rsp);
+      setTechBytes(TechBytesArena::Activation, i,
+                   &mTechParams[i].param.pa.sel_rsp, 1);
     } else if (NFC_PROTOCOL_T3T == mTechLibNfcTypes[i]) {
       // felica
       LOG(DEBUG) << StringPrintf("%s: T3T; felica; tech F", fn);
       // really, there is no data
-      actBytes.reset(e->NewByteArray(0));
+      setTechBytes(TechBytesArena::Activation, i, NULL, 0);
     } else if (NFC_PROTOCOL_MIFARE == mTechLibNfcTypes[i]) {
       LOG(DEBUG) << StringPrintf("%s: Mifare Classic; tech A", fn);
-      actBytes.reset(e->NewByteArray(1));
-      e->SetByteArrayRegion(actBytes.get(), 0, 1,
-                            (jbyte*)&mTechParams[i].param.pa.sel_rsp);
+      setTechBytes(TechBytesArena::Activation, i,
+                   &mTechParams[i].param.pa.sel_rsp, 1);
     } else if (NFC_PROTOCOL_ISO_DEP == mTechLibNfcTypes[i]) {
       // t4t
       if (mTechList[i] ==
@@ -897,15 +846,13 @@ void NfcTag::fillNativeNfcTagMembers4(JNIEnv* e, jclass tag_cls, jobject tag,
             LOG(DEBUG) << StringPrintf(
                 "%s: T4T; ISO_DEP for tech A; copy historical bytes; len=%u",
                 fn, pa_iso.his_byte_len);
-            actBytes.reset(e->NewByteArray(pa_iso.his_byte_len));
-            if (pa_iso.his_byte_len > 0)
-              e->SetByteArrayRegion(actBytes.get(), 0, pa_iso.his_byte_len,
-                                    (jbyte*)(pa_iso.his_byte));
+            setTechBytes(TechBytesArena::Activation, i, pa_iso.his_byte,
+                         pa_iso.his_byte_len);
           } else {
             LOG(ERROR) << StringPrintf(
                 "%s: T4T; ISO_DEP for tech A; wrong interface=%u", fn,
                 activationData.activate_ntf.intf_param.type);
-            actBytes.reset(e->NewByteArray(0));
+            setTechBytes(TechBytesArena::Activation, i, NULL, 0);
           }
         } else if ((mTechParams[i].mode == NFC_DISCOVERY_TYPE_POLL_B) ||
                    (mTechParams[i].mode == NFC_DISCOVERY_TYPE_POLL_B_PRIME) ||
@@ -922,26 +869,23 @@ void NfcTag::fillNativeNfcTagMembers4(JNIEnv* e, jclass tag_cls, jobject tag,
             LOG(DEBUG) << StringPrintf(
                 "%s: T4T; ISO_DEP for tech B; copy response bytes; len=%u", fn,
                 pb_iso.hi_info_len);
-            actBytes.reset(e->NewByteArray(pb_iso.hi_info_len));
-            if (pb_iso.hi_info_len > 0)
-              e->SetByteArrayRegion(actBytes.get(), 0, pb_iso.hi_info_len,
-                                    (jbyte*)(pb_iso.hi_info));
+            setTechBytes(TechBytesArena::Activation, i, pb_iso.hi_info,
+                         pb_iso.hi_info_len);
           } else {
             LOG(ERROR) << StringPrintf(
                 "%s: T4T; ISO_DEP for tech B; wrong interface=%u", fn,
                 activationData.activate_ntf.intf_param.type);
-            actBytes.reset(e->NewByteArray(0));
+            setTechBytes(TechBytesArena::Activation, i, NULL, 0);
           }
         }
       } else if (mTechList[i] ==
                  TARGET_TYPE_ISO14443_3A)  // is TagTechnology.NFC_A by Java API
       {
         LOG(DEBUG) << StringPrintf("%s: T4T; tech A", fn);
-        actBytes.reset(e->NewByteArray(1));
-        e->SetByteArrayRegion(actBytes.get(), 0, 1,
-                              (jbyte*)&mTechParams[i].param.pa.sel_rsp);
+        setTechBytes(TechBytesArena::Activation, i,
+                     &mTechParams[i].param.pa.sel_rsp, 1);
       } else {
-        actBytes.reset(e->NewByteArray(0));
+        setTechBytes(TechBytesArena::Activation, i, NULL, 0);
       }
     }  // case NFC_PROTOCOL_ISO_DEP: //t4t
     else if (NFC_PROTOCOL_T5T == mTechLibNfcTypes[i]) {
@@ -951,66 +895,159 @@ void NfcTag::fillNativeNfcTagMembers4(JNIEnv* e, jclass tag_cls, jobject tag,
       // used by public API: NfcV.getDsfId(), NfcV.getResponseFlags();
       uint8_t data[2] = {activationData.params.i93.afi,
                          activationData.params.i93.dsfid};
-      actBytes.reset(e->NewByteArray(2));
-      e->SetByteArrayRegion(actBytes.get(), 0, 2, (jbyte*)data);
+      setTechBytes(TechBytesArena::Activation, i, data, 2);
     } else {
       if ((NCI_PROTOCOL_UNKNOWN == mTechLibNfcTypes[i]) &&
           (mTechParams[i].mode == NFC_DISCOVERY_TYPE_POLL_B)) {
         LOG(DEBUG) << StringPrintf("%s; Chinese Id Card - MBI = %02X", fn,
                                    activationData.params.ci.mbi);
-        actBytes.reset(e->NewByteArray(1));
-        e->SetByteArrayRegion(actBytes.get(), 0, 1,
-                              (jbyte*)&activationData.params.ci.mbi);
+        setTechBytes(TechBytesArena::Activation, i,
+                     &activationData.params.ci.mbi, 1);
       } else {
         LOG(DEBUG) << StringPrintf("%s: tech unknown ????", fn);
-        actBytes.reset(e->NewByteArray(0));
+        setTechBytes(TechBytesArena::Activation, i, NULL, 0);
       }
     }
-    e->SetObjectArrayElement(techActBytes.get(), i, actBytes.get());
   }  // for: every technology in the array of current selected tag
-  if (gtechActBytes != NULL && mTechListTail != 0) {
-    e->DeleteGlobalRef(gtechActBytes);
-    gtechActBytes =
-        reinterpret_cast<jobjectArray>(e->NewGlobalRef(techActBytes.get()));
+  // technologies below mTechListTail come from tags selected before
+  makeTechBytesArray(e, TechBytesArena::Activation, techActBytes);
+}
+
+/*******************************************************************************
+**
+** Function:        internByteArray
+**
+** Description:     Get a Java byte array holding some bytes.  Arrays of at
+**                  most kMaxInternedLen bytes are made once and shared by
+**                  all tags.
+**                  e: JVM environment.
+**                  data: bytes; may be NULL if len is 0.
+**                  len: number of bytes.
+**
+** Returns:         Local reference to the array; NULL if out of memory.
+**
+*******************************************************************************/
+static jbyteArray internByteArray(JNIEnv* e, const uint8_t* data, size_t len) {
+  if (len <= kMaxInternedLen) {
+    for (size_t i = 0; i < sNumInterned; i++) {
+      if ((sInterned[i].len == len) &&
+          ((len == 0) || (memcmp(sInterned[i].data, data, len) == 0))) {
+        return reinterpret_cast<jbyteArray>(
+            e->NewLocalRef(sInterned[i].array));
+      }
+    }
+  }
+
+  jbyteArray array = e->NewByteArray(len);
+  if (array == NULL) {
+    e->ExceptionClear();
+    return NULL;
+  }
+  if (len > 0) e->SetByteArrayRegion(array, 0, len, (const jbyte*)data);
+  if (len <= kMaxInternedLen) {
+    jbyteArray global = reinterpret_cast<jbyteArray>(e->NewGlobalRef(array));
+    if (global != NULL) {
+      InternedBytes& interned = sInterned[sNextInterned];
+      // tags made before keep their own references to the old array
+      if (sNumInterned == kMaxInterned)
+        e->DeleteGlobalRef(interned.array);
+      else
+        sNumInterned++;
+      interned.array = global;
+      interned.len = len;
+      if (len > 0) memcpy(interned.data, data, len);
+      sNextInterned = (sNextInterned + 1) % kMaxInterned;
+    }
+  }
+  return array;
+}
+
+/*******************************************************************************
+**
+** Function:        setTechBytes
+**
+** Description:     Keep the poll or activation bytes of one technology in
+**                  the arena of the current activation.
+**                  kind: poll or activation bytes.
+**                  index: index of the technology.
+**                  data: bytes; may be NULL if len is 0.
+**                  len: number of bytes.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void NfcTag::setTechBytes(TechBytesArena::Kind kind, int index,
+                          const uint8_t* data, size_t len) {
+  static const char fn[] = "NfcTag::setTechBytes";
+  if (!mTechBytes.set(kind, index, data, len)) {
+    LOG(ERROR) << StringPrintf("%s: no room; kind=%d index=%d len=%zu", fn,
+                               kind, index, len);
+  }
+}
+
+/*******************************************************************************
+**
+** Function:        makeTechBytesArray
+**
+** Description:     Make the Java array of poll or activation bytes of all
+**                  technologies from the arena.
+**                  e: JVM environment.
+**                  kind: poll or activation bytes.
+**                  array: receives the array.
+**
+** Returns:         None
+**
+*******************************************************************************/
+void NfcTag::makeTechBytesArray(JNIEnv* e, TechBytesArena::Kind kind,
+                                ScopedLocalRef<jobjectArray>* array) {
+  static const char fn[] = "NfcTag::makeTechBytesArray";
+  array->reset(e->NewObjectArray(mNumTechList, sByteArrayClass, NULL));
+  if (array->get() == NULL) {
+    e->ExceptionClear();
+    LOG(ERROR) << StringPrintf("%s: fail create array", fn);
+    return;
+  }
+  for (int i = 0; i < mNumTechList; i++) {
+    size_t len = 0;
+    const uint8_t* bytes = mTechBytes.get(kind, i, &len);
+    if (bytes == NULL) continue;  // left null, as for a missing entry
+    ScopedLocalRef<jbyteArray> element(e, internByteArray(e, bytes, len));
+    e->SetObjectArrayElement(array->get(), i, element.get());
   }
-  jfieldID f = e->GetFieldID(tag_cls, "mTechActBytes", "[[B");
-  e->SetObjectField(tag, f, techActBytes.get());
 }
 
 /*******************************************************************************
 **
 ** Function:        fillNativeNfcTagMembers5
 **
-** Description:     Fill NativeNfcTag's members: mUid.
+** Description:     Make NativeNfcTag's member: mUid.
 **                  The original Google's implementation is in
 *nfc_jni_Discovery_notification_callback()
 **                  in com_android_nfc_NativeNfcManager.cpp;
 **                  e: JVM environment.
-**                  tag_cls: Java NativeNfcTag class.
-**                  tag: Java NativeNfcTag object.
 **                  activationData: data from activation.
+**                  uid: receives mUid.
 **
 ** Returns:         None
 **
 *******************************************************************************/
-void NfcTag::fillNativeNfcTagMembers5(JNIEnv* e, jclass tag_cls, jobject tag,
-                                      tNFA_ACTIVATED& activationData) {
+void NfcTag::fillNativeNfcTagMembers5(JNIEnv* e, tNFA_ACTIVATED& activationData,
+                                      ScopedLocalRef<jbyteArray>* uid) {
   static const char fn[] = "NfcTag::fillNativeNfcTagMembers5";
   int len = 0;
-  ScopedLocalRef<jbyteArray> uid(e, NULL);
 
   if (NFC_DISCOVERY_TYPE_POLL_KOVIO == mTechParams[0].mode) {
     LOG(DEBUG) << StringPrintf("%s: Kovio", fn);
     len = mTechParams[0].param.pk.uid_len;
-    uid.reset(e->NewByteArray(len));
-    e->SetByteArrayRegion(uid.get(), 0, len,
+    uid->reset(e->NewByteArray(len));
+    e->SetByteArrayRegion(uid->get(), 0, len,
                           (jbyte*)&mTechParams[0].param.pk.uid);
   } else if (NFC_DISCOVERY_TYPE_POLL_A == mTechParams[0].mode ||
              NFC_DISCOVERY_TYPE_LISTEN_A == mTechParams[0].mode) {
     LOG(DEBUG) << StringPrintf("%s: tech A", fn);
     len = mTechParams[0].param.pa.nfcid1_len;
-    uid.reset(e->NewByteArray(len));
-    e->SetByteArrayRegion(uid.get(), 0, len,
+    uid->reset(e->NewByteArray(len));
+    e->SetByteArrayRegion(uid->get(), 0, len,
                           (jbyte*)&mTechParams[0].param.pa.nfcid1);
     // a tag's NFCID1 can change dynamically at each activation;
     // only the first byte (0x08) is constant; a dynamic NFCID1's length
@@ -1023,13 +1060,13 @@ void NfcTag::fillNativeNfcTagMembers5(JNIEnv* e, jclass tag_cls, jobject tag,
              NFC_DISCOVERY_TYPE_LISTEN_B == mTechParams[0].mode ||
              NFC_DISCOVERY_TYPE_LISTEN_B_PRIME == mTechParams[0].mode) {
     LOG(DEBUG) << StringPrintf("%s: tech B", fn);
-    uid.reset(e->NewByteArray(NFC_NFCID0_MAX_LEN));
-    e->SetByteArrayRegion(uid.get(), 0, NFC_NFCID0_MAX_LEN,
+    uid->reset(e->NewByteArray(NFC_NFCID0_MAX_LEN));
+    e->SetByteArrayRegion(uid->get(), 0, NFC_NFCID0_MAX_LEN,
                           (jbyte*)&mTechParams[0].param.pb.nfcid0);
   } else if (NFC_DISCOVERY_TYPE_POLL_F == mTechParams[0].mode ||
              NFC_DISCOVERY_TYPE_LISTEN_F == mTechParams[0].mode) {
-    uid.reset(e->NewByteArray(NFC_NFCID2_LEN));
-    e->SetByteArrayRegion(uid.get(), 0, NFC_NFCID2_LEN,
+    uid->reset(e->NewByteArray(NFC_NFCID2_LEN));
+    e->SetByteArrayRegion(uid->get(), 0, NFC_NFCID2_LEN,
                           (jbyte*)&mTechParams[0].param.pf.nfcid2);
     LOG(DEBUG) << StringPrintf("%s: tech F", fn);
   } else if (NFC_DISCOVERY_TYPE_POLL_V == mTechParams[0].mode ||
@@ -1038,14 +1075,12 @@ void NfcTag::fillNativeNfcTagMembers5(JNIEnv* e, jclass tag_cls, jobject tag,
     jbyte data[I93_UID_BYTE_LEN];               // 8 bytes
     for (int i = 0; i < I93_UID_BYTE_LEN; ++i)  // reverse the ID
       data[i] = activationData.params.i93.uid[I93_UID_BYTE_LEN - i - 1];
-    uid.reset(e->NewByteArray(I93_UID_BYTE_LEN));
-    e->SetByteArrayRegion(uid.get(), 0, I93_UID_BYTE_LEN, data);
+    uid->reset(e->NewByteArray(I93_UID_BYTE_LEN));
+    e->SetByteArrayRegion(uid->get(), 0, I93_UID_BYTE_LEN, data);
   } else {
     LOG(ERROR) << StringPrintf("%s: tech unknown ????", fn);
-    uid.reset(e->NewByteArray(0));
+    uid->reset(e->NewByteArray(0));
   }
-  jfieldID f = e->GetFieldID(tag_cls, "mUid", "[B");
-  e->SetObjectField(tag, f, uid.get());
   mTechListTail = mNumTechList;
   if (mNumDiscNtf == 0) mTechListTail = 0;
   LOG(DEBUG) << StringPrintf("%s;mTechListTail=%x", fn, mTechListTail);
@@ -1076,6 +1111,10 @@ void NfcTag::resetTechnologies() {
   mIsDynamicTagId = false;
   mIsFelicaLite = false;
   resetAllTransceiveTimeouts();
+  {
+    Mutex::Autolock lock(mLatencyMutex);
+    mLatencies.clear();  // a new tag
+  }
 }
 
 /*******************************************************************************
@@ -1495,6 +1534,48 @@ bool NfcTag::isDynamicTagId() {
          (mTechList[1] == TARGET_TYPE_ISO14443_3A);   // tech A
 }
 
+/*******************************************************************************
+**
+** Function:        getTagUid
+**
+** Description:     Get the ID of the activated tag from its technology
+**                  parameters.
+**                  uid: receives the ID.
+**                  maxLen: size of uid.
+**
+** Returns:         Length of the ID; 0 if unknown or too long.
+**
+*******************************************************************************/
+size_t NfcTag::getTagUid(uint8_t* uid, size_t maxLen) {
+  const uint8_t* id = NULL;
+  size_t len = 0;
+
+  switch (mTechParams[0].mode) {
+    case NFC_DISCOVERY_TYPE_POLL_A:
+      id = mTechParams[0].param.pa.nfcid1;
+      len = mTechParams[0].param.pa.nfcid1_len;
+      break;
+    case NFC_DISCOVERY_TYPE_POLL_B:
+    case NFC_DISCOVERY_TYPE_POLL_B_PRIME:
+      id = mTechParams[0].param.pb.nfcid0;
+      len = NFC_NFCID0_MAX_LEN;
+      break;
+    case NFC_DISCOVERY_TYPE_POLL_F:
+      id = mTechParams[0].param.pf.nfcid2;
+      len = NFC_NFCID2_LEN;
+      break;
+    case NFC_DISCOVERY_TYPE_POLL_V:
+      id = mTechParams[0].param.pi93.uid;
+      len = I93_UID_BYTE_LEN;
+      break;
+    default:
+      break;
+  }
+  if ((id == NULL) || (len > maxLen)) return 0;
+  memcpy(uid, id, len);
+  return len;
+}
+
 /*******************************************************************************
 **
 ** Function:        resetAllTransceiveTimeouts
@@ -1515,6 +1596,7 @@ void NfcTag::resetAllTransceiveTimeouts() {
   mTechnologyTimeoutsTable[TARGET_TYPE_MIFARE_CLASSIC] = 618;  // MifareClassic
   mTechnologyTimeoutsTable[TARGET_TYPE_MIFARE_UL] = 618;  // MifareUltralight
   mTechnologyTimeoutsTable[TARGET_TYPE_KOVIO_BARCODE] = 1000;  // NfcBarcode
+  mAppTimeouts.assign(mAppTimeouts.size(), false);
 }
 
 /*******************************************************************************
@@ -1550,14 +1632,108 @@ int NfcTag::getTransceiveTimeout(int techId) {
 ** Returns:         Timeout value.
 **
 *******************************************************************************/
-void NfcTag::setTransceiveTimeout(int techId, int timeout) {
+void NfcTag::setTransceiveTimeout(int techId, int timeout, bool fromApp) {
   static const char fn[] = "NfcTag::setTransceiveTimeout";
-  if ((techId >= 0) && (techId < (int)mTechnologyTimeoutsTable.size()))
+  if ((techId >= 0) && (techId < (int)mTechnologyTimeoutsTable.size())) {
     mTechnologyTimeoutsTable[techId] = timeout;
-  else
+    mAppTimeouts[techId] = fromApp;
+  } else
     LOG(ERROR) << StringPrintf("%s: invalid tech=%d", fn, techId);
 }
 
+/*******************************************************************************
+**
+** Function:        getTransceiveTimeout
+**
+** Description:     Get the timeout value for one command.
+**                  techId: one of the values in TARGET_TYPE_* defined in
+**                  NfcJniUtil.h
+**                  cmd: command about to be sent.
+**                  cmdLen: length of the command.
+**
+** Returns:         Timeout value in millisecond.
+**
+*******************************************************************************/
+int NfcTag::getTransceiveTimeout(int techId, const uint8_t* cmd,
+                                 size_t cmdLen) {
+  int const timeout = getTransceiveTimeout(techId);
+  if (!mAdaptiveTimeout || (techId < 0) ||
+      (techId >= (int)mAppTimeouts.size()) || mAppTimeouts[techId])
+    return timeout;
+
+  Mutex::Autolock lock(mLatencyMutex);
+  auto it = mLatencies.find(latencyKey(techId, cmd, cmdLen));
+  if (it == mLatencies.end()) return timeout;
+  return it->second.timeoutMs(timeout);
+}
+
+/*******************************************************************************
+**
+** Function:        setAdaptiveTransceiveTimeout
+**
+** Description:     Enable or disable deriving transceive timeouts from
+**                  observed response latencies.
+**                  enabled: whether to adapt.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void NfcTag::setAdaptiveTransceiveTimeout(bool enabled) {
+  LOG(DEBUG) << StringPrintf("%s: enabled=%d", __func__, enabled);
+  mAdaptiveTimeout = enabled;
+}
+
+/*******************************************************************************
+**
+** Function:        recordTransceive
+**
+** Description:     Feed the outcome of a transceive to adaptive mode.
+**                  techId: one of the values in TARGET_TYPE_* defined in
+**                  NfcJniUtil.h
+**                  cmd: command that was sent.
+**                  cmdLen: length of the command.
+**                  latencyUs: time until the response.
+**                  responded: false if the command timed out.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void NfcTag::recordTransceive(int techId, const uint8_t* cmd, size_t cmdLen,
+                              uint32_t latencyUs, bool responded) {
+  if (!mAdaptiveTimeout) return;
+
+  Mutex::Autolock lock(mLatencyMutex);
+  LatencyEstimator& latency = mLatencies[latencyKey(techId, cmd, cmdLen)];
+  if (responded)
+    latency.addSample(latencyUs);
+  else
+    latency.addTimeout();
+}
+
+/*******************************************************************************
+**
+** Function:        latencyKey
+**
+** Description:     Key of the latencies of a class of command.
+**
+** Returns:         Key into mLatencies.
+**
+*******************************************************************************/
+uint32_t NfcTag::latencyKey(int techId, const uint8_t* cmd, size_t cmdLen) {
+  uint8_t code = 0;
+  switch (techId) {
+    case TARGET_TYPE_ISO14443_4:  // CLA INS ...
+    case TARGET_TYPE_FELICA:      // length, command code
+    case TARGET_TYPE_V:           // flags, command code
+      if (cmdLen >= 2) code = cmd[1];
+      break;
+    default:
+      if (cmdLen >= 1) code = cmd[0];
+      break;
+  }
+  return ((uint32_t)techId << 8) | code;
+}
+
 /*******************************************************************************
 **
 ** Function:        getPresenceCheckAlgorithm
@@ -1571,6 +1747,166 @@ tNFA_RW_PRES_CHK_OPTION NfcTag::getPresenceCheckAlgorithm() {
   return mPresenceCheckAlgorithm;
 }
 
+/*******************************************************************************
+**
+** Function:        hasStableTagId
+**
+** Description:     Whether the ID of the activated tag identifies it across
+**                  taps, so that it may key what is remembered about the tag.
+**
+** Returns:         False if the ID is unknown, dynamic or random.
+**
+*******************************************************************************/
+bool NfcTag::hasStableTagId() {
+  uint8_t uid[NCI_NFCID1_MAX_LEN];
+  size_t uidLen = getTagUid(uid, sizeof(uid));
+  if ((uidLen == 0) || isDynamicTagId()) return false;
+  // a random NFCID1 (first byte 0x08) can repeat for another tag
+  return !((uidLen == 4) && (uid[0] == 0x08));
+}
+
+/*******************************************************************************
+**
+** Function:        learnedTagKey
+**
+** Description:     Key of the activated tag in mLearnedPresenceChecks
+**                  and mLearnedHalts.
+**                  protocol: activated protocol.
+**                  key: receives the tag ID followed by the protocol.
+**
+** Returns:         False if the tag ID is unknown or dynamic.
+**
+*******************************************************************************/
+bool NfcTag::learnedTagKey(int protocol, std::vector<uint8_t>* key) {
+  uint8_t uid[NCI_NFCID1_MAX_LEN];
+  size_t uidLen = getTagUid(uid, sizeof(uid));
+  if ((uidLen == 0) || !hasStableTagId()) return false;
+  key->assign(uid, uid + uidLen);
+  key->push_back((uint8_t)protocol);
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        getLearnedPresenceCheck
+**
+** Description:     Get the presence-check method found to work on the
+**                  activated tag when it was last seen.
+**                  protocol: activated protocol.
+**                  method: receives the method.
+**
+** Returns:         True if a method was learned for this tag.
+**
+*******************************************************************************/
+bool NfcTag::getLearnedPresenceCheck(int protocol,
+                                     tNFA_RW_PRES_CHK_OPTION* method) {
+  std::vector<uint8_t> key;
+  if (!learnedTagKey(protocol, &key)) return false;
+
+  Mutex::Autolock lock(mLearnedMutex);
+  for (auto it = mLearnedPresenceChecks.begin();
+       it != mLearnedPresenceChecks.end(); ++it) {
+    if (it->first == key) {
+      mLearnedPresenceChecks.splice(mLearnedPresenceChecks.begin(),
+                                    mLearnedPresenceChecks, it);
+      *method = it->second;
+      return true;
+    }
+  }
+  return false;
+}
+
+/*******************************************************************************
+**
+** Function:        setLearnedPresenceCheck
+**
+** Description:     Remember the presence-check method that works on the
+**                  activated tag, for its next taps.
+**                  protocol: activated protocol.
+**                  method: presence-check method.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void NfcTag::setLearnedPresenceCheck(int protocol,
+                                     tNFA_RW_PRES_CHK_OPTION method) {
+  static const char fn[] = "NfcTag::setLearnedPresenceCheck";
+  std::vector<uint8_t> key;
+  if (!learnedTagKey(protocol, &key)) return;
+  LOG(DEBUG) << StringPrintf("%s: protocol=0x%X method=%u", fn, protocol,
+                             method);
+
+  Mutex::Autolock lock(mLearnedMutex);
+  for (auto it = mLearnedPresenceChecks.begin();
+       it != mLearnedPresenceChecks.end(); ++it) {
+    if (it->first == key) {
+      mLearnedPresenceChecks.erase(it);
+      break;
+    }
+  }
+  if (mLearnedPresenceChecks.size() >= kMaxLearnedPresenceChecks)
+    mLearnedPresenceChecks.pop_back();
+  mLearnedPresenceChecks.emplace_front(key, method);
+}
+
+/*******************************************************************************
+**
+** Function:        getLearnedHaltSequence
+**
+** Description:     Get how the halt of the activated tag ended when it was
+**                  last reselected.
+**                  protocol: activated protocol.
+**                  sequence: receives the halt sequence.
+**
+** Returns:         True if a sequence was learned for this tag.
+**
+*******************************************************************************/
+bool NfcTag::getLearnedHaltSequence(int protocol, HaltSequence* sequence) {
+  std::vector<uint8_t> key;
+  if (!learnedTagKey(protocol, &key)) return false;
+
+  Mutex::Autolock lock(mLearnedMutex);
+  for (auto it = mLearnedHalts.begin(); it != mLearnedHalts.end(); ++it) {
+    if (it->first == key) {
+      mLearnedHalts.splice(mLearnedHalts.begin(), mLearnedHalts, it);
+      *sequence = it->second;
+      return true;
+    }
+  }
+  return false;
+}
+
+/*******************************************************************************
+**
+** Function:        setLearnedHaltSequence
+**
+** Description:     Remember how the halt of the activated tag ends, for
+**                  its next reselections.
+**                  protocol: activated protocol.
+**                  sequence: halt sequence.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void NfcTag::setLearnedHaltSequence(int protocol, HaltSequence sequence) {
+  static const char fn[] = "NfcTag::setLearnedHaltSequence";
+  std::vector<uint8_t> key;
+  if (!learnedTagKey(protocol, &key)) return;
+  LOG(DEBUG) << StringPrintf("%s: protocol=0x%X sequence=%d", fn, protocol,
+                             sequence);
+
+  Mutex::Autolock lock(mLearnedMutex);
+  for (auto it = mLearnedHalts.begin(); it != mLearnedHalts.end(); ++it) {
+    if (it->first == key) {
+      mLearnedHalts.erase(it);
+      break;
+    }
+  }
+  if (mLearnedHalts.size() >= kMaxLearnedPresenceChecks)
+    mLearnedHalts.pop_back();
+  mLearnedHalts.emplace_front(key, sequence);
+}
+
 /*******************************************************************************
 **
 ** Function:        isInfineonMyDMove
@@ -19,11 +19,18 @@
  */
 
 #pragma once
+#include <nativehelper/ScopedLocalRef.h>
+
+#include <list>
+#include <map>
 #include <vector>
 
+#include "LatencyEstimator.h"
+#include "Mutex.h"
 #include "NfcJniUtil.h"
 #include "NfcStatsUtil.h"
 #include "SyncEvent.h"
+#include "TechBytesArena.h"
 #include "nfa_rw_api.h"
 
 #define MIN_FWI (11)
@@ -34,6 +41,11 @@ class NfcTag {
 
  public:
   enum ActivationState { Idle, Sleep, Active };
+  // how reSelect() ends the halt of a tag on the frame interface
+  enum HaltSequence {
+    HaltWaitReport,  // the controller reports the halt; wait for the report
+    HaltGuardTime    // nothing is reported; wait a short guard time instead
+  };
   static const int MAX_NUM_TECHNOLOGY =
       11;  // max number of technologies supported by one or more tags
   int mTechList[MAX_NUM_TECHNOLOGY];  // array of NFC technologies according to
@@ -71,6 +83,20 @@ class NfcTag {
   *******************************************************************************/
   static NfcTag& getInstance();
 
+  /*******************************************************************************
+  **
+  ** Function:        cacheJavaIds
+  **
+  ** Description:     Look up the Java NativeNfcTag class and its constructor
+  **                  once, when the natives are registered, so that tag
+  **                  activation does not repeat the lookups.
+  **                  e: JVM environment.
+  **
+  ** Returns:         True if ok.
+  **
+  *******************************************************************************/
+  static bool cacheJavaIds(JNIEnv* e);
+
   /*******************************************************************************
   **
   ** Function:        initialize
@@ -303,6 +329,32 @@ class NfcTag {
   *******************************************************************************/
   bool isDynamicTagId();
 
+  /*******************************************************************************
+  **
+  ** Function:        getTagUid
+  **
+  ** Description:     Get the ID of the activated tag from its technology
+  **                  parameters.
+  **                  uid: receives the ID.
+  **                  maxLen: size of uid.
+  **
+  ** Returns:         Length of the ID; 0 if unknown or too long.
+  **
+  *******************************************************************************/
+  size_t getTagUid(uint8_t* uid, size_t maxLen);
+
+  /*******************************************************************************
+  **
+  ** Function:        hasStableTagId
+  **
+  ** Description:     Whether the ID of the activated tag identifies it across
+  **                  taps, so that it may key what is remembered about the tag.
+  **
+  ** Returns:         False if the ID is unknown, dynamic or random.
+  **
+  *******************************************************************************/
+  bool hasStableTagId();
+
   /*******************************************************************************
   **
   ** Function:        resetAllTransceiveTimeouts
@@ -341,6 +393,25 @@ class NfcTag {
   *******************************************************************************/
   int getTransceiveTimeout(int techId);
 
+  /*******************************************************************************
+  **
+  ** Function:        getTransceiveTimeout
+  **
+  ** Description:     Get the timeout value for one command.  In adaptive
+  **                  mode this is derived from the latencies observed for
+  **                  the same class of command on the activated tag, bounded
+  **                  by the technology's timeout; a timeout set by the
+  **                  application is used as is.
+  **                  techId: one of the values in TARGET_TYPE_* defined in
+  **                  NfcJniUtil.h
+  **                  cmd: command about to be sent.
+  **                  cmdLen: length of the command.
+  **
+  ** Returns:         Timeout value in millisecond.
+  **
+  *******************************************************************************/
+  int getTransceiveTimeout(int techId, const uint8_t* cmd, size_t cmdLen);
+
   /*******************************************************************************
   **
   ** Function:        setTransceiveTimeout
@@ -349,11 +420,44 @@ class NfcTag {
   **                  techId: one of the values in TARGET_TYPE_* defined in
   *NfcJniUtil.h
   **                  timeout: timeout value in millisecond.
+  **                  fromApp: whether the application chose the value, in
+  **                  which case adaptive mode leaves it alone.
   **
   ** Returns:         Timeout value.
   **
   *******************************************************************************/
-  void setTransceiveTimeout(int techId, int timeout);
+  void setTransceiveTimeout(int techId, int timeout, bool fromApp = false);
+
+  /*******************************************************************************
+  **
+  ** Function:        setAdaptiveTransceiveTimeout
+  **
+  ** Description:     Enable or disable deriving transceive timeouts from
+  **                  observed response latencies.
+  **                  enabled: whether to adapt.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void setAdaptiveTransceiveTimeout(bool enabled);
+
+  /*******************************************************************************
+  **
+  ** Function:        recordTransceive
+  **
+  ** Description:     Feed the outcome of a transceive to adaptive mode.
+  **                  techId: one of the values in TARGET_TYPE_* defined in
+  **                  NfcJniUtil.h
+  **                  cmd: command that was sent.
+  **                  cmdLen: length of the command.
+  **                  latencyUs: time until the response.
+  **                  responded: false if the command timed out.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void recordTransceive(int techId, const uint8_t* cmd, size_t cmdLen,
+                        uint32_t latencyUs, bool responded);
 
   /*******************************************************************************
   **
@@ -366,6 +470,64 @@ class NfcTag {
   *******************************************************************************/
   tNFA_RW_PRES_CHK_OPTION getPresenceCheckAlgorithm();
 
+  /*******************************************************************************
+  **
+  ** Function:        getLearnedPresenceCheck
+  **
+  ** Description:     Get the presence-check method found to work on the
+  **                  activated tag when it was last seen.
+  **                  protocol: activated protocol.
+  **                  method: receives the method.
+  **
+  ** Returns:         True if a method was learned for this tag.
+  **
+  *******************************************************************************/
+  bool getLearnedPresenceCheck(int protocol, tNFA_RW_PRES_CHK_OPTION* method);
+
+  /*******************************************************************************
+  **
+  ** Function:        setLearnedPresenceCheck
+  **
+  ** Description:     Remember the presence-check method that works on the
+  **                  activated tag, for its next taps.  Tags with a dynamic
+  **                  ID are not remembered.
+  **                  protocol: activated protocol.
+  **                  method: presence-check method.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void setLearnedPresenceCheck(int protocol, tNFA_RW_PRES_CHK_OPTION method);
+
+  /*******************************************************************************
+  **
+  ** Function:        getLearnedHaltSequence
+  **
+  ** Description:     Get how the halt of the activated tag ended when it was
+  **                  last reselected.
+  **                  protocol: activated protocol.
+  **                  sequence: receives the halt sequence.
+  **
+  ** Returns:         True if a sequence was learned for this tag.
+  **
+  *******************************************************************************/
+  bool getLearnedHaltSequence(int protocol, HaltSequence* sequence);
+
+  /*******************************************************************************
+  **
+  ** Function:        setLearnedHaltSequence
+  **
+  ** Description:     Remember how the halt of the activated tag ends, for
+  **                  its next reselections.  Tags with a dynamic ID are not
+  **                  remembered.
+  **                  protocol: activated protocol.
+  **                  sequence: halt sequence.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void setLearnedHaltSequence(int protocol, HaltSequence sequence);
+
   /*******************************************************************************
   **
   ** Function:        isInfineonMyDMove
@@ -474,8 +636,50 @@ class NfcTag {
   int mNumDiscNtf;
   int mNumDiscTechList;
   int mTechListTail;  // Index of Last added entry in mTechList
+  TechBytesArena mTechBytes;  // poll and activation bytes of this activation
   bool mIsMultiProtocolTag;
   NfcStatsUtil* mNfcStatsUtil;
+  bool mAdaptiveTimeout;           // whether timeouts follow latencies
+  std::vector<bool> mAppTimeouts;  // techs whose timeout the app chose
+  Mutex mLatencyMutex;
+  // latencies of the activated tag, by technology and command class
+  std::map<uint32_t, LatencyEstimator> mLatencies;
+
+  /*******************************************************************************
+  **
+  ** Function:        latencyKey
+  **
+  ** Description:     Key of the latencies of a class of command: the
+  **                  technology and the command code, which is the
+  **                  instruction byte of an APDU.
+  **
+  ** Returns:         Key into mLatencies.
+  **
+  *******************************************************************************/
+  static uint32_t latencyKey(int techId, const uint8_t* cmd, size_t cmdLen);
+
+  // tags whose presence-check method or halt sequence is remembered
+  static const size_t kMaxLearnedPresenceChecks = 32;
+  Mutex mLearnedMutex;
+  // tag ID and protocol, with the method that works; most recent first
+  std::list<std::pair<std::vector<uint8_t>, tNFA_RW_PRES_CHK_OPTION>>
+      mLearnedPresenceChecks;
+  // tag ID and protocol, with the halt sequence; most recent first
+  std::list<std::pair<std::vector<uint8_t>, HaltSequence>> mLearnedHalts;
+
+  /*******************************************************************************
+  **
+  ** Function:        learnedTagKey
+  **
+  ** Description:     Key of the activated tag in mLearnedPresenceChecks
+  **                  and mLearnedHalts.
+  **                  protocol: activated protocol.
+  **                  key: receives the tag ID followed by the protocol.
+  **
+  ** Returns:         False if the tag ID is unknown or dynamic.
+  **
+  *******************************************************************************/
+  bool learnedTagKey(int protocol, std::vector<uint8_t>* key);
 
   /*******************************************************************************
   **
@@ -540,93 +744,107 @@ class NfcTag {
   **
   ** Function:        fillNativeNfcTagMembers1
   **
-  ** Description:     Fill NativeNfcTag's members: mProtocols, mTechList,
-  *mTechHandles, mTechLibNfcTypes.
+  ** Description:     Make NativeNfcTag's members: mTechList, mTechHandles,
+  **                  mTechLibNfcTypes; also fill mProtocols of native data.
   **                  e: JVM environment.
-  **                  tag_cls: Java NativeNfcTag class.
-  **                  tag: Java NativeNfcTag object.
+  **                  techList: receives mTechList.
+  **                  handleList: receives mTechHandles.
+  **                  typeList: receives mTechLibNfcTypes.
   **
   ** Returns:         None
   **
   *******************************************************************************/
-  void fillNativeNfcTagMembers1(JNIEnv* e, jclass tag_cls, jobject tag);
+  void fillNativeNfcTagMembers1(JNIEnv* e, ScopedLocalRef<jintArray>* techList,
+                                ScopedLocalRef<jintArray>* handleList,
+                                ScopedLocalRef<jintArray>* typeList);
 
   /*******************************************************************************
   **
-  ** Function:        fillNativeNfcTagMembers2
+  ** Function:        fillNativeNfcTagMembers3
   **
-  ** Description:     Fill NativeNfcTag's members: mConnectedTechIndex or
-  *mConnectedTechnology.
+  ** Description:     Make NativeNfcTag's member: mTechPollBytes.
   **                  The original Google's implementation is in
   *set_target_pollBytes(
   **                  in com_android_nfc_NativeNfcTag.cpp;
   **                  e: JVM environment.
-  **                  tag_cls: Java NativeNfcTag class.
-  **                  tag: Java NativeNfcTag object.
   **                  activationData: data from activation.
+  **                  techPollBytes: receives mTechPollBytes.
   **
   ** Returns:         None
   **
   *******************************************************************************/
-  void fillNativeNfcTagMembers2(JNIEnv* e, jclass tag_cls, jobject tag,
-                                tNFA_ACTIVATED& activationData);
+  void fillNativeNfcTagMembers3(JNIEnv* e, tNFA_ACTIVATED& activationData,
+                                ScopedLocalRef<jobjectArray>* techPollBytes);
 
   /*******************************************************************************
   **
-  ** Function:        fillNativeNfcTagMembers3
+  ** Function:        fillNativeNfcTagMembers4
   **
-  ** Description:     Fill NativeNfcTag's members: mTechPollBytes.
+  ** Description:     Make NativeNfcTag's member: mTechActBytes.
   **                  The original Google's implementation is in
-  *set_target_pollBytes(
+  *set_target_activationBytes()
   **                  in com_android_nfc_NativeNfcTag.cpp;
   **                  e: JVM environment.
-  **                  tag_cls: Java NativeNfcTag class.
-  **                  tag: Java NativeNfcTag object.
   **                  activationData: data from activation.
+  **                  techActBytes: receives mTechActBytes.
   **
   ** Returns:         None
   **
   *******************************************************************************/
-  void fillNativeNfcTagMembers3(JNIEnv* e, jclass tag_cls, jobject tag,
-                                tNFA_ACTIVATED& activationData);
+  void fillNativeNfcTagMembers4(JNIEnv* e, tNFA_ACTIVATED& activationData,
+                                ScopedLocalRef<jobjectArray>* techActBytes);
 
   /*******************************************************************************
   **
-  ** Function:        fillNativeNfcTagMembers4
+  ** Function:        fillNativeNfcTagMembers5
   **
-  ** Description:     Fill NativeNfcTag's members: mTechActBytes.
+  ** Description:     Make NativeNfcTag's member: mUid.
   **                  The original Google's implementation is in
-  *set_target_activationBytes()
-  **                  in com_android_nfc_NativeNfcTag.cpp;
+  *nfc_jni_Discovery_notification_callback()
+  **                  in com_android_nfc_NativeNfcManager.cpp;
   **                  e: JVM environment.
-  **                  tag_cls: Java NativeNfcTag class.
-  **                  tag: Java NativeNfcTag object.
   **                  activationData: data from activation.
+  **                  uid: receives mUid.
   **
   ** Returns:         None
   **
   *******************************************************************************/
-  void fillNativeNfcTagMembers4(JNIEnv* e, jclass tag_cls, jobject tag,
-                                tNFA_ACTIVATED& activationData);
+  void fillNativeNfcTagMembers5(JNIEnv* e, tNFA_ACTIVATED& activationData,
+                                ScopedLocalRef<jbyteArray>* uid);
 
   /*******************************************************************************
   **
-  ** Function:        fillNativeNfcTagMembers5
+  ** Function:        setTechBytes
   **
-  ** Description:     Fill NativeNfcTag's members: mUid.
-  **                  The original Google's implementation is in
-  *nfc_jni_Discovery_notification_callback()
-  **                  in com_android_nfc_NativeNfcManager.cpp;
+  ** Description:     Keep the poll or activation bytes of one technology in
+  **                  the arena of the current activation.
+  **                  kind: poll or activation bytes.
+  **                  index: index of the technology.
+  **                  data: bytes; may be NULL if len is 0.
+  **                  len: number of bytes.
+  **
+  ** Returns:         None
+  **
+  *******************************************************************************/
+  void setTechBytes(TechBytesArena::Kind kind, int index, const uint8_t* data,
+                    size_t len);
+
+  /*******************************************************************************
+  **
+  ** Function:        makeTechBytesArray
+  **
+  ** Description:     Make the Java array of poll or activation bytes of all
+  **                  technologies from the arena; small byte arrays are
+  **                  shared between tags.
   **                  e: JVM environment.
-  **                  tag_cls: Java NativeNfcTag class.
-  **                  tag: Java NativeNfcTag object.
-  **                  activationData: data from activation.
+  **                  kind: poll or activation bytes.
+  **                  array: receives the array.
   **
   ** Returns:         None
   **
   *******************************************************************************/
-  void fillNativeNfcTagMembers5(JNIEnv* e, jclass tag_cls, jobject tag,
-                                tNFA_ACTIVATED& activationData);
+  void makeTechBytesArray(JNIEnv* e, TechBytesArena::Kind kind,
+                          ScopedLocalRef<jobjectArray>* array);
 
   /*******************************************************************************
   **
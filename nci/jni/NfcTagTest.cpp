@@ -18,6 +18,19 @@ class NfcTagTest : public ::testing::Test {
   void setNfcStatsUtil(NfcStatsUtil* nfcStatsUtil) {
     mNfcTag.mNfcStatsUtil = nfcStatsUtil;
   }
+
+  void setPollAUid(uint8_t first, uint8_t last) {
+    mNfcTag.mTechParams[0].mode = NFC_DISCOVERY_TYPE_POLL_A;
+    mNfcTag.mTechParams[0].param.pa.nfcid1_len = 7;
+    memset(mNfcTag.mTechParams[0].param.pa.nfcid1, 0,
+           sizeof(mNfcTag.mTechParams[0].param.pa.nfcid1));
+    mNfcTag.mTechParams[0].param.pa.nfcid1[0] = first;
+    mNfcTag.mTechParams[0].param.pa.nfcid1[6] = last;
+  }
+
+  void setUidLength(uint8_t len) {
+    mNfcTag.mTechParams[0].param.pa.nfcid1_len = len;
+  }
 };
 
 TEST_F(NfcTagTest, NfcTagTypeOccurredType5) {
@@ -43,3 +56,65 @@ TEST_F(NfcTagTest, NfcTagTypeOccurredType5) {
 
   delete mockUtil;
 }
+
+TEST_F(NfcTagTest, AdaptiveTransceiveTimeout) {
+  const uint8_t select[] = {0x00, 0xA4, 0x04, 0x00};
+  const uint8_t readBinary[] = {0x00, 0xB0, 0x00, 0x00};
+  mNfcTag.resetAllTransceiveTimeouts();
+  mNfcTag.setAdaptiveTransceiveTimeout(true);
+  for (int i = 0; i < 10; i++) {
+    mNfcTag.recordTransceive(TARGET_TYPE_ISO14443_4, select, sizeof(select),
+                             3000, true);
+  }
+
+  // commands of the same class get a tight timeout; others keep the default
+  EXPECT_LT(mNfcTag.getTransceiveTimeout(TARGET_TYPE_ISO14443_4, select,
+                                         sizeof(select)),
+            100);
+  EXPECT_EQ(mNfcTag.getTransceiveTimeout(TARGET_TYPE_ISO14443_4, readBinary,
+                                         sizeof(readBinary)),
+            618);
+
+  // a timeout chosen by the application is used as is
+  mNfcTag.setTransceiveTimeout(TARGET_TYPE_ISO14443_4, 2000, true);
+  EXPECT_EQ(mNfcTag.getTransceiveTimeout(TARGET_TYPE_ISO14443_4, select,
+                                         sizeof(select)),
+            2000);
+}
+
+TEST_F(NfcTagTest, LearnedPresenceCheck) {
+  tNFA_RW_PRES_CHK_OPTION method = NFA_RW_PRES_CHK_DEFAULT;
+  setPollAUid(0x04, 0x01);
+  EXPECT_FALSE(mNfcTag.getLearnedPresenceCheck(NFC_PROTOCOL_ISO_DEP, &method));
+  mNfcTag.setLearnedPresenceCheck(NFC_PROTOCOL_ISO_DEP,
+                                  NFA_RW_PRES_CHK_I_BLOCK);
+  EXPECT_TRUE(mNfcTag.getLearnedPresenceCheck(NFC_PROTOCOL_ISO_DEP, &method));
+  EXPECT_EQ(method, NFA_RW_PRES_CHK_I_BLOCK);
+
+  // another tag, or the same tag on another protocol, is probed again
+  EXPECT_FALSE(mNfcTag.getLearnedPresenceCheck(NFC_PROTOCOL_T2T, &method));
+  setPollAUid(0x04, 0x02);
+  EXPECT_FALSE(mNfcTag.getLearnedPresenceCheck(NFC_PROTOCOL_ISO_DEP, &method));
+
+  // a random ID is never remembered
+  setPollAUid(0x08, 0x03);
+  setUidLength(4);
+  mNfcTag.setLearnedPresenceCheck(NFC_PROTOCOL_ISO_DEP,
+                                  NFA_RW_PRES_CHK_I_BLOCK);
+  EXPECT_FALSE(mNfcTag.getLearnedPresenceCheck(NFC_PROTOCOL_ISO_DEP, &method));
+}
+
+TEST_F(NfcTagTest, LearnedHaltSequence) {
+  NfcTag::HaltSequence sequence = NfcTag::HaltWaitReport;
+  setPollAUid(0x04, 0x11);
+  EXPECT_FALSE(mNfcTag.getLearnedHaltSequence(NFC_PROTOCOL_T2T, &sequence));
+  mNfcTag.setLearnedHaltSequence(NFC_PROTOCOL_T2T, NfcTag::HaltGuardTime);
+  EXPECT_TRUE(mNfcTag.getLearnedHaltSequence(NFC_PROTOCOL_T2T, &sequence));
+  EXPECT_EQ(sequence, NfcTag::HaltGuardTime);
+
+  // kept apart from the presence-check method of the same tag
+  tNFA_RW_PRES_CHK_OPTION method = NFA_RW_PRES_CHK_DEFAULT;
+  EXPECT_FALSE(mNfcTag.getLearnedPresenceCheck(NFC_PROTOCOL_T2T, &method));
+  setPollAUid(0x04, 0x12);
+  EXPECT_FALSE(mNfcTag.getLearnedHaltSequence(NFC_PROTOCOL_T2T, &sequence));
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Time spent in a named phase of a tag operation.
+ */
+
+#include "PhaseStats.h"
+
+#include <stdio.h>
+#include <time.h>
+
+std::atomic<PhaseStats*> PhaseStats::sPhases(NULL);
+
+/*******************************************************************************
+**
+** Function:        PhaseStats
+**
+** Description:     Initialize member variables and add the phase to the
+**                  list reported by dumpAll().
+**
+** Returns:         None.
+**
+*******************************************************************************/
+PhaseStats::PhaseStats(const char* name)
+    : mName(name), mNext(NULL), mCount(0), mLastUs(0), mTotalNs(0), mMaxNs(0) {
+  mNext = sPhases.load(std::memory_order_relaxed);
+  while (!sPhases.compare_exchange_weak(mNext, this, std::memory_order_release,
+                                        std::memory_order_relaxed)) {
+  }
+}
+
+/*******************************************************************************
+**
+** Function:        nowNs
+**
+** Description:     Read the monotonic clock.
+**
+** Returns:         Time in nanoseconds.
+**
+*******************************************************************************/
+uint64_t PhaseStats::nowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*******************************************************************************
+**
+** Function:        record
+**
+** Description:     Add one run of the phase.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void PhaseStats::record(uint64_t durationNs) {
+  mCount.fetch_add(1, std::memory_order_relaxed);
+  mLastUs.store((uint32_t)(durationNs / 1000), std::memory_order_relaxed);
+  mTotalNs.fetch_add(durationNs, std::memory_order_relaxed);
+  uint64_t maxNs = mMaxNs.load(std::memory_order_relaxed);
+  while ((durationNs > maxNs) &&
+         !mMaxNs.compare_exchange_weak(maxNs, durationNs,
+                                       std::memory_order_relaxed)) {
+  }
+}
+
+/*******************************************************************************
+**
+** Function:        dumpAll
+**
+** Description:     Write the count, average and longest duration of all
+**                  phases that have run.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void PhaseStats::dumpAll(int fd) {
+  dprintf(fd, "Tag operation phases (us):\n");
+  for (PhaseStats* phase = sPhases.load(std::memory_order_acquire); phase;
+       phase = phase->mNext) {
+    uint32_t count = phase->mCount.load(std::memory_order_relaxed);
+    if (count == 0) continue;
+    uint64_t totalNs = phase->mTotalNs.load(std::memory_order_relaxed);
+    dprintf(fd, "  %s: count=%u avg=%llu max=%llu last=%u\n", phase->mName,
+            count, (unsigned long long)(totalNs / count / 1000),
+            (unsigned long long)(phase->mMaxNs.load(std::memory_order_relaxed) /
+                                 1000),
+            phase->mLastUs.load(std::memory_order_relaxed));
+  }
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Time spent in a named phase of a tag operation.
+ */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+class PhaseStats {
+ public:
+  /*******************************************************************************
+  **
+  ** Function:        PhaseStats
+  **
+  ** Description:     Initialize member variables and add the phase to the
+  **                  list reported by dumpAll().  A phase must live until
+  **                  the process exits.
+  **                  name: name of the phase.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  explicit PhaseStats(const char* name);
+
+  /*******************************************************************************
+  **
+  ** Function:        record
+  **
+  ** Description:     Add one run of the phase.
+  **                  durationNs: time the run took.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void record(uint64_t durationNs);
+
+  /*******************************************************************************
+  **
+  ** Function:        lastUs
+  **
+  ** Description:     Get the duration of the latest run.
+  **
+  ** Returns:         Duration in microseconds; 0 before the first run.
+  **
+  *******************************************************************************/
+  uint32_t lastUs() const { return mLastUs.load(std::memory_order_relaxed); }
+
+  /*******************************************************************************
+  **
+  ** Function:        nowNs
+  **
+  ** Description:     Read the monotonic clock.
+  **
+  ** Returns:         Time in nanoseconds.
+  **
+  *******************************************************************************/
+  static uint64_t nowNs();
+
+  /*******************************************************************************
+  **
+  ** Function:        dumpAll
+  **
+  ** Description:     Write the count, average and longest duration of all
+  **                  phases that have run.
+  **                  fd: file descriptor.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  static void dumpAll(int fd);
+
+  /*****************************************************************************
+  **
+  **  Name:           Scope
+  **
+  **  Description:    Record the time from construction to destruction, and
+  **                  optionally also return it in microseconds.
+  **
+  *****************************************************************************/
+  class Scope {
+   public:
+    explicit Scope(PhaseStats& phase, uint32_t* elapsedUs = NULL)
+        : mPhase(phase), mElapsedUs(elapsedUs), mStartNs(nowNs()) {}
+    ~Scope() {
+      uint64_t const durationNs = nowNs() - mStartNs;
+      mPhase.record(durationNs);
+      if (mElapsedUs) *mElapsedUs = (uint32_t)(durationNs / 1000);
+    }
+
+   private:
+    PhaseStats& mPhase;
+    uint32_t* const mElapsedUs;
+    uint64_t const mStartNs;
+  };
+
+ private:
+  const char* mName;
+  PhaseStats* mNext;  // next phase in the list
+  std::atomic<uint32_t> mCount;
+  std::atomic<uint32_t> mLastUs;
+  std::atomic<uint64_t> mTotalNs;
+  std::atomic<uint64_t> mMaxNs;
+
+  static std::atomic<PhaseStats*> sPhases;
+};
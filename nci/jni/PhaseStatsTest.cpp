@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+
+#include <string>
+
+#include "PhaseStats.h"
+
+// Test a phase reports its runs and a phase that never ran is left out
+TEST(PhaseStatsTest, DumpAll) {
+  static PhaseStats phase("PhaseStatsTest.phase");
+  static PhaseStats idle("PhaseStatsTest.idle");
+  phase.record(2000000);
+  phase.record(4000000);
+  ASSERT_EQ(phase.lastUs(), 4000u);
+  uint32_t elapsedUs = UINT32_MAX;
+  {
+    PhaseStats::Scope scope(phase, &elapsedUs);
+  }
+  ASSERT_EQ(elapsedUs, phase.lastUs());
+
+  FILE* file = tmpfile();
+  ASSERT_NE(file, nullptr);
+  PhaseStats::dumpAll(fileno(file));
+  rewind(file);
+  char line[256];
+  std::string dump;
+  while (fgets(line, sizeof(line), file)) dump += line;
+  fclose(file);
+
+  ASSERT_NE(dump.find("PhaseStatsTest.phase: count=3 "), std::string::npos)
+      << dump;
+  ASSERT_NE(dump.find("max=4000 "), std::string::npos) << dump;
+  ASSERT_EQ(dump.find("PhaseStatsTest.idle"), std::string::npos) << dump;
+}
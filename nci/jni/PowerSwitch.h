@@ -241,9 +241,9 @@ class PowerSwitch {
   static PowerSwitch sPowerSwitch;  // singleton object
   static const uint8_t NFA_DM_PWR_STATE_UNKNOWN =
       -1;  // device management power state power state is unknown
-  SyncEvent mPowerStateEvent;
+  SyncEvent mPowerStateEvent{"PowerSwitch::mPowerStateEvent"};
   PowerActivity mCurrActivity;
-  Mutex mMutex;
+  Mutex mMutex{"PowerSwitch::mMutex"};
 
   /*******************************************************************************
   **
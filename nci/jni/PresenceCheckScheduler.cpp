@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Adapt the presence-check interval of a tag to how it behaves.
+ */
+
+#include "PresenceCheckScheduler.h"
+
+/*******************************************************************************
+**
+** Function:        PresenceCheckScheduler
+**
+** Description:     Initialize member variables.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+PresenceCheckScheduler::PresenceCheckScheduler() { reset(); }
+
+/*******************************************************************************
+**
+** Function:        reset
+**
+** Description:     Start over for a newly activated tag.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void PresenceCheckScheduler::reset() {
+  mCleanChecks = 0;
+  mBackoff = 1;
+  mIntervalMs = 0;
+  mActivityNs = 0;
+}
+
+/*******************************************************************************
+**
+** Function:        recordActivity
+**
+** Description:     Record that the tag answered a command.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void PresenceCheckScheduler::recordActivity(uint64_t nowNs) {
+  mActivityNs = nowNs;
+}
+
+/*******************************************************************************
+**
+** Function:        recordCheck
+**
+** Description:     Record the outcome of a presence check.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void PresenceCheckScheduler::recordCheck(bool present, bool retried) {
+  if (!present || retried) {
+    // check a flaky tag more often, to notice its removal sooner
+    mCleanChecks = 0;
+    mBackoff = 0;
+    return;
+  }
+  if (++mCleanChecks < kStableChecks) return;
+  mCleanChecks = 0;
+  if (mBackoff == 0)
+    mBackoff = 1;
+  else if (mBackoff < kMaxBackoff)
+    mBackoff *= 2;
+}
+
+/*******************************************************************************
+**
+** Function:        shouldSkip
+**
+** Description:     Whether the tag answered a command within the current
+**                  interval.
+**
+** Returns:         True if the check can be skipped.
+**
+*******************************************************************************/
+bool PresenceCheckScheduler::shouldSkip(uint64_t nowNs) const {
+  if ((mIntervalMs == 0) || (mActivityNs == 0) || (nowNs < mActivityNs))
+    return false;
+  return (nowNs - mActivityNs) < (uint64_t)mIntervalMs * 1000000;
+}
+
+/*******************************************************************************
+**
+** Function:        nextIntervalMs
+**
+** Description:     Interval until the next presence check.
+**
+** Returns:         Interval in milliseconds.
+**
+*******************************************************************************/
+int PresenceCheckScheduler::nextIntervalMs(int baseMs) {
+  mIntervalMs = (mBackoff == 0) ? (baseMs / 2) : (baseMs * mBackoff);
+  if (mIntervalMs < 1) mIntervalMs = 1;
+  return mIntervalMs;
+}
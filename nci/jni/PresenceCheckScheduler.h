@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Adapt the presence-check interval of a tag to how it behaves.
+ */
+
+#pragma once
+#include <stdint.h>
+
+class PresenceCheckScheduler {
+ public:
+  // clean checks in a row before the interval grows
+  static constexpr int kStableChecks = 4;
+  // largest interval, as a multiple of the base interval
+  static constexpr int kMaxBackoff = 4;
+
+  /*******************************************************************************
+  **
+  ** Function:        PresenceCheckScheduler
+  **
+  ** Description:     Initialize member variables.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  PresenceCheckScheduler();
+
+  /*******************************************************************************
+  **
+  ** Function:        reset
+  **
+  ** Description:     Start over for a newly activated tag.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void reset();
+
+  /*******************************************************************************
+  **
+  ** Function:        recordActivity
+  **
+  ** Description:     Record that the tag answered a command, which proves
+  **                  it present as well as a presence check would.
+  **                  nowNs: current monotonic time.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void recordActivity(uint64_t nowNs);
+
+  /*******************************************************************************
+  **
+  ** Function:        recordCheck
+  **
+  ** Description:     Record the outcome of a presence check.
+  **                  present: whether the tag was found.
+  **                  retried: whether the check needed retries or another
+  **                  method.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void recordCheck(bool present, bool retried);
+
+  /*******************************************************************************
+  **
+  ** Function:        shouldSkip
+  **
+  ** Description:     Whether the tag answered a command within the current
+  **                  interval, so that a presence check is not needed.
+  **                  nowNs: current monotonic time.
+  **
+  ** Returns:         True if the check can be skipped.
+  **
+  *******************************************************************************/
+  bool shouldSkip(uint64_t nowNs) const;
+
+  /*******************************************************************************
+  **
+  ** Function:        nextIntervalMs
+  **
+  ** Description:     Interval until the next presence check: longer for a
+  **                  tag that answered the last checks cleanly, shorter
+  **                  after a check needed retries.
+  **                  baseMs: interval configured by the NFC service.
+  **
+  ** Returns:         Interval in milliseconds.
+  **
+  *******************************************************************************/
+  int nextIntervalMs(int baseMs);
+
+ private:
+  int mCleanChecks;      // clean checks in a row
+  int mBackoff;          // 0: half the base; n > 0: n times the base
+  int mIntervalMs;       // last interval handed out; 0 before the first
+  uint64_t mActivityNs;  // last time the tag answered a command
+};
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include "PresenceCheckScheduler.h"
+
+// Test the interval grows on a stable tag, up to its bound
+TEST(PresenceCheckSchedulerTest, BacksOffOnStableTag) {
+  PresenceCheckScheduler scheduler;
+  ASSERT_EQ(scheduler.nextIntervalMs(1000), 1000);
+  for (int i = 0; i < PresenceCheckScheduler::kStableChecks; i++)
+    scheduler.recordCheck(true, false);
+  ASSERT_EQ(scheduler.nextIntervalMs(1000), 2000);
+  for (int i = 0; i < 10 * PresenceCheckScheduler::kStableChecks; i++)
+    scheduler.recordCheck(true, false);
+  ASSERT_EQ(scheduler.nextIntervalMs(1000),
+            1000 * PresenceCheckScheduler::kMaxBackoff);
+}
+
+// Test a check that needed retries tightens the interval
+TEST(PresenceCheckSchedulerTest, TightensAfterErrors) {
+  PresenceCheckScheduler scheduler;
+  for (int i = 0; i < PresenceCheckScheduler::kStableChecks; i++)
+    scheduler.recordCheck(true, false);
+  scheduler.recordCheck(true, true);
+  ASSERT_EQ(scheduler.nextIntervalMs(1000), 500);
+  for (int i = 0; i < PresenceCheckScheduler::kStableChecks; i++)
+    scheduler.recordCheck(true, false);
+  ASSERT_EQ(scheduler.nextIntervalMs(1000), 1000);
+}
+
+// Test a check is skipped only while a recent answer is within the interval
+TEST(PresenceCheckSchedulerTest, SkipsAfterActivity) {
+  const uint64_t ms = 1000000;
+  PresenceCheckScheduler scheduler;
+  scheduler.recordActivity(100 * ms);
+  // no interval handed out yet
+  ASSERT_FALSE(scheduler.shouldSkip(150 * ms));
+  scheduler.nextIntervalMs(1000);
+  ASSERT_TRUE(scheduler.shouldSkip(150 * ms));
+  ASSERT_FALSE(scheduler.shouldSkip(1200 * ms));
+  scheduler.reset();
+  ASSERT_FALSE(scheduler.shouldSkip(150 * ms));
+}
@@ -60,7 +60,7 @@ class RoutingManager {
   static const int CLEAR_AID_ENTRIES = 0x01;
   static const int CLEAR_PROTOCOL_ENTRIES = 0x02;
   static const int CLEAR_TECHNOLOGY_ENTRIES = 0x04;
-  SyncEvent mEeUpdateEvent;
+  SyncEvent mEeUpdateEvent{"RoutingManager::mEeUpdateEvent"};
 
  private:
   RoutingManager();
@@ -137,10 +137,10 @@ class RoutingManager {
   tNFA_EE_DISCOVER_REQ mEeInfo;
   tNFA_TECHNOLOGY_MASK mSeTechMask;
   static const JNINativeMethod sMethods[];
-  SyncEvent mEeRegisterEvent;
-  SyncEvent mRoutingEvent;
-  SyncEvent mEeInfoEvent;
-  SyncEvent mEeSetModeEvent;
-  SyncEvent mEePwrAndLinkCtrlEvent;
-  SyncEvent mAidAddRemoveEvent;
+  SyncEvent mEeRegisterEvent{"RoutingManager::mEeRegisterEvent"};
+  SyncEvent mRoutingEvent{"RoutingManager::mRoutingEvent"};
+  SyncEvent mEeInfoEvent{"RoutingManager::mEeInfoEvent"};
+  SyncEvent mEeSetModeEvent{"RoutingManager::mEeSetModeEvent"};
+  SyncEvent mEePwrAndLinkCtrlEvent{"RoutingManager::mEePwrAndLinkCtrlEvent"};
+  SyncEvent mAidAddRemoveEvent{"RoutingManager::mAidAddRemoveEvent"};
 };
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Wait statistics of named synchronization events.
+ */
+
+#include "SyncEvent.h"
+
+#include <stdio.h>
+#include <time.h>
+
+std::atomic<SyncEvent*> SyncEvent::sNamedEvents(NULL);
+
+/*******************************************************************************
+**
+** Function:        SyncEvent
+**
+** Description:     Initialize member variables; add a named event to the
+**                  list reported by dumpAll().
+**
+** Returns:         None.
+**
+*******************************************************************************/
+SyncEvent::SyncEvent(const char* name)
+    : mName(name),
+      mNext(NULL),
+      mWaiting(0),
+      mTimeouts(0),
+      mNotifyNoWaiter(0),
+      mMaxWaitNs(0) {
+  for (int i = 0; i < kWaitBuckets; i++) mWaitHistogram[i] = 0;
+  if (mName == NULL) return;
+
+  mNext = sNamedEvents.load(std::memory_order_relaxed);
+  while (!sNamedEvents.compare_exchange_weak(mNext, this,
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed)) {
+  }
+}
+
+/*******************************************************************************
+**
+** Function:        nowNs
+**
+** Description:     Read the monotonic clock.
+**
+** Returns:         Time in nanoseconds.
+**
+*******************************************************************************/
+uint64_t SyncEvent::nowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*******************************************************************************
+**
+** Function:        recordWait
+**
+** Description:     Add a completed wait to the statistics.
+**                  startNs: time the wait began.
+**                  success: false if the wait timed out.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void SyncEvent::recordWait(uint64_t startNs, bool success) {
+  uint64_t waitNs = nowNs() - startNs;
+  uint64_t waitMs = waitNs / 1000000;
+  int bucket = 0;
+  while ((waitMs > 0) && (bucket < kWaitBuckets - 1)) {
+    waitMs >>= 1;
+    bucket++;
+  }
+  mWaitHistogram[bucket].fetch_add(1, std::memory_order_relaxed);
+  if (!success) mTimeouts.fetch_add(1, std::memory_order_relaxed);
+
+  uint64_t maxNs = mMaxWaitNs.load(std::memory_order_relaxed);
+  while ((waitNs > maxNs) &&
+         !mMaxWaitNs.compare_exchange_weak(maxNs, waitNs,
+                                           std::memory_order_relaxed)) {
+  }
+}
+
+/*******************************************************************************
+**
+** Function:        dumpAll
+**
+** Description:     Write the wait statistics of all named events that have
+**                  been used.
+**                  fd: file descriptor.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void SyncEvent::dumpAll(int fd) {
+  dprintf(fd, "SyncEvent waits (ms histogram buckets: <1 1 2 4 8 ...):\n");
+  for (SyncEvent* event = sNamedEvents.load(std::memory_order_acquire); event;
+       event = event->mNext) {
+    uint32_t waits = 0;
+    char histogram[kWaitBuckets * 12] = {0};
+    int len = 0;
+    for (int i = 0; i < kWaitBuckets; i++) {
+      uint32_t count = event->mWaitHistogram[i].load(std::memory_order_relaxed);
+      waits += count;
+      len += snprintf(histogram + len, sizeof(histogram) - len, " %u", count);
+    }
+    uint32_t noWaiter =
+        event->mNotifyNoWaiter.load(std::memory_order_relaxed);
+    if ((waits == 0) && (noWaiter == 0)) continue;
+
+    dprintf(fd,
+            "  %s: waits=%u timeouts=%u notifyNoWaiter=%u maxMs=%llu "
+            "hist=[%s ]\n",
+            event->mName, waits,
+            event->mTimeouts.load(std::memory_order_relaxed), noWaiter,
+            (unsigned long long)(event->mMaxWaitNs.load(
+                                     std::memory_order_relaxed) /
+                                 1000000),
+            histogram);
+  }
+}
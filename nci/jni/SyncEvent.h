@@ -18,11 +18,30 @@
  *  Synchronize two or more threads using a condition variable and a mutex.
  */
 #pragma once
+#include <stdint.h>
+
+#include <atomic>
+
 #include "CondVar.h"
+#include "Deadline.h"
 #include "Mutex.h"
 
 class SyncEvent {
  public:
+  /*******************************************************************************
+  **
+  ** Function:        SyncEvent
+  **
+  ** Description:     Initialize member variables.
+  **                  name: if not NULL, the event records wait statistics
+  **                  and is listed by dumpAll().  A named event must live
+  **                  until the process exits.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  explicit SyncEvent(const char* name = NULL);
+
   /*******************************************************************************
   **
   ** Function:        ~SyncEvent
@@ -54,7 +73,11 @@ class SyncEvent {
   ** Returns:         None.
   **
   *******************************************************************************/
-  void wait() { mCondVar.wait(mMutex); }
+  void wait() {
+    uint64_t startNs = waitBegin();
+    mCondVar.wait(mMutex);
+    waitEnd(startNs, true);
+  }
 
   /*******************************************************************************
   **
@@ -67,7 +90,26 @@ class SyncEvent {
   **
   *******************************************************************************/
   bool wait(long millisec) {
+    uint64_t startNs = waitBegin();
     bool retVal = mCondVar.wait(mMutex, millisec);
+    waitEnd(startNs, retVal);
+    return retVal;
+  }
+
+  /*******************************************************************************
+  **
+  ** Function:        wait
+  **
+  ** Description:     Block the thread and wait for the event to occur.
+  **                  deadline: Time by which to give up.
+  **
+  ** Returns:         True if wait is successful; false if timeout occurs.
+  **
+  *******************************************************************************/
+  bool wait(const Deadline& deadline) {
+    uint64_t startNs = waitBegin();
+    bool retVal = mCondVar.wait(mMutex, deadline);
+    waitEnd(startNs, retVal);
     return retVal;
   }
 
@@ -81,7 +123,10 @@ class SyncEvent {
   ** Returns:         None.
   **
   *******************************************************************************/
-  void notifyOne() { mCondVar.notifyOne(); }
+  void notifyOne() {
+    notified();
+    mCondVar.notifyOne();
+  }
 
   /*******************************************************************************
   **
@@ -94,9 +139,182 @@ class SyncEvent {
   *******************************************************************************/
   void end() { mMutex.unlock(); }
 
- private:
+  /*******************************************************************************
+  **
+  ** Function:        dumpAll
+  **
+  ** Description:     Write the wait statistics of all named events.
+  **                  fd: file descriptor.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  static void dumpAll(int fd);
+
+ protected:
+  /*******************************************************************************
+  **
+  ** Function:        waitBegin / waitEnd
+  **
+  ** Description:     Bracket a wait so that named events can record its
+  **                  duration and whether it timed out.
+  **
+  ** Returns:         waitBegin returns the start time for waitEnd.
+  **
+  *******************************************************************************/
+  uint64_t waitBegin() {
+    mWaiting.fetch_add(1, std::memory_order_relaxed);
+    return mName ? nowNs() : 0;
+  }
+  void waitEnd(uint64_t startNs, bool success) {
+    mWaiting.fetch_sub(1, std::memory_order_relaxed);
+    if (mName) recordWait(startNs, success);
+  }
+
+  /*******************************************************************************
+  **
+  ** Function:        notified
+  **
+  ** Description:     Count a notification that no thread was waiting for.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void notified() {
+    if (mName && (mWaiting.load(std::memory_order_relaxed) == 0))
+      mNotifyNoWaiter.fetch_add(1, std::memory_order_relaxed);
+  }
+
   CondVar mCondVar;
   Mutex mMutex;
+
+ private:
+  // bucket 0 counts waits under 1 ms, bucket n waits of [2^(n-1), 2^n) ms
+  static const int kWaitBuckets = 14;
+
+  static uint64_t nowNs();
+  void recordWait(uint64_t startNs, bool success);
+
+  const char* mName;
+  SyncEvent* mNext;  // next named event
+  std::atomic<int> mWaiting;
+  std::atomic<uint32_t> mTimeouts;
+  std::atomic<uint32_t> mNotifyNoWaiter;
+  std::atomic<uint64_t> mMaxWaitNs;
+  std::atomic<uint32_t> mWaitHistogram[kWaitBuckets];
+
+  static std::atomic<SyncEvent*> sNamedEvents;
+};
+
+/*****************************************************************************
+**
+**  Name:           LatchedSyncEvent
+**
+**  Description:    SyncEvent that remembers a notification posted while no
+**                  thread was waiting.  Each notification bumps a generation
+**                  counter; wait() returns as soon as the generation differs
+**                  from the one the waiter last consumed, so a callback that
+**                  fires before the caller reaches wait() no longer costs the
+**                  whole timeout.  Call reset() with the event started and
+**                  before issuing the command, to drop stale notifications
+**                  left over from a previous operation.
+**
+*****************************************************************************/
+class LatchedSyncEvent : public SyncEvent {
+ public:
+  explicit LatchedSyncEvent(const char* name = NULL)
+      : SyncEvent(name), mPosted(0), mConsumed(0) {}
+
+  /*******************************************************************************
+  **
+  ** Function:        reset
+  **
+  ** Description:     Discard notifications not yet consumed by wait().
+  **                  The caller must have started the event.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void reset() { mConsumed = mPosted; }
+
+  /*******************************************************************************
+  **
+  ** Function:        wait
+  **
+  ** Description:     Block the thread until the event has occurred, unless a
+  **                  notification is already pending.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void wait() {
+    uint64_t startNs = waitBegin();
+    while (mPosted == mConsumed) mCondVar.wait(mMutex);
+    mConsumed = mPosted;
+    waitEnd(startNs, true);
+  }
+
+  /*******************************************************************************
+  **
+  ** Function:        wait
+  **
+  ** Description:     Block the thread until the event has occurred, unless a
+  **                  notification is already pending.
+  **                  millisec: Timeout in milliseconds; a negative timeout
+  **                  has already expired.
+  **
+  ** Returns:         True if the event occurred; false if timeout occurs.
+  **
+  *******************************************************************************/
+  bool wait(long millisec) {
+    return wait(Deadline::fromNow((millisec < 0) ? 0 : millisec));
+  }
+
+  /*******************************************************************************
+  **
+  ** Function:        wait
+  **
+  ** Description:     Block the thread until the event has occurred, unless a
+  **                  notification is already pending.
+  **                  deadline: Time by which to give up.
+  **
+  ** Returns:         True if the event occurred; false if timeout occurs.
+  **
+  *******************************************************************************/
+  bool wait(const Deadline& deadline) {
+    uint64_t startNs = waitBegin();
+    // loop over spurious wakeups until the deadline
+    while (mPosted == mConsumed) {
+      if (!mCondVar.wait(mMutex, deadline) && (mPosted == mConsumed)) {
+        waitEnd(startNs, false);
+        return false;
+      }
+    }
+    mConsumed = mPosted;
+    waitEnd(startNs, true);
+    return true;
+  }
+
+  /*******************************************************************************
+  **
+  ** Function:        notifyOne
+  **
+  ** Description:     Record that the event has occurred and unblock the
+  **                  waiting thread, if any.  The caller must have started
+  **                  the event.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void notifyOne() {
+    notified();
+    mPosted++;
+    mCondVar.notifyOne();
+  }
+
+ private:
+  uint32_t mPosted;    // generation of the latest notification
+  uint32_t mConsumed;  // generation last returned by wait() or reset()
 };
 
 /*****************************************************************************/
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "SyncEvent.h"
+
+class LatchedSyncEventTest : public ::testing::Test {
+ protected:
+  LatchedSyncEvent event;
+};
+
+// Test a notification posted before wait() is not lost
+TEST_F(LatchedSyncEventTest, NotifyBeforeWait) {
+  {
+    SyncEventGuard guard(event);
+    event.notifyOne();
+  }
+  SyncEventGuard guard(event);
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_TRUE(event.wait(2000));
+  ASSERT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(100));
+  // the notification is consumed by the first wait
+  ASSERT_FALSE(event.wait(10));
+}
+
+// Test reset() discards a stale notification
+TEST_F(LatchedSyncEventTest, ResetDropsStaleNotification) {
+  {
+    SyncEventGuard guard(event);
+    event.notifyOne();
+  }
+  SyncEventGuard guard(event);
+  event.reset();
+  ASSERT_FALSE(event.wait(20));
+}
+
+// Test wait() times out after roughly the requested time
+TEST_F(LatchedSyncEventTest, Timeout) {
+  SyncEventGuard guard(event);
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_FALSE(event.wait(50));
+  ASSERT_GE(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(45));
+}
+
+// Test a notification from another thread unblocks the waiter
+TEST_F(LatchedSyncEventTest, NotifyFromOtherThread) {
+  SyncEventGuard guard(event);
+  event.reset();
+  std::thread notifier([this]() {
+    SyncEventGuard guard(event);
+    event.notifyOne();
+  });
+  ASSERT_TRUE(event.wait(2000));
+  notifier.join();
+}
+
+// Test a named event reports its waits, timeouts and early notifications
+TEST(SyncEventStatsTest, DumpNamedEvent) {
+  static SyncEvent event("SyncEventStatsTest.event");
+  {
+    SyncEventGuard guard(event);
+    event.notifyOne();  // nobody is waiting
+    ASSERT_FALSE(event.wait(1));
+  }
+
+  FILE* file = tmpfile();
+  ASSERT_NE(file, nullptr);
+  SyncEvent::dumpAll(fileno(file));
+  rewind(file);
+  char line[256];
+  std::string dump;
+  while (fgets(line, sizeof(line), file)) dump += line;
+  fclose(file);
+
+  ASSERT_NE(dump.find("SyncEventStatsTest.event: waits=1 timeouts=1 "
+                      "notifyNoWaiter=1"),
+            std::string::npos)
+      << dump;
+}
+
+// Test a negative timeout has expired instead of waiting forever
+TEST_F(LatchedSyncEventTest, NegativeTimeoutExpired) {
+  SyncEventGuard guard(event);
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_FALSE(event.wait(-1L));
+  ASSERT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(1000));
+}
+
+// Test successive waits share one deadline
+TEST_F(LatchedSyncEventTest, SharedDeadline) {
+  Deadline deadline = Deadline::fromNow(60);
+  SyncEventGuard guard(event);
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_FALSE(event.wait(deadline));
+  ASSERT_FALSE(event.wait(deadline));
+  ASSERT_TRUE(deadline.expired());
+  ASSERT_EQ(deadline.remainingMs(), 0);
+  ASSERT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(1000));
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Per-activation scratch space for the poll and activation bytes of a tag.
+ */
+
+#include "TechBytesArena.h"
+
+#include <string.h>
+
+/*******************************************************************************
+**
+** Function:        TechBytesArena
+**
+** Description:     Initialize member variables.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+TechBytesArena::TechBytesArena() { reset(); }
+
+/*******************************************************************************
+**
+** Function:        reset
+**
+** Description:     Forget all entries.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void TechBytesArena::reset() {
+  mUsed = 0;
+  memset(mSpans, 0, sizeof(mSpans));
+}
+
+/*******************************************************************************
+**
+** Function:        set
+**
+** Description:     Keep the bytes of one technology.
+**
+** Returns:         False if the index is out of range or the arena is full.
+**
+*******************************************************************************/
+bool TechBytesArena::set(Kind kind, size_t index, const uint8_t* data,
+                         size_t len) {
+  if ((kind >= kNumKinds) || (index >= kMaxEntries)) return false;
+  Span& span = mSpans[kind][index];
+  if (!span.valid || (len > span.len)) {
+    if (len > kCapacity - mUsed) return false;
+    span.offset = mUsed;
+    mUsed += len;
+  }
+  if (len > 0) memcpy(mBytes + span.offset, data, len);
+  span.len = len;
+  span.valid = true;
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        get
+**
+** Description:     Get the bytes of one technology.
+**
+** Returns:         The bytes; NULL if the entry was never set.
+**
+*******************************************************************************/
+const uint8_t* TechBytesArena::get(Kind kind, size_t index,
+                                   size_t* len) const {
+  if ((kind >= kNumKinds) || (index >= kMaxEntries)) return NULL;
+  const Span& span = mSpans[kind][index];
+  if (!span.valid) return NULL;
+  *len = span.len;
+  return mBytes + span.offset;
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Per-activation scratch space for the poll and activation bytes of a tag.
+ */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+class TechBytesArena {
+ public:
+  enum Kind { Poll, Activation, kNumKinds };
+  static constexpr size_t kMaxEntries = 16;  // technologies per kind
+  static constexpr size_t kCapacity = 2048;  // bytes of all entries
+
+  /*******************************************************************************
+  **
+  ** Function:        TechBytesArena
+  **
+  ** Description:     Initialize member variables.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  TechBytesArena();
+
+  /*******************************************************************************
+  **
+  ** Function:        reset
+  **
+  ** Description:     Forget all entries, e.g. when a new tag is discovered.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void reset();
+
+  /*******************************************************************************
+  **
+  ** Function:        set
+  **
+  ** Description:     Keep the bytes of one technology.  An entry that is
+  **                  set again reuses its space when the new bytes fit.
+  **                  kind: poll or activation bytes.
+  **                  index: index of the technology.
+  **                  data: bytes; may be NULL if len is 0.
+  **                  len: number of bytes.
+  **
+  ** Returns:         False if the index is out of range or the arena is full.
+  **
+  *******************************************************************************/
+  bool set(Kind kind, size_t index, const uint8_t* data, size_t len);
+
+  /*******************************************************************************
+  **
+  ** Function:        get
+  **
+  ** Description:     Get the bytes of one technology.
+  **                  kind: poll or activation bytes.
+  **                  index: index of the technology.
+  **                  len: receives the number of bytes.
+  **
+  ** Returns:         The bytes, valid until the next reset(); NULL if the
+  **                  entry was never set.
+  **
+  *******************************************************************************/
+  const uint8_t* get(Kind kind, size_t index, size_t* len) const;
+
+  /*******************************************************************************
+  **
+  ** Function:        used
+  **
+  ** Description:     Get the number of bytes handed out since reset().
+  **
+  ** Returns:         Number of bytes.
+  **
+  *******************************************************************************/
+  size_t used() const { return mUsed; }
+
+ private:
+  struct Span {
+    uint16_t offset;
+    uint16_t len;
+    bool valid;
+  };
+
+  uint8_t mBytes[kCapacity];
+  size_t mUsed;
+  Span mSpans[kNumKinds][kMaxEntries];
+};
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <string.h>
+
+#include "TechBytesArena.h"
+
+// Test entries of both kinds are kept apart and reset() forgets them
+TEST(TechBytesArenaTest, SetGetReset) {
+  TechBytesArena arena;
+  const uint8_t atqa[2] = {0x44, 0x00};
+  const uint8_t sak = 0x20;
+  size_t len = 0;
+  ASSERT_EQ(arena.get(TechBytesArena::Poll, 0, &len), nullptr);
+  ASSERT_TRUE(arena.set(TechBytesArena::Poll, 0, atqa, sizeof(atqa)));
+  ASSERT_TRUE(arena.set(TechBytesArena::Activation, 0, &sak, 1));
+  ASSERT_TRUE(arena.set(TechBytesArena::Activation, 1, NULL, 0));
+
+  const uint8_t* bytes = arena.get(TechBytesArena::Poll, 0, &len);
+  ASSERT_NE(bytes, nullptr);
+  ASSERT_EQ(len, 2u);
+  ASSERT_EQ(memcmp(bytes, atqa, 2), 0);
+  bytes = arena.get(TechBytesArena::Activation, 0, &len);
+  ASSERT_EQ(len, 1u);
+  ASSERT_EQ(bytes[0], sak);
+  ASSERT_NE(arena.get(TechBytesArena::Activation, 1, &len), nullptr);
+  ASSERT_EQ(len, 0u);
+
+  arena.reset();
+  ASSERT_EQ(arena.used(), 0u);
+  ASSERT_EQ(arena.get(TechBytesArena::Poll, 0, &len), nullptr);
+}
+
+// Test an entry set again reuses its space, and a full arena refuses
+TEST(TechBytesArenaTest, ReuseAndFull) {
+  TechBytesArena arena;
+  uint8_t large[TechBytesArena::kCapacity] = {};
+  ASSERT_TRUE(arena.set(TechBytesArena::Poll, 0, large, 10));
+  ASSERT_TRUE(arena.set(TechBytesArena::Poll, 0, large, 8));
+  ASSERT_EQ(arena.used(), 10u);
+  ASSERT_FALSE(arena.set(TechBytesArena::Poll, 1, large, sizeof(large)));
+  ASSERT_FALSE(arena.set(TechBytesArena::Poll, TechBytesArena::kMaxEntries,
+                         large, 1));
+  ASSERT_TRUE(arena.set(TechBytesArena::Poll, 1, large,
+                        TechBytesArena::kCapacity - 10));
+}
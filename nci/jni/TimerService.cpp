@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  One dispatch thread serving all timers of the JNI layer.
+ */
+
+#include "TimerService.h"
+
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+#include <time.h>
+
+using android::base::StringPrintf;
+
+/*******************************************************************************
+**
+** Function:        TimerService
+**
+** Description:     Initialize member variables.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+TimerService::TimerService() : mNextId(1), mThreadStarted(false) {}
+
+/*******************************************************************************
+**
+** Function:        getInstance
+**
+** Description:     Get the timer service shared by the JNI layer.
+**
+** Returns:         Reference to TimerService object.
+**
+*******************************************************************************/
+TimerService& TimerService::getInstance() {
+  // never destroyed; the dispatch thread runs until the process exits
+  static TimerService* service = new TimerService();
+  return *service;
+}
+
+/*******************************************************************************
+**
+** Function:        create
+**
+** Description:     Register a timer; it stays disarmed until arm().
+**                  cb: function run on the dispatch thread at expiry.
+**                  value: argument passed to cb.
+**
+** Returns:         Timer id; 0 on failure.
+**
+*******************************************************************************/
+TimerService::TimerId TimerService::create(TIMER_FUNC cb, union sigval value) {
+  if (cb == NULL) return 0;
+
+  Mutex::Autolock lock(mMutex);
+  if (!mThreadStarted) {
+    pthread_t thread;
+    int res = pthread_create(&thread, NULL, dispatchThread, this);
+    if (res != 0) {
+      LOG(ERROR) << StringPrintf("%s: fail create thread; error=0x%X",
+                                 __func__, res);
+      return 0;
+    }
+    pthread_detach(thread);
+    mThreadStarted = true;
+  }
+
+  TimerId id = mNextId++;
+  if (mNextId == 0) mNextId = 1;
+  Timer& timer = mTimers[id];
+  timer.cb = cb;
+  timer.value = value;
+  timer.deadlineNs = 0;
+  timer.periodNs = 0;
+  timer.generation = 0;
+  timer.armed = false;
+  return id;
+}
+
+/*******************************************************************************
+**
+** Function:        arm
+**
+** Description:     Start or restart a timer, replacing any pending expiry.
+**                  id: timer id.
+**                  ms: delay until the first expiry in milliseconds.
+**                  periodMs: interval of further expiries; 0 for one-shot.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool TimerService::arm(TimerId id, int ms, int periodMs) {
+  if ((ms < 0) || (periodMs < 0)) return false;
+
+  Mutex::Autolock lock(mMutex);
+  auto it = mTimers.find(id);
+  if (it == mTimers.end()) return false;
+
+  Timer& timer = it->second;
+  timer.generation++;
+  timer.armed = true;
+  timer.deadlineNs = nowNs() + (uint64_t)ms * 1000000;
+  timer.periodNs = (uint64_t)periodMs * 1000000;
+  bool const earliest =
+      mExpiries.empty() || (timer.deadlineNs < mExpiries.top().deadlineNs);
+  compactExpiries();
+  mExpiries.push({timer.deadlineNs, id, timer.generation});
+  // the dispatch thread only needs to recompute its sleep if this timer
+  // now expires first
+  if (earliest) mCondVar.notifyOne();
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        setCallback
+**
+** Description:     Change the function run at expiry.
+**                  id: timer id.
+**                  cb: function run on the dispatch thread at expiry.
+**
+** Returns:         True if ok.
+**
+*******************************************************************************/
+bool TimerService::setCallback(TimerId id, TIMER_FUNC cb) {
+  if (cb == NULL) return false;
+
+  Mutex::Autolock lock(mMutex);
+  auto it = mTimers.find(id);
+  if (it == mTimers.end()) return false;
+  it->second.cb = cb;
+  return true;
+}
+
+/*******************************************************************************
+**
+** Function:        disarm
+**
+** Description:     Cancel the pending expiry of a timer.
+**                  id: timer id.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void TimerService::disarm(TimerId id) {
+  Mutex::Autolock lock(mMutex);
+  auto it = mTimers.find(id);
+  if (it == mTimers.end()) return;
+  // the queued expiry becomes stale and is skipped by the dispatch thread
+  it->second.generation++;
+  it->second.armed = false;
+}
+
+/*******************************************************************************
+**
+** Function:        destroy
+**
+** Description:     Cancel and unregister a timer.
+**                  id: timer id.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void TimerService::destroy(TimerId id) {
+  Mutex::Autolock lock(mMutex);
+  mTimers.erase(id);
+}
+
+/*******************************************************************************
+**
+** Function:        isLive
+**
+** Description:     Whether a queued expiry still belongs to an armed timer,
+**                  i.e. the timer was not re-armed, disarmed or destroyed
+**                  since it was queued.  The caller must hold mMutex.
+**                  expiry: queued expiry.
+**
+** Returns:         True if the expiry is still due to fire.
+**
+*******************************************************************************/
+bool TimerService::isLive(const Expiry& expiry) {
+  auto it = mTimers.find(expiry.id);
+  return (it != mTimers.end()) && it->second.armed &&
+         (it->second.generation == expiry.generation);
+}
+
+/*******************************************************************************
+**
+** Function:        compactExpiries
+**
+** Description:     Drop stale expiries once they outnumber the timers, so
+**                  that frequent re-arming does not grow the queue.  The
+**                  caller must hold mMutex.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void TimerService::compactExpiries() {
+  if (mExpiries.size() < 2 * mTimers.size() + 16) return;
+
+  std::vector<Expiry> live;
+  while (!mExpiries.empty()) {
+    if (isLive(mExpiries.top())) live.push_back(mExpiries.top());
+    mExpiries.pop();
+  }
+  for (const Expiry& expiry : live) mExpiries.push(expiry);
+}
+
+/*******************************************************************************
+**
+** Function:        nowNs
+**
+** Description:     Read the monotonic clock.
+**
+** Returns:         Time in nanoseconds.
+**
+*******************************************************************************/
+uint64_t TimerService::nowNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*******************************************************************************
+**
+** Function:        dispatchThread
+**
+** Description:     Entry point of the dispatch thread.
+**                  arg: TimerService object.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void* TimerService::dispatchThread(void* arg) {
+  pthread_setname_np(pthread_self(), "NfcTimerService");
+  static_cast<TimerService*>(arg)->dispatch();
+  return NULL;
+}
+
+/*******************************************************************************
+**
+** Function:        dispatch
+**
+** Description:     Sleep until the earliest expiry, then run the callbacks
+**                  that are due, outside the lock.  Periodic timers are
+**                  queued again for their next period.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void TimerService::dispatch() {
+  std::vector<std::pair<TIMER_FUNC, union sigval>> due;
+
+  mMutex.lock();
+  for (;;) {
+    // drop expiries made stale by arm(), disarm() or destroy()
+    while (!mExpiries.empty() && !isLive(mExpiries.top())) mExpiries.pop();
+
+    if (mExpiries.empty()) {
+      mCondVar.wait(mMutex);
+      continue;
+    }
+
+    uint64_t const now = nowNs();
+    if (mExpiries.top().deadlineNs > now) {
+      // round up so that the timer never fires early
+      long waitMs =
+          (long)((mExpiries.top().deadlineNs - now + 999999) / 1000000);
+      mCondVar.wait(mMutex, waitMs);
+      continue;
+    }
+
+    while (!mExpiries.empty() && (mExpiries.top().deadlineNs <= now)) {
+      Expiry expiry = mExpiries.top();
+      mExpiries.pop();
+      if (!isLive(expiry)) continue;
+      Timer& timer = mTimers[expiry.id];
+      due.push_back(std::make_pair(timer.cb, timer.value));
+      if (timer.periodNs > 0) {
+        // keep the period phase-locked; skip periods missed entirely
+        timer.deadlineNs += timer.periodNs;
+        if (timer.deadlineNs <= now) {
+          timer.deadlineNs +=
+              ((now - timer.deadlineNs) / timer.periodNs + 1) * timer.periodNs;
+        }
+        mExpiries.push({timer.deadlineNs, expiry.id, timer.generation});
+      } else {
+        timer.armed = false;
+      }
+    }
+
+    mMutex.unlock();
+    for (auto& callback : due) callback.first(callback.second);
+    due.clear();
+    mMutex.lock();
+  }
+}
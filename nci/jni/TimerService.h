@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  One dispatch thread serving all timers of the JNI layer.
+ */
+
+#pragma once
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+
+#include <functional>
+#include <map>
+#include <queue>
+#include <vector>
+
+#include "CondVar.h"
+#include "Mutex.h"
+
+class TimerService {
+ public:
+  typedef void (*TIMER_FUNC)(union sigval);
+  typedef uint32_t TimerId;  // 0 is never a valid id
+
+  /*******************************************************************************
+  **
+  ** Function:        getInstance
+  **
+  ** Description:     Get the timer service shared by the JNI layer.
+  **
+  ** Returns:         Reference to TimerService object.
+  **
+  *******************************************************************************/
+  static TimerService& getInstance();
+
+  /*******************************************************************************
+  **
+  ** Function:        create
+  **
+  ** Description:     Register a timer; it stays disarmed until arm().
+  **                  cb: function run on the dispatch thread at expiry.
+  **                  value: argument passed to cb.
+  **
+  ** Returns:         Timer id; 0 on failure.
+  **
+  *******************************************************************************/
+  TimerId create(TIMER_FUNC cb, union sigval value);
+
+  /*******************************************************************************
+  **
+  ** Function:        arm
+  **
+  ** Description:     Start or restart a timer, replacing any pending expiry.
+  **                  id: timer id.
+  **                  ms: delay until the first expiry in milliseconds.
+  **                  periodMs: interval of further expiries; 0 for a
+  **                  one-shot timer.
+  **
+  ** Returns:         True if ok.
+  **
+  *******************************************************************************/
+  bool arm(TimerId id, int ms, int periodMs);
+
+  /*******************************************************************************
+  **
+  ** Function:        setCallback
+  **
+  ** Description:     Change the function run at expiry.
+  **                  id: timer id.
+  **                  cb: function run on the dispatch thread at expiry.
+  **
+  ** Returns:         True if ok.
+  **
+  *******************************************************************************/
+  bool setCallback(TimerId id, TIMER_FUNC cb);
+
+  /*******************************************************************************
+  **
+  ** Function:        disarm
+  **
+  ** Description:     Cancel the pending expiry of a timer.  A callback that
+  **                  is already running is not waited for.
+  **                  id: timer id.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void disarm(TimerId id);
+
+  /*******************************************************************************
+  **
+  ** Function:        destroy
+  **
+  ** Description:     Cancel and unregister a timer.
+  **                  id: timer id.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void destroy(TimerId id);
+
+ private:
+  struct Timer {
+    TIMER_FUNC cb;
+    union sigval value;
+    uint64_t deadlineNs;
+    uint64_t periodNs;
+    uint32_t generation;  // bumped by every arm() and disarm()
+    bool armed;
+  };
+
+  struct Expiry {
+    uint64_t deadlineNs;
+    TimerId id;
+    uint32_t generation;  // stale once the timer is re-armed
+    bool operator>(const Expiry& other) const {
+      return deadlineNs > other.deadlineNs;
+    }
+  };
+
+  TimerService();
+  static void* dispatchThread(void* arg);
+  static uint64_t nowNs();
+  void dispatch();
+  bool isLive(const Expiry& expiry);
+  void compactExpiries();
+
+  Mutex mMutex;
+  CondVar mCondVar;
+  std::map<TimerId, Timer> mTimers;
+  std::priority_queue<Expiry, std::vector<Expiry>, std::greater<Expiry>>
+      mExpiries;
+  TimerId mNextId;
+  bool mThreadStarted;
+};
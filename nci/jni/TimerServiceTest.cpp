@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "IntervalTimer.h"
+#include "TimerService.h"
+
+namespace {
+std::atomic<int> sFired(0);
+std::atomic<int> sOtherFired(0);
+
+void onTimer(union sigval) { sFired++; }
+void onOtherTimer(union sigval) { sOtherFired++; }
+
+void sleepMs(int ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// waits for a count rather than sleeping a fixed time, so a loaded machine
+// only makes the test slower
+bool waitForCount(const std::atomic<int>& counter, int count) {
+  for (int i = 0; i < 2000; i++) {
+    if (counter >= count) return true;
+    sleepMs(1);
+  }
+  return false;
+}
+}  // namespace
+
+class TimerServiceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    sFired = 0;
+    sOtherFired = 0;
+  }
+  TimerService& service = TimerService::getInstance();
+};
+
+// Test a one-shot timer fires once
+TEST_F(TimerServiceTest, OneShot) {
+  union sigval value = {};
+  TimerService::TimerId id = service.create(onTimer, value);
+  ASSERT_NE(id, 0u);
+  ASSERT_TRUE(service.arm(id, 10, 0));
+  ASSERT_TRUE(waitForCount(sFired, 1));
+  sleepMs(50);
+  ASSERT_EQ(sFired, 1);
+  service.destroy(id);
+}
+
+// Test re-arming replaces the pending expiry instead of adding one
+TEST_F(TimerServiceTest, RearmReplacesExpiry) {
+  union sigval value = {};
+  TimerService::TimerId id = service.create(onTimer, value);
+  for (int i = 0; i < 100; i++) ASSERT_TRUE(service.arm(id, 20, 0));
+  ASSERT_TRUE(waitForCount(sFired, 1));
+  sleepMs(50);
+  ASSERT_EQ(sFired, 1);
+  service.destroy(id);
+}
+
+// Test a disarmed timer does not fire
+TEST_F(TimerServiceTest, Disarm) {
+  union sigval value = {};
+  TimerService::TimerId id = service.create(onTimer, value);
+  ASSERT_TRUE(service.arm(id, 20, 0));
+  service.disarm(id);
+  sleepMs(60);
+  ASSERT_EQ(sFired, 0);
+  service.destroy(id);
+  ASSERT_FALSE(service.arm(id, 20, 0));
+}
+
+// Test a periodic timer keeps firing until disarmed
+TEST_F(TimerServiceTest, Periodic) {
+  union sigval value = {};
+  TimerService::TimerId id = service.create(onTimer, value);
+  ASSERT_TRUE(service.arm(id, 10, 10));
+  ASSERT_TRUE(waitForCount(sFired, 3));
+  service.disarm(id);
+  // a callback already dispatched may still finish
+  sleepMs(20);
+  int fired = sFired;
+  sleepMs(50);
+  ASSERT_EQ(sFired, fired);
+  service.destroy(id);
+}
+
+// Test IntervalTimer switches callback without losing its timer
+TEST_F(TimerServiceTest, IntervalTimerChangeCallback) {
+  IntervalTimer timer;
+  ASSERT_TRUE(timer.set(50, onTimer));
+  ASSERT_TRUE(timer.set(10, onOtherTimer));
+  ASSERT_TRUE(waitForCount(sOtherFired, 1));
+  sleepMs(60);
+  ASSERT_EQ(sFired, 0);
+  ASSERT_EQ(sOtherFired, 1);
+  timer.kill();
+  ASSERT_TRUE(timer.set(10, onTimer));
+  ASSERT_TRUE(waitForCount(sFired, 1));
+}
+
+// Test IntervalTimer::disarm() cancels the expiry and set() re-arms it
+TEST_F(TimerServiceTest, IntervalTimerDisarm) {
+  IntervalTimer timer;
+  ASSERT_TRUE(timer.set(20, onTimer));
+  timer.disarm();
+  sleepMs(60);
+  ASSERT_EQ(sFired, 0);
+  ASSERT_TRUE(timer.set(10, onTimer));
+  ASSERT_TRUE(waitForCount(sFired, 1));
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Lock-free ring of the timings of the latest transceive calls.
+ */
+
+#include "TransceiveTrace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// the binary trace handed to Java relies on this layout
+static_assert(sizeof(TransceiveTrace::Record) == 32,
+              "a record must be 32 octets");
+
+/*******************************************************************************
+**
+** Function:        TransceiveTrace
+**
+** Description:     Initialize member variables.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+TransceiveTrace::TransceiveTrace() : mNext(0) {
+  for (size_t i = 0; i < kCapacity; i++) {
+    mSlots[i].seq.store(0, std::memory_order_relaxed);
+    for (size_t w = 0; w < kWords; w++)
+      mSlots[i].words[w].store(0, std::memory_order_relaxed);
+  }
+}
+
+/*******************************************************************************
+**
+** Function:        getInstance
+**
+** Description:     Get the trace of tag transceive calls.
+**
+** Returns:         Reference to TransceiveTrace object.
+**
+*******************************************************************************/
+TransceiveTrace& TransceiveTrace::getInstance() {
+  static TransceiveTrace trace;
+  return trace;
+}
+
+/*******************************************************************************
+**
+** Function:        add
+**
+** Description:     Add a record, overwriting the oldest one when the ring
+**                  is full.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void TransceiveTrace::add(const Record& record) {
+  uint64_t words[kWords];
+  memcpy(words, &record, sizeof(words));
+
+  uint64_t const index = mNext.fetch_add(1, std::memory_order_relaxed);
+  Slot& slot = mSlots[index % kCapacity];
+  uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+  // a writer a whole ring behind still owns the slot; drop this record
+  if ((seq & 1) || !slot.seq.compare_exchange_strong(
+                       seq, 2 * index + 1, std::memory_order_relaxed))
+    return;
+  std::atomic_thread_fence(std::memory_order_release);
+  for (size_t w = 0; w < kWords; w++)
+    slot.words[w].store(words[w], std::memory_order_relaxed);
+  slot.seq.store(2 * index + 2, std::memory_order_release);
+}
+
+/*******************************************************************************
+**
+** Function:        snapshot
+**
+** Description:     Copy the records, oldest first.
+**
+** Returns:         Number of records copied.
+**
+*******************************************************************************/
+size_t TransceiveTrace::snapshot(Record* records, size_t maxRecords) const {
+  uint64_t const next = mNext.load(std::memory_order_acquire);
+  uint64_t index = (next > kCapacity) ? next - kCapacity : 0;
+  size_t count = 0;
+  for (; (index < next) && (count < maxRecords); index++) {
+    const Slot& slot = mSlots[index % kCapacity];
+    if (slot.seq.load(std::memory_order_acquire) != 2 * index + 2) continue;
+    uint64_t words[kWords];
+    for (size_t w = 0; w < kWords; w++)
+      words[w] = slot.words[w].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // overwritten while being copied
+    if (slot.seq.load(std::memory_order_relaxed) != 2 * index + 2) continue;
+    memcpy(&records[count++], words, sizeof(words));
+  }
+  return count;
+}
+
+/*******************************************************************************
+**
+** Function:        dump
+**
+** Description:     Write the records to a file descriptor.
+**
+** Returns:         None.
+**
+*******************************************************************************/
+void TransceiveTrace::dump(int fd) const {
+  Record records[kCapacity];
+  size_t const count = snapshot(records, kCapacity);
+  dprintf(fd, "Transceive trace (us after entry):\n");
+  for (size_t i = 0; i < count; i++) {
+    const Record& r = records[i];
+    dprintf(fd,
+            "  %llu.%06llu tx=%u rx=%u sent=%u callback=%u return=%u "
+            "status=%u flags=0x%02x\n",
+            (unsigned long long)(r.entryNs / 1000000000),
+            (unsigned long long)(r.entryNs % 1000000000 / 1000), r.txLen,
+            r.rxLen, r.sentUs, r.callbackUs, r.returnUs, r.status, r.flags);
+  }
+}
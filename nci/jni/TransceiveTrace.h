@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *  Lock-free ring of the timings of the latest transceive calls.
+ */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+class TransceiveTrace {
+ public:
+  static constexpr size_t kCapacity = 64;
+
+  // flags of a record
+  static constexpr uint8_t kNotSent = 0x01;   // NFA_SendRawFrame failed
+  static constexpr uint8_t kTimeout = 0x02;   // no response in time
+  static constexpr uint8_t kTagLost = 0x04;   // tag was not active
+  static constexpr uint8_t kNack = 0x08;      // T2T NACK response
+
+  // one call; this is also the layout of the binary trace, in host byte
+  // order.  Times are microseconds after entryNs; 0 if not reached.
+  struct Record {
+    uint64_t entryNs;     // JNI entry, CLOCK_MONOTONIC
+    uint32_t sentUs;      // NFA_SendRawFrame returned
+    uint32_t callbackUs;  // first response callback
+    uint32_t returnUs;    // JNI return
+    uint32_t txLen;       // octets sent
+    uint32_t rxLen;       // octets received
+    uint8_t status;       // status of the response
+    uint8_t flags;
+    uint16_t reserved;
+  };
+
+  /*******************************************************************************
+  **
+  ** Function:        TransceiveTrace
+  **
+  ** Description:     Initialize member variables.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  TransceiveTrace();
+
+  /*******************************************************************************
+  **
+  ** Function:        getInstance
+  **
+  ** Description:     Get the trace of tag transceive calls.
+  **
+  ** Returns:         Reference to TransceiveTrace object.
+  **
+  *******************************************************************************/
+  static TransceiveTrace& getInstance();
+
+  /*******************************************************************************
+  **
+  ** Function:        add
+  **
+  ** Description:     Add a record, overwriting the oldest one when the ring
+  **                  is full.  Never blocks; any thread may add.  The record
+  **                  is dropped if its slot is still being written by a
+  **                  call a whole ring earlier.
+  **                  record: record to add.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void add(const Record& record);
+
+  /*******************************************************************************
+  **
+  ** Function:        snapshot
+  **
+  ** Description:     Copy the records, oldest first.  Records being
+  **                  written or overwritten during the copy are left out.
+  **                  records: receives the records.
+  **                  maxRecords: capacity of records.
+  **
+  ** Returns:         Number of records copied.
+  **
+  *******************************************************************************/
+  size_t snapshot(Record* records, size_t maxRecords) const;
+
+  /*******************************************************************************
+  **
+  ** Function:        dump
+  **
+  ** Description:     Write the records to a file descriptor.
+  **                  fd: file descriptor.
+  **
+  ** Returns:         None.
+  **
+  *******************************************************************************/
+  void dump(int fd) const;
+
+ private:
+  static constexpr size_t kWords = sizeof(Record) / sizeof(uint64_t);
+
+  // a record guarded by a sequence number: 2 * index + 1 while record
+  // number index is written, 2 * index + 2 once it is complete
+  struct Slot {
+    std::atomic<uint64_t> seq;
+    std::atomic<uint64_t> words[kWords];
+  };
+
+  std::atomic<uint64_t> mNext;  // index of the next record
+  Slot mSlots[kCapacity];
+};
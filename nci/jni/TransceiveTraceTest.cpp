@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "TransceiveTrace.h"
+
+static TransceiveTrace::Record makeRecord(uint32_t txLen) {
+  TransceiveTrace::Record record = {};
+  record.entryNs = 1000000000ull * txLen;
+  record.txLen = txLen;
+  record.rxLen = txLen + 2;
+  record.sentUs = 10;
+  record.returnUs = 20;
+  return record;
+}
+
+// Test records come back oldest first and the oldest are overwritten
+TEST(TransceiveTraceTest, Wraps) {
+  std::unique_ptr<TransceiveTrace> trace(new TransceiveTrace());
+  TransceiveTrace::Record records[TransceiveTrace::kCapacity];
+  ASSERT_EQ(trace->snapshot(records, TransceiveTrace::kCapacity), 0u);
+
+  size_t const added = TransceiveTrace::kCapacity + 5;
+  for (size_t i = 1; i <= added; i++) trace->add(makeRecord(i));
+  ASSERT_EQ(trace->snapshot(records, TransceiveTrace::kCapacity),
+            TransceiveTrace::kCapacity);
+  ASSERT_EQ(records[0].txLen, 6u);
+  ASSERT_EQ(records[TransceiveTrace::kCapacity - 1].txLen, added);
+  ASSERT_EQ(records[0].rxLen, 8u);
+}
+
+// Test concurrent writers never produce a torn record
+TEST(TransceiveTraceTest, ConcurrentAdd) {
+  std::unique_ptr<TransceiveTrace> trace(new TransceiveTrace());
+  std::vector<std::thread> writers;
+  for (uint32_t t = 1; t <= 4; t++) {
+    writers.emplace_back([&trace, t] {
+      for (int i = 0; i < 10000; i++) trace->add(makeRecord(t));
+    });
+  }
+  TransceiveTrace::Record records[TransceiveTrace::kCapacity];
+  for (int i = 0; i < 1000; i++) {
+    size_t count = trace->snapshot(records, TransceiveTrace::kCapacity);
+    for (size_t r = 0; r < count; r++) {
+      ASSERT_EQ(records[r].rxLen, records[r].txLen + 2);
+      ASSERT_EQ(records[r].entryNs, 1000000000ull * records[r].txLen);
+    }
+  }
+  for (auto& writer : writers) writer.join();
+}
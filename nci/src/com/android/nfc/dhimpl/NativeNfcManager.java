@@ -411,6 +411,14 @@ public class NativeNfcManager implements DeviceHost {
 
     private native void doDump(FileDescriptor fd);
 
+    /**
+     * Returns the timings of the latest tag transceive calls, oldest first, as
+     * 32-octet records in native byte order: u64 entry time in ns, then u32
+     * sent, callback and return times in us after entry, u32 octets sent and
+     * received, u8 status, u8 flags and two reserved octets.
+     */
+    public native byte[] doGetTransceiveTrace();
+
     @Override
     public void dump(PrintWriter pw, FileDescriptor fd) {
         pw.println("Native Proprietary Caps=" + mProprietaryCaps);
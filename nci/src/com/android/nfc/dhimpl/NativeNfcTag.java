@@ -31,10 +31,14 @@ import android.nfc.tech.NfcV;
 import android.nfc.tech.TagTechnology;
 import android.os.Bundle;
 import android.util.Log;
+import android.util.SparseArray;
 
 import com.android.nfc.DeviceHost;
 import com.android.nfc.DeviceHost.TagEndpoint;
 
+import java.nio.ByteBuffer;
+import java.util.concurrent.Executor;
+
 /** Native interface to the NFC tag functions */
 public class NativeNfcTag implements TagEndpoint {
     static final boolean DBG = true;
@@ -69,7 +73,23 @@ public class NativeNfcTag implements TagEndpoint {
 
     private boolean mIsPresent; // Whether the tag is known to be still present
 
-    private PresenceCheckWatchdog mWatchdog;
+    private volatile PresenceCheckWatchdog mWatchdog;
+
+    public NativeNfcTag() {}
+
+    /**
+     * Called from native code when a tag is activated, with all members resolved at once so
+     * that no field has to be looked up and set one by one.
+     */
+    private NativeNfcTag(int[] techList, int[] techHandles, int[] techLibNfcTypes,
+            byte[][] techPollBytes, byte[][] techActBytes, byte[] uid) {
+        mTechList = techList;
+        mTechHandles = techHandles;
+        mTechLibNfcTypes = techLibNfcTypes;
+        mTechPollBytes = techPollBytes;
+        mTechActBytes = techActBytes;
+        mUid = uid;
+    }
 
     class PresenceCheckWatchdog extends Thread {
 
@@ -80,6 +100,11 @@ public class NativeNfcTag implements TagEndpoint {
         private boolean isStopped = false;
         private boolean isPaused = false;
         private boolean doCheck = true;
+        private volatile boolean isLost = false;
+        // Guards isLooping, so that tagLost() never interrupts the thread once it has left
+        // the presence check loop
+        private final Object loopLock = new Object();
+        private boolean isLooping = true;
 
         PresenceCheckWatchdog(
                 int presenceCheckDelay, @Nullable DeviceHost.TagDisconnectedCallback callback) {
@@ -105,6 +130,19 @@ public class NativeNfcTag implements TagEndpoint {
             this.notifyAll();
         }
 
+        /**
+         * Ends the watchdog because the tag was deactivated. Does not take the watchdog lock,
+         * since a presence check may be running under it.
+         */
+        public void tagLost() {
+            isLost = true;
+            synchronized (loopLock) {
+                if (isLooping) {
+                    interrupt();
+                }
+            }
+        }
+
         public synchronized void end(boolean disableCallback) {
             isStopped = true;
             doCheck = false;
@@ -118,12 +156,12 @@ public class NativeNfcTag implements TagEndpoint {
         public void run() {
             synchronized (this) {
                 if (DBG) Log.d(TAG, "Starting background presence check");
-                while (isPresent && !isStopped) {
+                while (isPresent && !isStopped && !isLost) {
                     try {
                         if (!isPaused) {
                             doCheck = true;
                         }
-                        this.wait(watchdogTimeout);
+                        this.wait(doGetPresenceCheckDelay(watchdogTimeout));
                         if (doCheck) {
                             isPresent = doPresenceCheck();
                         } else {
@@ -139,6 +177,12 @@ public class NativeNfcTag implements TagEndpoint {
                     }
                 }
             }
+            synchronized (loopLock) {
+                isLooping = false;
+            }
+            // Drop an interrupt that arrived after the last wait, so that it does not
+            // break waits in doDisconnect() or the disconnect callback
+            Thread.interrupted();
 
             synchronized (NativeNfcTag.this) {
                 mIsPresent = false;
@@ -154,6 +198,16 @@ public class NativeNfcTag implements TagEndpoint {
         }
     }
 
+    private native int doGetPresenceCheckDelay(int baseDelay);
+
+    /** Called from native code when the tag is deactivated. */
+    private void onTagLost() {
+        PresenceCheckWatchdog watchdog = mWatchdog;
+        if (watchdog != null) {
+            watchdog.tagLost();
+        }
+    }
+
     private native int doConnect(int handle);
 
     public synchronized int connectWithStatus(int technology) {
@@ -319,6 +373,158 @@ public class NativeNfcTag implements TagEndpoint {
         return result;
     }
 
+    /** Receives the result of {@link #transceiveAsync}. */
+    public interface TransceiveCallback {
+        /**
+         * @param response response of the tag, or null if the transceive failed
+         * @param status 0 on success, {@link #STATUS_CODE_TARGET_LOST} if the tag did not
+         *     answer in time or was lost, another value on other failures
+         */
+        void onTransceiveComplete(byte[] response, int status);
+    }
+
+    // callbacks of asynchronous transceives in flight, by request id
+    private final SparseArray<TransceiveCallback> mTransceiveCallbacks = new SparseArray<>();
+
+    private native int doTransceiveAsync(byte[] data);
+
+    /**
+     * Sends raw data to the tag and returns without waiting for the response. One transceive
+     * can be in flight at a time.
+     *
+     * <p>The native thread that reports the result also delivers every response of the tag,
+     * so callback runs on executor instead: a transceive issued from the callback would
+     * otherwise wait for its own response forever.
+     *
+     * @return false if the data was not sent; callback is then never called
+     */
+    public synchronized boolean transceiveAsync(
+            byte[] data, Executor executor, TransceiveCallback callback) {
+        if (mWatchdog != null) {
+            mWatchdog.pause();
+        }
+        TransceiveCallback posted = (response, status) ->
+                executor.execute(() -> callback.onTransceiveComplete(response, status));
+        int id;
+        synchronized (mTransceiveCallbacks) {
+            // held until the callback is stored, so a fast completion finds it
+            id = doTransceiveAsync(data);
+            if (id != 0) {
+                mTransceiveCallbacks.put(id, posted);
+            }
+        }
+        if (id == 0 && mWatchdog != null) {
+            mWatchdog.doResume();
+        }
+        return id != 0;
+    }
+
+    /**
+     * Called from native code when an asynchronous transceive ends, on the thread that
+     * delivers tag responses; the callback itself is posted to its executor.
+     */
+    private void onTransceiveComplete(int id, byte[] response, int status) {
+        TransceiveCallback callback;
+        synchronized (mTransceiveCallbacks) {
+            callback = mTransceiveCallbacks.get(id);
+            mTransceiveCallbacks.remove(id);
+        }
+        // no presence check holds the watchdog lock: it was paused for the transceive
+        PresenceCheckWatchdog watchdog = mWatchdog;
+        if (watchdog != null) {
+            watchdog.doResume();
+        }
+        if (callback != null) {
+            callback.onTransceiveComplete(response, status);
+        }
+    }
+
+    private native byte[] doTransceiveChained(byte[] data, int[] returnCode);
+
+    /**
+     * Like {@link #transceive(byte[], boolean, int[])}, but for an ISO-DEP tag can also chain
+     * natively: a command longer than the controller's limit is sent as a command chain, 61xx
+     * is followed by GET RESPONSE and 6Cxx repeats the command with the right Le.
+     *
+     * @param chain whether to chain; only takes effect for ISO-DEP
+     * @return response data of all parts followed by the final status word
+     */
+    public synchronized byte[] transceive(byte[] data, boolean raw, boolean chain,
+            int[] returnCode) {
+        if (!chain || getConnectedTechnology() != TagTechnology.ISO_DEP) {
+            return transceive(data, raw, returnCode);
+        }
+        if (mWatchdog != null) {
+            mWatchdog.pause();
+        }
+        byte[] result = doTransceiveChained(data, returnCode);
+        if (mWatchdog != null) {
+            mWatchdog.doResume();
+        }
+        return result;
+    }
+
+    private native int doTransceiveDirect(ByteBuffer cmd, int cmdOffset, int cmdLen,
+            ByteBuffer rsp, int rspOffset, int rspMax, int[] returnCode);
+
+    /**
+     * Sends the remaining bytes of cmd to the tag and writes the response at the position of
+     * rsp, without allocating arrays.
+     *
+     * <p>On success the position of cmd moves to its limit and the position of rsp moves past
+     * the response. The response is written to rsp as it arrives, so on failure the remaining
+     * bytes of rsp may have been overwritten.
+     *
+     * @param cmd direct buffer holding the command
+     * @param rsp direct buffer receiving the response; its remaining bytes must fit it
+     * @param returnCode set to 1 in its first element if the tag was lost
+     * @return length of the response, or -1 if the transceive failed, the tag answered with
+     *     nothing or a NACK, or the response did not fit
+     */
+    public synchronized int transceive(ByteBuffer cmd, ByteBuffer rsp, int[] returnCode) {
+        if (!cmd.isDirect() || !rsp.isDirect()) {
+            throw new IllegalArgumentException("direct buffers required");
+        }
+        if (mWatchdog != null) {
+            mWatchdog.pause();
+        }
+        int len = doTransceiveDirect(cmd, cmd.position(), cmd.remaining(),
+                rsp, rsp.position(), rsp.remaining(), returnCode);
+        if (mWatchdog != null) {
+            mWatchdog.doResume();
+        }
+        if (len >= 0) {
+            cmd.position(cmd.limit());
+            rsp.position(rsp.position() + len);
+        }
+        return len;
+    }
+
+    private native byte[][] doTransceiveBatch(byte[][] cmds, int stopOnSwMask,
+            int[] returnCode);
+
+    /**
+     * Sends several APDUs to an ISO-DEP tag in one native call.
+     *
+     * @param cmds APDUs to send in order
+     * @param stopOnSwMask bits of the status word compared with 9000; the batch stops after
+     *     the first response that differs in these bits, or runs every APDU if 0
+     * @param returnCode set to 1 in its first element if the tag was lost
+     * @return responses in the order of cmds, null where an APDU was not run or failed;
+     *     null if the tag is not active or not ISO-DEP, or an APDU is null or empty
+     */
+    public synchronized byte[][] transceiveBatch(byte[][] cmds, int stopOnSwMask,
+            int[] returnCode) {
+        if (mWatchdog != null) {
+            mWatchdog.pause();
+        }
+        byte[][] result = doTransceiveBatch(cmds, stopOnSwMask, returnCode);
+        if (mWatchdog != null) {
+            mWatchdog.doResume();
+        }
+        return result;
+    }
+
     private native int doCheckNdef(int[] ndefinfo);
 
     private synchronized int checkNdefWithStatus(int[] ndefinfo) {
@@ -357,6 +563,38 @@ public class NativeNfcTag implements TagEndpoint {
         return result;
     }
 
+    /** Receives an NDEF message in chunks from {@link #readNdefStreaming}. */
+    public interface NdefChunkListener {
+        /**
+         * @param chunk next part of the message
+         * @param offset position of the chunk in the message
+         * @param total length of the whole message
+         * @return false to stop reading
+         */
+        boolean onNdefChunk(byte[] chunk, int offset, int total);
+    }
+
+    private native int doReadStreaming(NdefChunkListener listener, int chunkSize);
+
+    /**
+     * Reads the NDEF message on the tag and hands it to listener in chunks of at most
+     * chunkSize bytes as they arrive. For a type 4 tag the message is read in parts, so
+     * native memory stays bounded by the chunk size; other tags are read whole and then
+     * handed over in chunks.
+     *
+     * @return length of the message, or -1 if the read failed or the listener stopped it
+     */
+    public synchronized int readNdefStreaming(NdefChunkListener listener, int chunkSize) {
+        if (mWatchdog != null) {
+            mWatchdog.pause();
+        }
+        int result = doReadStreaming(listener, chunkSize);
+        if (mWatchdog != null) {
+            mWatchdog.doResume();
+        }
+        return result;
+    }
+
     private native boolean doWrite(byte[] buf);
 
     @Override